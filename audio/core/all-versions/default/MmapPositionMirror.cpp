@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "MmapPositionMirrorHAL"
+
+#include "core/default/MmapPositionMirror.h"
+
+//#define LOG_NDEBUG 0
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <new>
+
+#include <android/log.h>
+#include <cutils/ashmem.h>
+#include <cutils/properties.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+namespace {
+
+// Faster polling than this would cost more than the binder calls it replaces.
+constexpr int32_t kMaxUpdateRateHz = 2000;
+
+}  // namespace
+
+// static
+sp<MmapPositionMirror> MmapPositionMirror::create(PositionGetter getter) {
+    int32_t rateHz = property_get_int32("ro.vendor.audio.hal.mmap_position_mirror_hz", 0);
+    if (rateHz <= 0 || !getter) return nullptr;
+    if (rateHz > kMaxUpdateRateHz) rateHz = kMaxUpdateRateHz;
+
+    const size_t size = getpagesize();
+    int fd = ashmem_create_region("audio_mmap_position", size);
+    if (fd < 0) {
+        ALOGE("failed to create position page: %s", strerror(errno));
+        return nullptr;
+    }
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        ALOGE("failed to map position page: %s", strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+    // Clients may only map the page for reading.
+    if (ashmem_set_prot_region(fd, PROT_READ) != 0) {
+        ALOGE("failed to protect position page: %s", strerror(errno));
+        munmap(data, size);
+        close(fd);
+        return nullptr;
+    }
+
+    const nsecs_t period = s2ns(1) / rateHz;
+    auto page = new (data) MmapPositionPage();
+    page->magic = MmapPositionPage::kMagic;
+    page->version = MmapPositionPage::kVersion;
+    page->updatePeriodUs = static_cast<uint32_t>(ns2us(period));
+
+    sp<MmapPositionMirror> mirror = new MmapPositionMirror(std::move(getter), fd, page, period);
+    status_t status = mirror->run("mmap_position", PRIORITY_URGENT_AUDIO);
+    if (status != OK) {
+        ALOGE("failed to start position mirror thread: %s", strerror(-status));
+        return nullptr;
+    }
+    return mirror;
+}
+
+MmapPositionMirror::MmapPositionMirror(PositionGetter getter, int fd, MmapPositionPage* page,
+                                       nsecs_t period)
+    : Thread(false /*canCallJava*/),
+      mGetter(std::move(getter)),
+      mFd(fd),
+      mPage(page),
+      mPeriod(period) {}
+
+MmapPositionMirror::~MmapPositionMirror() {
+    munmap(mPage, getpagesize());
+    close(mFd);
+}
+
+void MmapPositionMirror::setActive(bool active) {
+    Mutex::Autolock _l(mLock);
+    if (mActive == active) return;
+    mActive = active;
+    if (!active) {
+        publish(0, 0, systemTime());
+    }
+    mCondition.signal();
+}
+
+void MmapPositionMirror::exit() {
+    {
+        Mutex::Autolock _l(mLock);
+        requestExit();
+        mCondition.signal();
+    }
+    join();
+}
+
+bool MmapPositionMirror::threadLoop() {
+    {
+        Mutex::Autolock _l(mLock);
+        while (!mActive && !exitPending()) {
+            mCondition.wait(mLock);
+        }
+        if (exitPending()) return false;
+    }
+
+    // Query the HAL without holding the lock so that stop() is not delayed.
+    struct audio_mmap_position halPosition;
+    int result = mGetter(&halPosition);
+    const nsecs_t now = systemTime();
+    ALOGV_IF(result != 0, "get_mmap_position failed: %d", result);
+
+    Mutex::Autolock _l(mLock);
+    // The stream may have been stopped while the HAL was queried, and the
+    // page must then keep reporting that no position is available.
+    if (result == 0 && mActive) {
+        publish(halPosition.time_nanoseconds, halPosition.position_frames, now);
+    }
+    if (!exitPending()) {
+        mCondition.waitRelative(mLock, mPeriod);
+    }
+    return !exitPending();
+}
+
+// Called with mLock held, which makes this the only writer of the page.
+void MmapPositionMirror::publish(int64_t timeNs, int32_t frames, int64_t updateTimeNs) {
+    uint32_t sequence = mPage->sequence.load(std::memory_order_relaxed);
+    mPage->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    mPage->timeNanoseconds.store(timeNs, std::memory_order_relaxed);
+    mPage->positionFrames.store(frames, std::memory_order_relaxed);
+    mPage->updateTimeNanoseconds.store(updateTimeNs, std::memory_order_relaxed);
+    mPage->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
@@ -18,6 +18,14 @@
 #include "core/default/Conversions.h"
 #include "core/default/Util.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <array>
+
+#include <cutils/properties.h>
 #include <system/audio.h>
 
 namespace android {
@@ -45,6 +53,119 @@ static Result getHalStatusToResult(status_t status) {
     }
 }
 
+namespace {
+
+/** In-place view of a "key1=value1;key2=value2" string as produced by the
+ * legacy HAL. Keys without '=' have an empty value, empty keys are skipped,
+ * and for duplicate keys the last value wins, like AudioParameter does.
+ * Keys and values are NUL-terminated in place, so that they can be handed
+ * out without copying. Up to kInlineEntries pairs are parsed without touching
+ * the heap.
+ */
+class KeyValueView {
+   public:
+    struct Entry {
+        const char* key;
+        size_t keyLength;
+        const char* value;
+        size_t valueLength;
+    };
+
+    explicit KeyValueView(char* str) {
+        if (str == nullptr) return;
+        while (*str != '\0') {
+            char* end = strchrnul(str, ';');
+            char* eq = static_cast<char*>(memchr(str, '=', end - str));
+            char* keyEnd = eq != nullptr ? eq : end;
+            char* next = *end == ';' ? end + 1 : end;
+            if (keyEnd != str) {
+                add({str, size_t(keyEnd - str), eq != nullptr ? eq + 1 : end,
+                     size_t(eq != nullptr ? end - eq - 1 : 0)});
+            }
+            *keyEnd = '\0';
+            *end = '\0';
+            str = next;
+        }
+    }
+
+    size_t size() const { return mSize; }
+    const Entry& operator[](size_t i) const {
+        return i < kInlineEntries ? mInline[i] : mOverflow[i - kInlineEntries];
+    }
+
+   private:
+    static constexpr size_t kInlineEntries = 16;
+
+    Entry& at(size_t i) { return i < kInlineEntries ? mInline[i] : mOverflow[i - kInlineEntries]; }
+
+    void add(const Entry& entry) {
+        for (size_t i = 0; i < mSize; ++i) {
+            Entry& existing = at(i);
+            if (existing.keyLength == entry.keyLength &&
+                strncmp(existing.key, entry.key, entry.keyLength) == 0) {
+                existing = entry;
+                return;
+            }
+        }
+        if (mSize < kInlineEntries) {
+            mInline[mSize] = entry;
+        } else {
+            mOverflow.push_back(entry);
+        }
+        ++mSize;
+    }
+
+    std::array<Entry, kInlineEntries> mInline;
+    std::vector<Entry> mOverflow;
+    size_t mSize = 0;
+};
+
+}  // namespace
+
+ParametersUtil::ParametersUtil() {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("ro.vendor.audio.hal.immutable_params", value, "");
+    char* saveptr = nullptr;
+    for (char* key = strtok_r(value, ",", &saveptr); key != nullptr;
+         key = strtok_r(nullptr, ",", &saveptr)) {
+        mImmutableKeys.emplace_back(key);
+    }
+}
+
+bool ParametersUtil::isImmutable(const char* key) const {
+    return std::find(mImmutableKeys.begin(), mImmutableKeys.end(), key) != mImmutableKeys.end();
+}
+
+bool ParametersUtil::appendCachedValue(const char* key, std::string* value) {
+    if (!isImmutable(key)) return false;
+    std::lock_guard<std::mutex> lock(mCacheLock);
+    for (const auto& entry : mCache) {
+        if (entry.first == key) {
+            value->append(entry.second);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ParametersUtil::cacheValue(const char* key, const char* value, size_t valueLength) {
+    if (!isImmutable(key)) return;
+    std::lock_guard<std::mutex> lock(mCacheLock);
+    for (auto& entry : mCache) {
+        if (entry.first == key) {
+            entry.second.assign(value, valueLength);
+            return;
+        }
+    }
+    mCache.emplace_back(key, std::string(value, valueLength));
+}
+
+void ParametersUtil::clearCache() {
+    if (mImmutableKeys.empty()) return;
+    std::lock_guard<std::mutex> lock(mCacheLock);
+    mCache.clear();
+}
+
 Result ParametersUtil::getParam(const char* name, bool* value) {
     String8 halValue;
     Result retval = getParam(name, &halValue);
@@ -59,23 +180,46 @@ Result ParametersUtil::getParam(const char* name, bool* value) {
 }
 
 Result ParametersUtil::getParam(const char* name, int* value) {
-    const String8 halName(name);
-    AudioParameter keys;
-    keys.addKey(halName);
-    std::unique_ptr<AudioParameter> params = getParams(keys);
-    return getHalStatusToResult(params->getInt(halName, *value));
+    String8 halValue;
+    Result retval = getParam(name, &halValue);
+    *value = 0;
+    if (retval != Result::OK) {
+        return retval;
+    }
+    // Same conversion rules as AudioParameter::getInt
+    int converted;
+    if (sscanf(halValue.string(), "%d", &converted) != 1) {
+        return getHalStatusToResult(INVALID_OPERATION);
+    }
+    *value = converted;
+    return Result::OK;
 }
 
 Result ParametersUtil::getParam(const char* name, String8* value, AudioParameter context) {
+    const bool hasContext = context.size() != 0;
+    std::string cached;
+    if (!hasContext && appendCachedValue(name, &cached)) {
+        value->setTo(cached.c_str(), cached.size());
+        return Result::OK;
+    }
     const String8 halName(name);
     context.addKey(halName);
     std::unique_ptr<AudioParameter> params = getParams(context);
-    return getHalStatusToResult(params->get(halName, *value));
+    Result retval = getHalStatusToResult(params->get(halName, *value));
+    if (!hasContext && retval == Result::OK) {
+        cacheValue(name, value->string(), value->size());
+    }
+    return retval;
 }
 
 void ParametersUtil::getParametersImpl(
     const hidl_vec<ParameterValue>& context, const hidl_vec<hidl_string>& keys,
     std::function<void(Result retval, const hidl_vec<ParameterValue>& parameters)> cb) {
+    if (context.size() == 0 && keys.size() != 0) {
+        getParametersNoContext(keys, cb);
+        return;
+    }
+
     AudioParameter halKeys;
     for (auto& pair : context) {
         halKeys.add(String8(pair.key.c_str()), String8(pair.value.c_str()));
@@ -102,6 +246,68 @@ void ParametersUtil::getParametersImpl(
     cb(retval, result);
 }
 
+// Serves cached keys locally, fetches the rest with a single HAL call and
+// parses the reply in place instead of going through AudioParameter. The
+// reply points into the request, the HAL reply and per-instance buffers that
+// keep their capacity, so once they have grown nothing is allocated here
+// beyond what the HAL itself allocates.
+void ParametersUtil::getParametersNoContext(
+    const hidl_vec<hidl_string>& keys,
+    std::function<void(Result retval, const hidl_vec<ParameterValue>& parameters)> cb) {
+    std::lock_guard<std::mutex> lock(mGetBuffersLock);
+    mKeysBuffer.clear();
+    mValuesBuffer.clear();
+    mCachedValueOffsets.clear();
+    mResultBuffer.clear();
+
+    for (size_t i = 0; i < keys.size(); ++i) {
+        const hidl_string& key = keys[i];
+        if (std::find(keys.begin(), keys.begin() + i, key) != keys.begin() + i) {
+            continue;  // Only query a repeated key once
+        }
+        const size_t valueOffset = mValuesBuffer.size();
+        if (appendCachedValue(key.c_str(), &mValuesBuffer)) {
+            mValuesBuffer.push_back('\0');
+            mCachedValueOffsets.push_back(valueOffset);
+            mResultBuffer.emplace_back();
+            mResultBuffer.back().key.setToExternal(key.c_str(), key.size());
+            continue;
+        }
+        if (!mKeysBuffer.empty()) mKeysBuffer += ';';
+        mKeysBuffer += key.c_str();
+    }
+    // mValuesBuffer is complete, so its contents no longer move
+    for (size_t i = 0; i < mCachedValueOffsets.size(); ++i) {
+        const char* value = mValuesBuffer.c_str() + mCachedValueOffsets[i];
+        mResultBuffer[i].value.setToExternal(value, strlen(value));
+    }
+
+    char* halValues = mKeysBuffer.empty() ? nullptr : halGetParameters(mKeysBuffer.c_str());
+    KeyValueView view(halValues);
+    for (size_t i = 0; i < view.size(); ++i) {
+        const auto& entry = view[i];
+        mResultBuffer.emplace_back();
+        mResultBuffer.back().key.setToExternal(entry.key, entry.keyLength);
+        mResultBuffer.back().value.setToExternal(entry.value, entry.valueLength);
+        cacheValue(entry.key, entry.value, entry.valueLength);
+    }
+
+    // AudioParameter reports keys sorted and without duplicates; keep doing so.
+    std::sort(mResultBuffer.begin(), mResultBuffer.end(), [](const auto& a, const auto& b) {
+        return strcmp(a.key.c_str(), b.key.c_str()) < 0;
+    });
+    mResultBuffer.erase(std::unique(mResultBuffer.begin(), mResultBuffer.end(),
+                                    [](const auto& a, const auto& b) { return a.key == b.key; }),
+                        mResultBuffer.end());
+
+    Result retval =
+        (keys.size() == 0 || mResultBuffer.size() != 0) ? Result::OK : Result::NOT_SUPPORTED;
+    hidl_vec<ParameterValue> result;
+    result.setToExternal(mResultBuffer.data(), mResultBuffer.size());
+    cb(retval, result);
+    free(halValues);
+}
+
 std::unique_ptr<AudioParameter> ParametersUtil::getParams(const AudioParameter& keys) {
     String8 paramsAndValues;
     char* halValues = halGetParameters(keys.keysToString().string());
@@ -156,6 +362,7 @@ Result ParametersUtil::setParam(const char* name, const DeviceAddress& address)
 }
 
 Result ParametersUtil::setParams(const AudioParameter& param) {
+    clearCache();
     int halStatus = halSetParameters(param.toString().string());
     return util::analyzeStatus(halStatus);
 }
@@ -25,6 +25,7 @@
 #define ATRACE_TAG ATRACE_TAG_AUDIO
 
 #include <android/log.h>
+#include <cutils/properties.h>
 #include <hardware/audio.h>
 #include <utils/Trace.h>
 #include <memory>
@@ -42,7 +43,8 @@ class ReadThread : public Thread {
    public:
     // ReadThread's lifespan never exceeds StreamIn's lifespan.
     ReadThread(std::atomic<bool>* stop, audio_stream_in_t* stream, StreamIn::CommandMQ* commandMQ,
-               StreamIn::DataMQ* dataMQ, StreamIn::StatusMQ* statusMQ, EventFlag* efGroup)
+               StreamIn::DataMQ* dataMQ, StreamIn::StatusMQ* statusMQ, EventFlag* efGroup,
+               size_t frameSize, StreamStats* stats)
         : Thread(false /*canCallJava*/),
           mStop(stop),
           mStream(stream),
@@ -50,6 +52,9 @@ class ReadThread : public Thread {
           mDataMQ(dataMQ),
           mStatusMQ(statusMQ),
           mEfGroup(efGroup),
+          mFrameSize(frameSize),
+          mZeroCopy(property_get_bool("ro.vendor.audio.hal.fmq_zero_copy", false)),
+          mStats(stats),
           mBuffer(nullptr) {}
     bool init() {
         mBuffer.reset(new (std::nothrow) uint8_t[mDataMQ->getQuantumCount()]);
@@ -64,17 +69,79 @@ class ReadThread : public Thread {
     StreamIn::DataMQ* mDataMQ;
     StreamIn::StatusMQ* mStatusMQ;
     EventFlag* mEfGroup;
+    const size_t mFrameSize;
+    // Whether to let the HAL read straight into the DataMQ regions instead of
+    // going through mBuffer
+    const bool mZeroCopy;
+    StreamStats* mStats;
     std::unique_ptr<uint8_t[]> mBuffer;
     IStreamIn::ReadParameters mParameters;
     IStreamIn::ReadStatus mStatus;
+    nsecs_t mWakeTime = 0;
+    nsecs_t mLastReadTime = 0;
 
     bool threadLoop() override;
 
     void doGetCapturePosition();
     void doRead();
+    bool doZeroCopyRead(size_t requestedToRead);
 };
 
+// Reads into the writable part of the DataMQ directly, which takes two reads
+// when the space wraps around the end of the ring. Like the write side, only
+// done when ro.vendor.audio.hal.fmq_zero_copy is set. Returns false if the
+// regions can not be filled without splitting a frame, in which case nothing
+// has been produced.
+bool ReadThread::doZeroCopyRead(size_t requestedToRead) {
+    const nsecs_t fmqStart = systemTime();
+    StreamIn::DataMQ::MemTransaction tx;
+    if (!mDataMQ->beginWrite(requestedToRead, &tx)) {
+        return false;
+    }
+    const auto& first = tx.getFirstRegion();
+    const auto& second = tx.getSecondRegion();
+    if (second.getLength() != 0 && first.getLength() % mFrameSize != 0) {
+        return false;
+    }
+    const nsecs_t halStart = systemTime();
+    mStats->record(StreamStats::Timing::WAKE_TO_HAL, halStart - mWakeTime);
+
+    mStatus.retval = Result::OK;
+    size_t read = 0;
+    for (const auto* region : {&first, &second}) {
+        if (region->getLength() == 0) {
+            break;
+        }
+        ssize_t readResult = mStream->read(mStream, region->getAddress(), region->getLength());
+        if (readResult < 0) {
+            if (read == 0) {
+                mStatus.retval = Stream::analyzeStatus("read", readResult);
+            }
+            break;
+        }
+        read += readResult;
+        if (static_cast<size_t>(readResult) < region->getLength()) {
+            break;
+        }
+    }
+    const nsecs_t halEnd = systemTime();
+    mStats->record(StreamStats::Timing::HAL, halEnd - halStart);
+    if (mStatus.retval == Result::OK) {
+        mStatus.reply.read = read;
+        if (!mDataMQ->commitWrite(read)) {
+            ALOGW("data message queue write failed");
+        }
+    }
+    mStats->record(StreamStats::Timing::FMQ, (halStart - fmqStart) + (systemTime() - halEnd));
+    return true;
+}
+
 void ReadThread::doRead() {
+    if (mLastReadTime != 0) {
+        mStats->record(StreamStats::Timing::CYCLE, mWakeTime - mLastReadTime);
+    }
+    mLastReadTime = mWakeTime;
+
     size_t availableToWrite = mDataMQ->availableToWrite();
     size_t requestedToRead = mParameters.params.read;
     if (requestedToRead > availableToWrite) {
@@ -83,14 +150,24 @@ void ReadThread::doRead() {
             "space",
             (int32_t)requestedToRead, (int32_t)availableToWrite);
         requestedToRead = availableToWrite;
+        mStats->record(StreamStats::Event::OVERRUN);
+    }
+    // A zero-length read is passed on to the HAL by the copying path.
+    if (mZeroCopy && requestedToRead != 0 && doZeroCopyRead(requestedToRead)) {
+        return;
     }
+    const nsecs_t halStart = systemTime();
+    mStats->record(StreamStats::Timing::WAKE_TO_HAL, halStart - mWakeTime);
     ssize_t readResult = mStream->read(mStream, &mBuffer[0], requestedToRead);
+    const nsecs_t halEnd = systemTime();
+    mStats->record(StreamStats::Timing::HAL, halEnd - halStart);
     mStatus.retval = Result::OK;
     if (readResult >= 0) {
         mStatus.reply.read = readResult;
         if (!mDataMQ->write(&mBuffer[0], readResult)) {
             ALOGW("data message queue write failed");
         }
+        mStats->record(StreamStats::Timing::FMQ, systemTime() - halEnd);
     } else {
         mStatus.retval = Stream::analyzeStatus("read", readResult);
     }
@@ -111,6 +188,7 @@ bool ReadThread::threadLoop() {
         if (!(efState & static_cast<uint32_t>(MessageQueueFlagBits::NOT_FULL))) {
             continue;  // Nothing to do.
         }
+        mWakeTime = systemTime();
         if (!mCommandMQ->read(&mParameters)) {
             continue;  // Nothing to do.
         }
@@ -127,10 +205,15 @@ bool ReadThread::threadLoop() {
                 mStatus.retval = Result::NOT_SUPPORTED;
                 break;
         }
+        const nsecs_t statusStart = systemTime();
         if (!mStatusMQ->write(&mStatus)) {
             ALOGW("status message queue write failed");
+            mStats->record(StreamStats::Event::STATUS_WRITE_FAILURE);
         }
         mEfGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::NOT_EMPTY));
+        const nsecs_t statusEnd = systemTime();
+        mStats->record(StreamStats::Timing::STATUS, statusEnd - statusStart);
+        mStats->traceIfEnabled(statusEnd);
     }
 
     return false;
@@ -145,7 +228,8 @@ StreamIn::StreamIn(const sp<Device>& device, audio_stream_in_t* stream)
       mStreamCommon(new Stream(&stream->common)),
       mStreamMmap(new StreamMmap<audio_stream_in_t>(stream)),
       mEfGroup(nullptr),
-      mStopReadThread(false) {}
+      mStopReadThread(false),
+      mStats("AudioIn") {}
 
 StreamIn::~StreamIn() {
     ATRACE_CALL();
@@ -159,6 +243,7 @@ StreamIn::~StreamIn() {
         status_t status = EventFlag::deleteEventFlag(&mEfGroup);
         ALOGE_IF(status, "read MQ event flag deletion error: %s", strerror(-status));
     }
+    mStreamMmap->close();
     mDevice->closeInputStream(mStream);
     mStream = nullptr;
 }
@@ -264,7 +349,7 @@ Return<Result> StreamIn::setParameters(const hidl_vec<ParameterValue>& parameter
 }
 
 Return<void> StreamIn::debugDump(const hidl_handle& fd) {
-    return mStreamCommon->debugDump(fd);
+    return debug(fd, {} /* options */);
 }
 #elif MAJOR_VERSION >= 4
 Return<void> StreamIn::getDevices(getDevices_cb _hidl_cb) {
@@ -389,7 +474,8 @@ Return<void> StreamIn::prepareForReading(uint32_t frameSize, uint32_t framesCoun
     // Create and launch the thread.
     auto tempReadThread =
         std::make_unique<ReadThread>(&mStopReadThread, mStream, tempCommandMQ.get(),
-                                     tempDataMQ.get(), tempStatusMQ.get(), tempElfGroup.get());
+                                     tempDataMQ.get(), tempStatusMQ.get(), tempElfGroup.get(),
+                                     frameSize, &mStats);
     if (!tempReadThread->init()) {
         ALOGW("failed to start reader thread: %s", strerror(-status));
         sendError(Result::INVALID_ARGUMENTS);
@@ -445,7 +531,11 @@ Return<void> StreamIn::getCapturePosition(getCapturePosition_cb _hidl_cb) {
 }
 
 Return<void> StreamIn::debug(const hidl_handle& fd, const hidl_vec<hidl_string>& options) {
-    return mStreamCommon->debug(fd, options);
+    mStreamCommon->debug(fd, options);
+    if (fd.getNativeHandle() != nullptr && fd->numFds == 1) {
+        mStats.dump(fd->data[0]);
+    }
+    return Void();
 }
 
 #if MAJOR_VERSION >= 4
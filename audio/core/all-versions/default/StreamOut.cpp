@@ -22,9 +22,13 @@
 //#define LOG_NDEBUG 0
 #define ATRACE_TAG ATRACE_TAG_AUDIO
 
+#include <stdio.h>
+#include <unistd.h>
+
 #include <memory>
 
 #include <android/log.h>
+#include <cutils/properties.h>
 #include <hardware/audio.h>
 #include <utils/Trace.h>
 
@@ -41,7 +45,8 @@ class WriteThread : public Thread {
     // WriteThread's lifespan never exceeds StreamOut's lifespan.
     WriteThread(std::atomic<bool>* stop, audio_stream_out_t* stream,
                 StreamOut::CommandMQ* commandMQ, StreamOut::DataMQ* dataMQ,
-                StreamOut::StatusMQ* statusMQ, EventFlag* efGroup)
+                StreamOut::StatusMQ* statusMQ, EventFlag* efGroup, size_t frameSize,
+                StreamStats* stats)
         : Thread(false /*canCallJava*/),
           mStop(stop),
           mStream(stream),
@@ -49,6 +54,9 @@ class WriteThread : public Thread {
           mDataMQ(dataMQ),
           mStatusMQ(statusMQ),
           mEfGroup(efGroup),
+          mFrameSize(frameSize),
+          mZeroCopy(property_get_bool("ro.vendor.audio.hal.fmq_zero_copy", false)),
+          mStats(stats),
           mBuffer(nullptr) {}
     bool init() {
         mBuffer.reset(new (std::nothrow) uint8_t[mDataMQ->getQuantumCount()]);
@@ -63,22 +71,115 @@ class WriteThread : public Thread {
     StreamOut::DataMQ* mDataMQ;
     StreamOut::StatusMQ* mStatusMQ;
     EventFlag* mEfGroup;
+    const size_t mFrameSize;
+    // Whether to hand the DataMQ regions to the HAL directly instead of
+    // copying them into mBuffer first
+    const bool mZeroCopy;
+    StreamStats* mStats;
     std::unique_ptr<uint8_t[]> mBuffer;
     IStreamOut::WriteStatus mStatus;
+    nsecs_t mWakeTime = 0;
+    nsecs_t mLastWriteTime = 0;
+
+    // The position captured right after the last write, handed out to the
+    // query that follows it instead of calling into the HAL again. Only
+    // captured while the client is seen polling after each write.
+    struct WriteSnapshot {
+        bool valid = false;
+        Result positionRetval = Result::NOT_SUPPORTED;
+        uint64_t frames = 0;
+        TimeSpec timeStamp = {0, 0};
+    };
+    WriteSnapshot mSnapshot;
+    bool mCaptureAfterWrite = false;
+    IStreamOut::WriteCommand mLastCommand = IStreamOut::WriteCommand::WRITE;
 
     bool threadLoop() override;
 
     void doGetLatency();
     void doGetPresentationPosition();
     void doWrite();
+    bool doZeroCopyWrite(size_t availToRead);
+    void updateWriteSnapshot(IStreamOut::WriteCommand command);
 };
 
+// Writes the readable part of the DataMQ straight from its shared memory,
+// which takes two writes when the data wraps around the end of the ring. As
+// the HAL then reads memory shared with the client, this is only done when
+// ro.vendor.audio.hal.fmq_zero_copy is set. Returns false if the regions can
+// not be written without splitting a frame, in which case nothing has been
+// consumed.
+bool WriteThread::doZeroCopyWrite(size_t availToRead) {
+    mStatus.retval = Result::OK;
+    mStatus.reply.written = 0;
+
+    const nsecs_t fmqStart = systemTime();
+    StreamOut::DataMQ::MemTransaction tx;
+    if (!mDataMQ->beginRead(availToRead, &tx)) {
+        return false;
+    }
+    const auto& first = tx.getFirstRegion();
+    const auto& second = tx.getSecondRegion();
+    if (second.getLength() != 0 && first.getLength() % mFrameSize != 0) {
+        return false;
+    }
+    const nsecs_t halStart = systemTime();
+    mStats->record(StreamStats::Timing::FMQ, halStart - fmqStart);
+    mStats->record(StreamStats::Timing::WAKE_TO_HAL, halStart - mWakeTime);
+
+    size_t written = 0;
+    for (const auto* region : {&first, &second}) {
+        if (region->getLength() == 0) {
+            break;
+        }
+        ssize_t writeResult = mStream->write(mStream, region->getAddress(), region->getLength());
+        if (writeResult < 0) {
+            if (written == 0) {
+                mStatus.retval = Stream::analyzeStatus("write", writeResult);
+            }
+            break;
+        }
+        written += writeResult;
+        if (static_cast<size_t>(writeResult) < region->getLength()) {
+            break;
+        }
+    }
+    mStatus.reply.written = written;
+    mStats->record(StreamStats::Timing::HAL, systemTime() - halStart);
+
+    // As with the copying path, everything that was available is consumed
+    // regardless of how much the HAL accepted.
+    mDataMQ->commitRead(availToRead);
+    return true;
+}
+
 void WriteThread::doWrite() {
+    if (mLastWriteTime != 0) {
+        mStats->record(StreamStats::Timing::CYCLE, mWakeTime - mLastWriteTime);
+    }
+    mLastWriteTime = mWakeTime;
+
     const size_t availToRead = mDataMQ->availableToRead();
+    if (availToRead == 0) {
+        mStats->record(StreamStats::Event::UNDERRUN);
+    } else {
+        mStats->recordTransfer(availToRead);
+    }
+    // An empty queue still goes through the copying path, as some HALs rely
+    // on the zero-length write for underrun and timestamp handling.
+    if (mZeroCopy && availToRead != 0 && doZeroCopyWrite(availToRead)) {
+        return;
+    }
+
     mStatus.retval = Result::OK;
     mStatus.reply.written = 0;
+    const nsecs_t fmqStart = systemTime();
     if (mDataMQ->read(&mBuffer[0], availToRead)) {
+        const nsecs_t halStart = systemTime();
+        mStats->record(StreamStats::Timing::FMQ, halStart - fmqStart);
+        mStats->record(StreamStats::Timing::WAKE_TO_HAL, halStart - mWakeTime);
         ssize_t writeResult = mStream->write(mStream, &mBuffer[0], availToRead);
+        mStats->record(StreamStats::Timing::HAL, systemTime() - halStart);
         if (writeResult >= 0) {
             mStatus.reply.written = writeResult;
         } else {
@@ -88,6 +189,12 @@ void WriteThread::doWrite() {
 }
 
 void WriteThread::doGetPresentationPosition() {
+    if (mSnapshot.valid) {
+        mStatus.retval = mSnapshot.positionRetval;
+        mStatus.reply.presentationPosition.frames = mSnapshot.frames;
+        mStatus.reply.presentationPosition.timeStamp = mSnapshot.timeStamp;
+        return;
+    }
     mStatus.retval =
         StreamOut::getPresentationPositionImpl(mStream, &mStatus.reply.presentationPosition.frames,
                                                &mStatus.reply.presentationPosition.timeStamp);
@@ -98,6 +205,32 @@ void WriteThread::doGetLatency() {
     mStatus.reply.latencyMs = mStream->get_latency(mStream);
 }
 
+// AudioFlinger typically follows every WRITE with GET_PRESENTATION_POSITION.
+// The HIDL reply can only carry one of them, so capture the position right
+// after the write has been acknowledged and serve the next query from it. The
+// snapshot is dropped by any other command, and capturing stops as soon as a
+// write goes unqueried so that clients which never poll pay nothing.
+void WriteThread::updateWriteSnapshot(IStreamOut::WriteCommand command) {
+    if (command == IStreamOut::WriteCommand::WRITE) {
+        if (mLastCommand == IStreamOut::WriteCommand::WRITE) {
+            mCaptureAfterWrite = false;
+        }
+        mSnapshot.valid = false;
+        if (mCaptureAfterWrite && mStatus.retval == Result::OK) {
+            mSnapshot.positionRetval = StreamOut::getPresentationPositionImpl(
+                mStream, &mSnapshot.frames, &mSnapshot.timeStamp);
+            mSnapshot.valid = true;
+        }
+    } else {
+        if (command == IStreamOut::WriteCommand::GET_PRESENTATION_POSITION &&
+            mLastCommand == IStreamOut::WriteCommand::WRITE) {
+            mCaptureAfterWrite = true;
+        }
+        mSnapshot.valid = false;
+    }
+    mLastCommand = command;
+}
+
 bool WriteThread::threadLoop() {
     // This implementation doesn't return control back to the Thread until it
     // decides to stop,
@@ -108,6 +241,7 @@ bool WriteThread::threadLoop() {
         if (!(efState & static_cast<uint32_t>(MessageQueueFlagBits::NOT_EMPTY))) {
             continue;  // Nothing to do.
         }
+        mWakeTime = systemTime();
         if (!mCommandMQ->read(&mStatus.replyTo)) {
             continue;  // Nothing to do.
         }
@@ -126,25 +260,70 @@ bool WriteThread::threadLoop() {
                 mStatus.retval = Result::NOT_SUPPORTED;
                 break;
         }
+        const nsecs_t statusStart = systemTime();
         if (!mStatusMQ->write(&mStatus)) {
             ALOGE("status message queue write failed");
+            mStats->record(StreamStats::Event::STATUS_WRITE_FAILURE);
         }
         mEfGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::NOT_FULL));
+        const nsecs_t statusEnd = systemTime();
+        mStats->record(StreamStats::Timing::STATUS, statusEnd - statusStart);
+        mStats->traceIfEnabled(statusEnd);
+        // The client is already woken up; its next command is not read until
+        // this returns.
+        updateWriteSnapshot(mStatus.replyTo);
     }
 
     return false;
 }
 
+// Chooses the capacity of the DataMQ for a stream opened with the given flags.
+// The descriptor is sent to the client once and the queue can not be resized
+// afterwards, and the client never writes more than the queue can take, so the
+// requested size is a lower bound. Latency sensitive streams get exactly what
+// they asked for. The client caps each write at the size it requested, so
+// extra space is only of use to clients that write larger chunks; devices with
+// such clients can give offload and deep buffer streams headroom with
+// ro.vendor.audio.hal.fmq_headroom_percent.
+size_t chooseDataMQFrames(audio_output_flags_t flags, uint32_t frameSize, uint32_t framesCount,
+                          const char** policy) {
+    if (flags & (AUDIO_OUTPUT_FLAG_FAST | AUDIO_OUTPUT_FLAG_RAW | AUDIO_OUTPUT_FLAG_MMAP_NOIRQ)) {
+        *policy = "tight";
+        return framesCount;
+    }
+    uint64_t frames = framesCount;
+    if (flags & (AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD | AUDIO_OUTPUT_FLAG_DEEP_BUFFER)) {
+        *policy = flags & AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD ? "offload" : "deep buffer";
+        int32_t headroomPercent =
+            property_get_int32("ro.vendor.audio.hal.fmq_headroom_percent", 0);
+        if (headroomPercent < 0) headroomPercent = 0;
+        if (headroomPercent > 400) headroomPercent = 400;
+        frames += frames * headroomPercent / 100;
+    } else {
+        *policy = "default";
+    }
+    // Shared memory is allocated in whole pages, use all of it.
+    const uint64_t pageSize = getpagesize();
+    frames = (frames * frameSize + pageSize - 1) / pageSize * pageSize / frameSize;
+    const uint64_t maxFrames = Stream::MAX_BUFFER_SIZE / frameSize;
+    if (frames > maxFrames) frames = maxFrames;
+    if (frames < framesCount) frames = framesCount;
+    return frames;
+}
+
 }  // namespace
 
-StreamOut::StreamOut(const sp<Device>& device, audio_stream_out_t* stream)
+StreamOut::StreamOut(const sp<Device>& device, audio_stream_out_t* stream,
+                     audio_output_flags_t flags)
     : mIsClosed(false),
       mDevice(device),
       mStream(stream),
+      mFlags(flags),
       mStreamCommon(new Stream(&stream->common)),
       mStreamMmap(new StreamMmap<audio_stream_out_t>(stream)),
       mEfGroup(nullptr),
-      mStopWriteThread(false) {}
+      mStopWriteThread(false),
+      mStats("AudioOut") {}
 
 StreamOut::~StreamOut() {
     ATRACE_CALL();
@@ -159,6 +338,7 @@ StreamOut::~StreamOut() {
         ALOGE_IF(status, "write MQ event flag deletion error: %s", strerror(-status));
     }
     mCallback.clear();
+    mStreamMmap->close();
     mDevice->closeOutputStream(mStream);
     // Closing the output stream in the HAL waits for the callback to finish,
     // and joins the callback thread. Thus is it guaranteed that the callback
@@ -268,7 +448,7 @@ Return<Result> StreamOut::setParameters(const hidl_vec<ParameterValue>& paramete
 }
 
 Return<void> StreamOut::debugDump(const hidl_handle& fd) {
-    return mStreamCommon->debugDump(fd);
+    return debug(fd, {} /* options */);
 }
 #elif MAJOR_VERSION >= 4
 Return<void> StreamOut::getDevices(getDevices_cb _hidl_cb) {
@@ -349,7 +529,9 @@ Return<void> StreamOut::prepareForWriting(uint32_t frameSize, uint32_t framesCou
         sendError(Result::INVALID_ARGUMENTS);
         return Void();
     }
-    std::unique_ptr<DataMQ> tempDataMQ(new DataMQ(frameSize * framesCount, true /* EventFlag */));
+    const char* sizingPolicy;
+    const size_t dataMQFrames = chooseDataMQFrames(mFlags, frameSize, framesCount, &sizingPolicy);
+    std::unique_ptr<DataMQ> tempDataMQ(new DataMQ(frameSize * dataMQFrames, true /* EventFlag */));
 
     std::unique_ptr<StatusMQ> tempStatusMQ(new StatusMQ(1));
     if (!tempCommandMQ->isValid() || !tempDataMQ->isValid() || !tempStatusMQ->isValid()) {
@@ -372,7 +554,8 @@ Return<void> StreamOut::prepareForWriting(uint32_t frameSize, uint32_t framesCou
     // Create and launch the thread.
     auto tempWriteThread =
         std::make_unique<WriteThread>(&mStopWriteThread, mStream, tempCommandMQ.get(),
-                                      tempDataMQ.get(), tempStatusMQ.get(), tempElfGroup.get());
+                                      tempDataMQ.get(), tempStatusMQ.get(), tempElfGroup.get(),
+                                      frameSize, &mStats);
     if (!tempWriteThread->init()) {
         ALOGW("failed to start writer thread: %s", strerror(-status));
         sendError(Result::INVALID_ARGUMENTS);
@@ -385,6 +568,12 @@ Return<void> StreamOut::prepareForWriting(uint32_t frameSize, uint32_t framesCou
         return Void();
     }
 
+    ALOGV("DataMQ of %zu frames for %u requested (%s policy)", dataMQFrames, framesCount,
+          sizingPolicy);
+    {
+        std::lock_guard<std::mutex> lock(mDataMQSizingLock);
+        mDataMQSizing = {framesCount, dataMQFrames, frameSize, sizingPolicy};
+    }
     mCommandMQ = std::move(tempCommandMQ);
     mDataMQ = std::move(tempDataMQ);
     mStatusMQ = std::move(tempStatusMQ);
@@ -542,7 +731,25 @@ Return<void> StreamOut::getMmapPosition(getMmapPosition_cb _hidl_cb) {
 }
 
 Return<void> StreamOut::debug(const hidl_handle& fd, const hidl_vec<hidl_string>& options) {
-    return mStreamCommon->debug(fd, options);
+    mStreamCommon->debug(fd, options);
+    if (fd.getNativeHandle() != nullptr && fd->numFds == 1) {
+        const int fdNum = fd->data[0];
+        DataMQSizing sizing;
+        {
+            std::lock_guard<std::mutex> lock(mDataMQSizingLock);
+            sizing = mDataMQSizing;
+        }
+        if (sizing.capacityFrames != 0) {
+            const size_t maxWriteFrames = mStats.getMaxTransferBytes() / sizing.frameSize;
+            dprintf(fdNum,
+                    "  DataMQ: %zu frames (%s policy, %u requested), largest write %zu frames "
+                    "(%zu%%)\n",
+                    sizing.capacityFrames, sizing.policy, sizing.requestedFrames, maxWriteFrames,
+                    maxWriteFrames * 100 / sizing.capacityFrames);
+        }
+        mStats.dump(fdNum);
+    }
+    return Void();
 }
 
 #if MAJOR_VERSION >= 4
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "StreamStatsHAL"
+
+#include "core/default/StreamStats.h"
+
+//#define LOG_NDEBUG 0
+#define ATRACE_TAG ATRACE_TAG_AUDIO
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <android-base/stringprintf.h>
+#include <utils/Trace.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+namespace {
+
+const char* const kTimingNames[] = {"wake to HAL", "FMQ", "HAL", "status", "cycle"};
+const char* const kEventNames[] = {"underruns", "overruns", "status write failures"};
+
+template <typename T>
+void increment(std::atomic<T>* value, T delta) {
+    value->store(value->load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+}  // namespace
+
+StreamStats::StreamStats(const char* name)
+    : mHalTraceName(base::StringPrintf("%s-%p HAL us", name, this)),
+      mEventTraceName(base::StringPrintf("%s-%p xruns", name, this)) {
+    static_assert(sizeof(kTimingNames) / sizeof(kTimingNames[0]) == kTimingCount,
+                  "timing names out of sync");
+    static_assert(sizeof(kEventNames) / sizeof(kEventNames[0]) == kEventCount,
+                  "event names out of sync");
+}
+
+void StreamStats::Histogram::record(nsecs_t duration) {
+    if (duration < 0) duration = 0;
+    uint64_t us = static_cast<uint64_t>(duration) / 1000;
+    size_t bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    if (bucket >= kBucketCount) bucket = kBucketCount - 1;
+
+    increment(&buckets[bucket], uint64_t(1));
+    increment(&count, uint64_t(1));
+    increment(&totalNs, int64_t(duration));
+    if (duration > maxNs.load(std::memory_order_relaxed)) {
+        maxNs.store(duration, std::memory_order_relaxed);
+    }
+}
+
+void StreamStats::traceIfEnabled(nsecs_t now) {
+    if (!ATRACE_ENABLED() || now - mLastTraceNs < s2ns(1)) return;
+    mLastTraceNs = now;
+
+    const auto& hal = mHistograms[static_cast<size_t>(Timing::HAL)];
+    uint64_t count = hal.count.load(std::memory_order_relaxed);
+    int64_t totalNs = hal.totalNs.load(std::memory_order_relaxed);
+    if (count > mLastTraceCount) {
+        ATRACE_INT64(mHalTraceName.c_str(),
+                     (totalNs - mLastTraceTotalNs) / int64_t(count - mLastTraceCount) / 1000);
+    }
+    mLastTraceCount = count;
+    mLastTraceTotalNs = totalNs;
+
+    int64_t xruns = 0;
+    for (const auto& event : mEvents) {
+        xruns += event.load(std::memory_order_relaxed);
+    }
+    ATRACE_INT64(mEventTraceName.c_str(), xruns);
+}
+
+void StreamStats::dump(int fd) const {
+    dprintf(fd, "  Stream thread statistics (us):\n");
+    for (size_t i = 0; i < kTimingCount; ++i) {
+        const auto& histogram = mHistograms[i];
+        uint64_t count = histogram.count.load(std::memory_order_relaxed);
+        int64_t totalNs = histogram.totalNs.load(std::memory_order_relaxed);
+        dprintf(fd, "    %-12s count %" PRIu64 " avg %" PRId64 " max %" PRId64 "\n",
+                kTimingNames[i], count, count ? totalNs / int64_t(count) / 1000 : 0,
+                histogram.maxNs.load(std::memory_order_relaxed) / 1000);
+        if (count == 0) continue;
+        dprintf(fd, "     ");
+        for (size_t b = 0; b < kBucketCount; ++b) {
+            uint64_t bucketCount = histogram.buckets[b].load(std::memory_order_relaxed);
+            if (bucketCount == 0) continue;
+            if (b == kBucketCount - 1) {
+                dprintf(fd, " >=%" PRIu64 ":%" PRIu64, uint64_t(1) << (b - 1), bucketCount);
+            } else {
+                dprintf(fd, " <%" PRIu64 ":%" PRIu64, uint64_t(1) << b, bucketCount);
+            }
+        }
+        dprintf(fd, "\n");
+    }
+    uint64_t transfers = mTransferCount.load(std::memory_order_relaxed);
+    if (transfers != 0) {
+        dprintf(fd, "    transfer bytes: count %" PRIu64 " avg %" PRIu64 " max %zu\n", transfers,
+                mTransferBytes.load(std::memory_order_relaxed) / transfers,
+                mMaxTransferBytes.load(std::memory_order_relaxed));
+    }
+    for (size_t i = 0; i < kEventCount; ++i) {
+        dprintf(fd, "    %s: %" PRIu64 "\n", kEventNames[i],
+                mEvents[i].load(std::memory_order_relaxed));
+    }
+}
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
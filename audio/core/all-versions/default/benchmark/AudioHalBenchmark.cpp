@@ -0,0 +1,285 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "AudioHalBenchmark"
+
+#include <time.h>
+
+#include <algorithm>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <core/default/Device.h>
+#include <core/default/StreamIn.h>
+#include <core/default/StreamOut.h>
+#include <fmq/EventFlag.h>
+
+#include "FakeAudioHwDevice.h"
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace benchmark {
+namespace {
+
+using namespace ::android::hardware::audio::common::CPP_VERSION;
+using ::android::hardware::audio::common::CPP_VERSION::implementation::AudioChannelBitfield;
+using ::android::hardware::audio::common::CPP_VERSION::implementation::AudioInputFlagBitfield;
+using ::android::hardware::audio::common::CPP_VERSION::implementation::AudioOutputFlagBitfield;
+using implementation::Device;
+using implementation::StreamIn;
+using implementation::StreamOut;
+
+constexpr nsecs_t kStatusTimeoutNs = 1000000000;
+
+nsecs_t processCpuTime() {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return seconds_to_nanoseconds(ts.tv_sec) + ts.tv_nsec;
+}
+
+// Waits for the stream thread to post its status, as the framework client does.
+template <typename StatusMQ, typename Status>
+bool waitForStatus(EventFlag* efGroup, MessageQueueFlagBits bit, StatusMQ* statusMQ,
+                   Status* status) {
+    const nsecs_t deadline = systemTime() + kStatusTimeoutNs;
+    do {
+        uint32_t efState = 0;
+        efGroup->wait(static_cast<uint32_t>(bit), &efState, kStatusTimeoutNs, true /* retry */);
+        if ((efState & static_cast<uint32_t>(bit)) && statusMQ->read(status)) {
+            return true;
+        }
+    } while (systemTime() < deadline);
+    return false;
+}
+
+// Reports the round trips of one run, measured from the client sending a
+// command to it reading the status. The HAL transfer delay is included in the
+// round trip and subtracted for the wrapper overhead.
+void reportRoundTrips(::benchmark::State& state, std::vector<nsecs_t>* roundTrips,
+                      nsecs_t cpuTime, nsecs_t transferDelay) {
+    if (roundTrips->empty()) return;
+    std::sort(roundTrips->begin(), roundTrips->end());
+    nsecs_t total = 0;
+    for (nsecs_t roundTrip : *roundTrips) {
+        total += roundTrip;
+    }
+    const size_t count = roundTrips->size();
+    const nsecs_t average = total / count;
+    const nsecs_t median = (*roundTrips)[count / 2];
+    const nsecs_t p99 = (*roundTrips)[std::min(count - 1, count * 99 / 100)];
+
+    using ::benchmark::Counter;
+    state.counters["rtt_ns"] = Counter(average);
+    state.counters["rtt_p50_ns"] = Counter(median);
+    state.counters["rtt_p99_ns"] = Counter(p99);
+    state.counters["jitter_ns"] = Counter(p99 - median);
+    state.counters["overhead_ns"] = Counter(std::max<nsecs_t>(0, average - transferDelay));
+    // Client and stream thread together, as both run in this process.
+    state.counters["cpu_ns"] = Counter(cpuTime / count);
+}
+
+AudioConfig makeConfig(AudioChannelMask channelMask) {
+    AudioConfig config{};
+    config.sampleRateHz = FakeAudioHwDevice::kSampleRate;
+    config.channelMask = AudioChannelBitfield(channelMask);
+    config.format = AudioFormat::PCM_16_BIT;
+    return config;
+}
+
+// Writes periods of state.range(0) frames to an output stream whose HAL
+// write() takes state.range(1) microseconds.
+void BM_StreamOutWrite(::benchmark::State& state) {
+    const uint32_t periodFrames = static_cast<uint32_t>(state.range(0));
+    const nsecs_t transferDelay = us2ns(state.range(1));
+    const size_t periodBytes = periodFrames * FakeAudioHwDevice::kFrameSize;
+
+    sp<Device> device = new Device(FakeAudioHwDevice::create(transferDelay));
+    DeviceAddress address{};
+    address.device = AudioDevice::OUT_SPEAKER;
+    AudioConfig suggestedConfig;
+    Result result;
+    sp<IStreamOut> stream;
+    std::tie(result, stream) = device->openOutputStreamImpl(
+        1 /* ioHandle */, address, makeConfig(AudioChannelMask::OUT_STEREO),
+        AudioOutputFlagBitfield(0), &suggestedConfig);
+    if (result != Result::OK) {
+        state.SkipWithError("failed to open output stream");
+        return;
+    }
+
+    std::unique_ptr<StreamOut::CommandMQ> commandMQ;
+    std::unique_ptr<StreamOut::DataMQ> dataMQ;
+    std::unique_ptr<StreamOut::StatusMQ> statusMQ;
+    stream->prepareForWriting(
+        FakeAudioHwDevice::kFrameSize, periodFrames,
+        [&](Result retval, const auto& commandDesc, const auto& dataDesc, const auto& statusDesc,
+            const auto& /* threadInfo */) {
+            result = retval;
+            if (retval == Result::OK) {
+                commandMQ.reset(new StreamOut::CommandMQ(commandDesc));
+                dataMQ.reset(new StreamOut::DataMQ(dataDesc));
+                statusMQ.reset(new StreamOut::StatusMQ(statusDesc));
+            }
+        });
+    EventFlag* efGroup = nullptr;
+    if (result != Result::OK ||
+        EventFlag::createEventFlag(dataMQ->getEventFlagWord(), &efGroup) != OK) {
+        state.SkipWithError("failed to prepare for writing");
+        stream->close();
+        return;
+    }
+
+    std::vector<uint8_t> period(periodBytes);
+    std::vector<nsecs_t> roundTrips;
+    roundTrips.reserve(state.max_iterations);
+    const IStreamOut::WriteCommand command = IStreamOut::WriteCommand::WRITE;
+    IStreamOut::WriteStatus status;
+    bool failed = false;
+    const nsecs_t cpuStart = processCpuTime();
+
+    for (auto _ : state) {
+        const nsecs_t start = systemTime();
+        if (!commandMQ->write(&command) || !dataMQ->write(period.data(), periodBytes)) {
+            failed = true;
+            break;
+        }
+        efGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::NOT_EMPTY));
+        if (!waitForStatus(efGroup, MessageQueueFlagBits::NOT_FULL, statusMQ.get(), &status) ||
+            status.retval != Result::OK || status.reply.written != periodBytes) {
+            failed = true;
+            break;
+        }
+        roundTrips.push_back(systemTime() - start);
+    }
+
+    const nsecs_t cpuTime = processCpuTime() - cpuStart;
+    stream->close();
+    EventFlag::deleteEventFlag(&efGroup);
+    if (failed) {
+        state.SkipWithError("write round trip failed");
+        return;
+    }
+    state.SetBytesProcessed(state.iterations() * periodBytes);
+    reportRoundTrips(state, &roundTrips, cpuTime, transferDelay);
+}
+
+// Reads periods of state.range(0) frames from an input stream whose HAL
+// read() takes state.range(1) microseconds.
+void BM_StreamInRead(::benchmark::State& state) {
+    const uint32_t periodFrames = static_cast<uint32_t>(state.range(0));
+    const nsecs_t transferDelay = us2ns(state.range(1));
+    const size_t periodBytes = periodFrames * FakeAudioHwDevice::kFrameSize;
+
+    sp<Device> device = new Device(FakeAudioHwDevice::create(transferDelay));
+    DeviceAddress address{};
+    address.device = AudioDevice::IN_BUILTIN_MIC;
+    AudioConfig suggestedConfig;
+    Result result;
+    sp<IStreamIn> stream;
+    std::tie(result, stream) = device->openInputStreamImpl(
+        1 /* ioHandle */, address, makeConfig(AudioChannelMask::IN_STEREO),
+        AudioInputFlagBitfield(0), AudioSource::MIC, &suggestedConfig);
+    if (result != Result::OK) {
+        state.SkipWithError("failed to open input stream");
+        return;
+    }
+
+    std::unique_ptr<StreamIn::CommandMQ> commandMQ;
+    std::unique_ptr<StreamIn::DataMQ> dataMQ;
+    std::unique_ptr<StreamIn::StatusMQ> statusMQ;
+    stream->prepareForReading(
+        FakeAudioHwDevice::kFrameSize, periodFrames,
+        [&](Result retval, const auto& commandDesc, const auto& dataDesc, const auto& statusDesc,
+            const auto& /* threadInfo */) {
+            result = retval;
+            if (retval == Result::OK) {
+                commandMQ.reset(new StreamIn::CommandMQ(commandDesc));
+                dataMQ.reset(new StreamIn::DataMQ(dataDesc));
+                statusMQ.reset(new StreamIn::StatusMQ(statusDesc));
+            }
+        });
+    EventFlag* efGroup = nullptr;
+    if (result != Result::OK ||
+        EventFlag::createEventFlag(dataMQ->getEventFlagWord(), &efGroup) != OK) {
+        state.SkipWithError("failed to prepare for reading");
+        stream->close();
+        return;
+    }
+
+    std::vector<uint8_t> period(periodBytes);
+    std::vector<nsecs_t> roundTrips;
+    roundTrips.reserve(state.max_iterations);
+    IStreamIn::ReadParameters parameters;
+    parameters.command = IStreamIn::ReadCommand::READ;
+    parameters.params.read = periodBytes;
+    IStreamIn::ReadStatus status;
+    bool failed = false;
+    const nsecs_t cpuStart = processCpuTime();
+
+    for (auto _ : state) {
+        const nsecs_t start = systemTime();
+        if (!commandMQ->write(&parameters)) {
+            failed = true;
+            break;
+        }
+        efGroup->wake(static_cast<uint32_t>(MessageQueueFlagBits::NOT_FULL));
+        if (!waitForStatus(efGroup, MessageQueueFlagBits::NOT_EMPTY, statusMQ.get(), &status) ||
+            status.retval != Result::OK || status.reply.read != periodBytes ||
+            !dataMQ->read(period.data(), periodBytes)) {
+            failed = true;
+            break;
+        }
+        roundTrips.push_back(systemTime() - start);
+    }
+
+    const nsecs_t cpuTime = processCpuTime() - cpuStart;
+    stream->close();
+    EventFlag::deleteEventFlag(&efGroup);
+    if (failed) {
+        state.SkipWithError("read round trip failed");
+        return;
+    }
+    state.SetBytesProcessed(state.iterations() * periodBytes);
+    reportRoundTrips(state, &roundTrips, cpuTime, transferDelay);
+}
+
+// Periods of 1, 2, 4, 10 and 20 ms at 48 kHz, against a HAL transfer that is
+// either instantaneous or blocks for 100 us.
+void PeriodArguments(::benchmark::internal::Benchmark* b) {
+    b->ArgNames({"frames", "delay_us"});
+    for (int frames : {48, 96, 192, 480, 960}) {
+        for (int delayUs : {0, 100}) {
+            b->Args({frames, delayUs});
+        }
+    }
+    b->UseRealTime();
+}
+
+BENCHMARK(BM_StreamOutWrite)->Apply(PeriodArguments);
+BENCHMARK(BM_StreamInRead)->Apply(PeriodArguments);
+
+}  // namespace
+}  // namespace benchmark
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
+
+BENCHMARK_MAIN();
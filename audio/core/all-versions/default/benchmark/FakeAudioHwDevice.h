@@ -0,0 +1,222 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include <hardware/audio.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace benchmark {
+
+// FakeAudioHwDevice is a legacy audio_hw_device whose output streams write
+// into a memory sink and whose input streams read from a memory source.
+// Every write() and read() blocks for a configurable delay to stand in for
+// the time a real HAL spends on the transfer, so that benchmarks measure
+// the cost of the HIDL wrapper around it rather than the cost of audio I/O.
+//
+// The device is owned by the wrapper's Device, which closes it.
+class FakeAudioHwDevice {
+   public:
+    static constexpr uint32_t kSampleRate = 48000;
+    static constexpr size_t kFrameSize = 4;  // 16 bit stereo
+    static constexpr size_t kBufferFrames = 192;
+
+    static audio_hw_device_t* create(nsecs_t transferDelayNs) {
+        return &(new FakeAudioHwDevice(transferDelayNs))->mDevice;
+    }
+
+   private:
+    // Sink and source of every stream, large enough for any benchmarked period.
+    static constexpr size_t kMemorySize = 64 * 1024;
+
+    struct StreamOut {
+        audio_stream_out_t stream;  // must be first
+        nsecs_t delayNs;
+        std::atomic<uint64_t> framesWritten{0};
+        size_t sinkOffset = 0;
+        uint8_t sink[kMemorySize];
+    };
+
+    struct StreamIn {
+        audio_stream_in_t stream;  // must be first
+        nsecs_t delayNs;
+        std::atomic<int64_t> framesRead{0};
+        size_t sourceOffset = 0;
+        uint8_t source[kMemorySize];
+    };
+
+    explicit FakeAudioHwDevice(nsecs_t transferDelayNs) : mDelayNs(transferDelayNs) {
+        mDevice.common.tag = HARDWARE_DEVICE_TAG;
+        mDevice.common.version = AUDIO_DEVICE_API_VERSION_3_0;
+        mDevice.common.close = [](hw_device_t* device) {
+            delete reinterpret_cast<FakeAudioHwDevice*>(device);
+            return 0;
+        };
+        mDevice.init_check = [](const audio_hw_device_t*) { return 0; };
+        mDevice.set_voice_volume = [](audio_hw_device_t*, float) { return 0; };
+        mDevice.set_mode = [](audio_hw_device_t*, audio_mode_t) { return 0; };
+        mDevice.set_mic_mute = [](audio_hw_device_t*, bool) { return 0; };
+        mDevice.get_mic_mute = [](const audio_hw_device_t*, bool* state) {
+            *state = false;
+            return 0;
+        };
+        mDevice.set_parameters = [](audio_hw_device_t*, const char*) { return 0; };
+        mDevice.get_parameters = [](const audio_hw_device_t*, const char*) { return strdup(""); };
+        mDevice.get_input_buffer_size = [](const audio_hw_device_t*, const audio_config*) {
+            return kBufferFrames * kFrameSize;
+        };
+        mDevice.open_output_stream = openOutputStream;
+        mDevice.close_output_stream = [](audio_hw_device_t*, audio_stream_out_t* stream) {
+            delete reinterpret_cast<StreamOut*>(stream);
+        };
+        mDevice.open_input_stream = openInputStream;
+        mDevice.close_input_stream = [](audio_hw_device_t*, audio_stream_in_t* stream) {
+            delete reinterpret_cast<StreamIn*>(stream);
+        };
+        mDevice.dump = [](const audio_hw_device_t*, int) { return 0; };
+    }
+
+    static FakeAudioHwDevice* fromDevice(audio_hw_device_t* device) {
+        return reinterpret_cast<FakeAudioHwDevice*>(device);
+    }
+
+    static void fillCommon(audio_stream_t* common) {
+        common->get_sample_rate = [](const audio_stream_t*) { return kSampleRate; };
+        common->set_sample_rate = [](audio_stream_t*, uint32_t) { return -ENOSYS; };
+        common->get_buffer_size = [](const audio_stream_t*) { return kBufferFrames * kFrameSize; };
+        common->set_format = [](audio_stream_t*, audio_format_t) { return -ENOSYS; };
+        common->get_format = [](const audio_stream_t*) { return AUDIO_FORMAT_PCM_16_BIT; };
+        common->standby = [](audio_stream_t*) { return 0; };
+        common->dump = [](const audio_stream_t*, int) { return 0; };
+        common->set_parameters = [](audio_stream_t*, const char*) { return 0; };
+        common->get_parameters = [](const audio_stream_t*, const char*) { return strdup(""); };
+        common->add_audio_effect = [](const audio_stream_t*, effect_handle_t) { return 0; };
+        common->remove_audio_effect = [](const audio_stream_t*, effect_handle_t) { return 0; };
+    }
+
+    static void transferDelay(nsecs_t delayNs) {
+        if (delayNs <= 0) return;
+        struct timespec delay = {static_cast<time_t>(delayNs / 1000000000),
+                                 static_cast<long>(delayNs % 1000000000)};
+        nanosleep(&delay, nullptr);
+    }
+
+    // Copies between 'buffer' and the circular 'memory', starting at '*offset'.
+    static void copyCircular(uint8_t* memory, size_t* offset, void* buffer, size_t bytes,
+                             bool toMemory) {
+        auto data = static_cast<uint8_t*>(buffer);
+        while (bytes > 0) {
+            const size_t chunk = std::min(bytes, kMemorySize - *offset);
+            if (toMemory) {
+                memcpy(memory + *offset, data, chunk);
+            } else {
+                memcpy(data, memory + *offset, chunk);
+            }
+            *offset = (*offset + chunk) % kMemorySize;
+            data += chunk;
+            bytes -= chunk;
+        }
+    }
+
+    static int openOutputStream(audio_hw_device_t* device, audio_io_handle_t, audio_devices_t,
+                                audio_output_flags_t, audio_config* config,
+                                audio_stream_out_t** streamOut, const char*) {
+        auto out = new StreamOut{};
+        out->delayNs = fromDevice(device)->mDelayNs;
+        fillCommon(&out->stream.common);
+        out->stream.common.get_channels = [](const audio_stream_t*) {
+            return static_cast<audio_channel_mask_t>(AUDIO_CHANNEL_OUT_STEREO);
+        };
+        out->stream.get_latency = [](const audio_stream_out_t*) { return uint32_t(4); };
+        out->stream.write = [](audio_stream_out_t* stream, const void* buffer, size_t bytes) {
+            auto out = reinterpret_cast<StreamOut*>(stream);
+            transferDelay(out->delayNs);
+            copyCircular(out->sink, &out->sinkOffset, const_cast<void*>(buffer), bytes, true);
+            out->framesWritten += bytes / kFrameSize;
+            return static_cast<ssize_t>(bytes);
+        };
+        out->stream.get_render_position = [](const audio_stream_out_t* stream,
+                                              uint32_t* dspFrames) {
+            *dspFrames = reinterpret_cast<const StreamOut*>(stream)->framesWritten.load();
+            return 0;
+        };
+        out->stream.get_presentation_position = [](const audio_stream_out_t* stream,
+                                                    uint64_t* frames, struct timespec* timestamp) {
+            *frames = reinterpret_cast<const StreamOut*>(stream)->framesWritten.load();
+            clock_gettime(CLOCK_MONOTONIC, timestamp);
+            return 0;
+        };
+        config->sample_rate = kSampleRate;
+        config->channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+        config->format = AUDIO_FORMAT_PCM_16_BIT;
+        *streamOut = &out->stream;
+        return 0;
+    }
+
+    static int openInputStream(audio_hw_device_t* device, audio_io_handle_t, audio_devices_t,
+                               audio_config* config, audio_stream_in_t** streamIn,
+                               audio_input_flags_t, const char*, audio_source_t) {
+        auto in = new StreamIn{};
+        in->delayNs = fromDevice(device)->mDelayNs;
+        for (size_t i = 0; i < kMemorySize; i++) {
+            in->source[i] = static_cast<uint8_t>(i);
+        }
+        fillCommon(&in->stream.common);
+        in->stream.common.get_channels = [](const audio_stream_t*) {
+            return static_cast<audio_channel_mask_t>(AUDIO_CHANNEL_IN_STEREO);
+        };
+        in->stream.set_gain = [](audio_stream_in_t*, float) { return 0; };
+        in->stream.read = [](audio_stream_in_t* stream, void* buffer, size_t bytes) {
+            auto in = reinterpret_cast<StreamIn*>(stream);
+            transferDelay(in->delayNs);
+            copyCircular(in->source, &in->sourceOffset, buffer, bytes, false);
+            in->framesRead += bytes / kFrameSize;
+            return static_cast<ssize_t>(bytes);
+        };
+        in->stream.get_input_frames_lost = [](audio_stream_in_t*) { return uint32_t(0); };
+        in->stream.get_capture_position = [](const audio_stream_in_t* stream, int64_t* frames,
+                                             int64_t* time) {
+            *frames = reinterpret_cast<const StreamIn*>(stream)->framesRead.load();
+            *time = systemTime(SYSTEM_TIME_MONOTONIC);
+            return 0;
+        };
+        config->sample_rate = kSampleRate;
+        config->channel_mask = AUDIO_CHANNEL_IN_STEREO;
+        config->format = AUDIO_FORMAT_PCM_16_BIT;
+        *streamIn = &in->stream;
+        return 0;
+    }
+
+    audio_hw_device_t mDevice = {};  // must be first
+    const nsecs_t mDelayNs;
+};
+
+}  // namespace benchmark
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_AUDIO_MMAPPOSITIONMIRROR_H
+#define ANDROID_HARDWARE_AUDIO_MMAPPOSITIONMIRROR_H
+
+#include <atomic>
+#include <functional>
+#include <type_traits>
+
+#include <hardware/audio.h>
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/Thread.h>
+#include <utils/Timers.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+/** Layout of the read-only page that MmapPositionMirror publishes.
+ *
+ * The page is passed to the client as the second fd of the native handle in
+ * MmapBufferInfo.sharedMemory; the first fd remains the audio buffer. Fields
+ * are guarded by a sequence lock: the writer makes 'sequence' odd while it
+ * updates them, so a reader retries until it sees the same even value before
+ * and after reading.
+ */
+struct MmapPositionPage {
+    static constexpr uint32_t kMagic = 0x4d504d41;  // "AMPM"
+    static constexpr uint32_t kVersion = 1;
+
+    // Set once before the page is shared.
+    uint32_t magic;
+    uint32_t version;
+    uint32_t updatePeriodUs;
+    uint32_t reserved;
+
+    std::atomic<uint32_t> sequence;
+    std::atomic<int32_t> positionFrames;
+    // CLOCK_MONOTONIC time of positionFrames, 0 while the stream is stopped.
+    std::atomic<int64_t> timeNanoseconds;
+    // CLOCK_MONOTONIC time at which the HAL was last queried.
+    std::atomic<int64_t> updateTimeNanoseconds;
+
+    /** Copies a consistent snapshot of the position.
+     * @return false if the writer kept updating the page for maxRetries
+     *         attempts or no position is currently available, in which case
+     *         the client should fall back to IStream.getMmapPosition().
+     */
+    bool read(int64_t* timeNs, int32_t* frames, int64_t* updateTimeNs,
+              int maxRetries = 8) const {
+        for (int i = 0; i < maxRetries; ++i) {
+            uint32_t begin = sequence.load(std::memory_order_acquire);
+            if (begin & 1) continue;
+            int64_t time = timeNanoseconds.load(std::memory_order_relaxed);
+            int32_t position = positionFrames.load(std::memory_order_relaxed);
+            int64_t update = updateTimeNanoseconds.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) != begin) continue;
+            if (time == 0) return false;
+            *timeNs = time;
+            *frames = position;
+            *updateTimeNs = update;
+            return true;
+        }
+        return false;
+    }
+};
+
+static_assert(std::is_standard_layout<MmapPositionPage>::value,
+              "MmapPositionPage is shared across processes");
+static_assert(sizeof(MmapPositionPage) == 40, "MmapPositionPage layout changed");
+
+/** Publishes the position of an mmap stream into a shared page so that the
+ * client can poll it without a binder transaction.
+ *
+ * A helper thread queries the HAL at the rate given by
+ * ro.vendor.audio.hal.mmap_position_mirror_hz while the stream is started.
+ * The mirror is disabled when the property is unset or 0.
+ */
+class MmapPositionMirror : public Thread {
+   public:
+    using PositionGetter = std::function<int(struct audio_mmap_position*)>;
+
+    /** @return nullptr if the mirror is disabled or cannot be allocated. */
+    static sp<MmapPositionMirror> create(PositionGetter getter);
+
+    virtual ~MmapPositionMirror();
+
+    /** File descriptor of the page, owned by the mirror. */
+    int getFd() const { return mFd; }
+
+    /** Starts or pauses refreshing the page. Pausing marks the position as
+     * unavailable, as the HAL resets it when the stream stops. */
+    void setActive(bool active);
+
+    /** Stops the helper thread. Must be called before the HAL stream is closed. */
+    void exit();
+
+   private:
+    MmapPositionMirror(PositionGetter getter, int fd, MmapPositionPage* page, nsecs_t period);
+
+    bool threadLoop() override;
+    void publish(int64_t timeNs, int32_t frames, int64_t updateTimeNs);
+
+    const PositionGetter mGetter;
+    const int mFd;
+    MmapPositionPage* const mPage;
+    const nsecs_t mPeriod;
+
+    Mutex mLock;
+    Condition mCondition;
+    bool mActive = false;  // guarded by mLock
+};
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_AUDIO_MMAPPOSITIONMIRROR_H
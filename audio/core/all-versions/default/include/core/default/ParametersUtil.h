@@ -21,6 +21,10 @@
 
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include <hidl/HidlSupport.h>
 #include <media/AudioParameter.h>
@@ -55,10 +59,39 @@ class ParametersUtil {
     Result setParam(const char* name, const DeviceAddress& address);
 
    protected:
+    ParametersUtil();
     virtual ~ParametersUtil() {}
 
     virtual char* halGetParameters(const char* keys) = 0;
     virtual int halSetParameters(const char* keysAndValues) = 0;
+
+   private:
+    void getParametersNoContext(
+        const hidl_vec<hidl_string>& keys,
+        std::function<void(Result retval, const hidl_vec<ParameterValue>& parameters)> cb);
+
+    /** Keys listed in ro.vendor.audio.hal.immutable_params, whose values are
+     * cached after the first successful context-free get. Every set drops the
+     * cache, as it may reconfigure what the HAL reports.
+     */
+    bool isImmutable(const char* key) const;
+    bool appendCachedValue(const char* key, std::string* value);
+    void cacheValue(const char* key, const char* value, size_t valueLength);
+    void clearCache();
+
+    std::vector<std::string> mImmutableKeys;
+    std::mutex mCacheLock;
+    std::vector<std::pair<std::string, std::string>> mCache;
+
+    /** Reused by getParametersNoContext for the keys sent to the HAL, copies of
+     * cached values and the reply, so that polling does not allocate. The
+     * lock serializes context-free gets on one device or stream.
+     */
+    std::mutex mGetBuffersLock;
+    std::string mKeysBuffer;
+    std::string mValuesBuffer;
+    std::vector<size_t> mCachedValueOffsets;
+    std::vector<ParameterValue> mResultBuffer;
 };
 
 }  // namespace implementation
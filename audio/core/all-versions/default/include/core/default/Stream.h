@@ -19,6 +19,7 @@
 
 #include PATH(android/hardware/audio/FILE_VERSION/IStream.h)
 
+#include "MmapPositionMirror.h"
 #include "ParametersUtil.h"
 
 #include <vector>
@@ -128,23 +129,33 @@ struct StreamMmap : public RefBase {
     Return<void> createMmapBuffer(int32_t minSizeFrames, size_t frameSize,
                                   IStream::createMmapBuffer_cb _hidl_cb);
     Return<void> getMmapPosition(IStream::getMmapPosition_cb _hidl_cb);
+    /** Stops the position mirror thread, must be called before closing the HAL stream. */
+    void close();
 
    private:
     StreamMmap() {}
 
     T* mStream;
+    // Shared position page, created with the first mmap buffer if enabled.
+    sp<MmapPositionMirror> mPositionMirror;
 };
 
 template <typename T>
 Return<Result> StreamMmap<T>::start() {
     if (mStream->start == NULL) return Result::NOT_SUPPORTED;
     int result = mStream->start(mStream);
+    if (result == 0 && mPositionMirror != nullptr) {
+        mPositionMirror->setActive(true);
+    }
     return Stream::analyzeStatus("start", result);
 }
 
 template <typename T>
 Return<Result> StreamMmap<T>::stop() {
     if (mStream->stop == NULL) return Result::NOT_SUPPORTED;
+    if (mPositionMirror != nullptr) {
+        mPositionMirror->setActive(false);
+    }
     int result = mStream->stop(mStream);
     return Stream::analyzeStatus("stop", result);
 }
@@ -161,8 +172,20 @@ Return<void> StreamMmap<T>::createMmapBuffer(int32_t minSizeFrames, size_t frame
         retval = Stream::analyzeStatus(
             "create_mmap_buffer", mStream->create_mmap_buffer(mStream, minSizeFrames, &halInfo));
         if (retval == Result::OK) {
-            hidlHandle = native_handle_create(1, 0);
+            if (mPositionMirror == nullptr && mStream->get_mmap_position != NULL) {
+                T* stream = mStream;
+                mPositionMirror =
+                    MmapPositionMirror::create([stream](struct audio_mmap_position* position) {
+                        return stream->get_mmap_position(stream, position);
+                    });
+            }
+            // The position page, if any, travels as an extra fd after the
+            // audio buffer so that clients unaware of it are not affected.
+            hidlHandle = native_handle_create(mPositionMirror != nullptr ? 2 : 1, 0);
             hidlHandle->data[0] = halInfo.shared_memory_fd;
+            if (mPositionMirror != nullptr) {
+                hidlHandle->data[1] = mPositionMirror->getFd();
+            }
 
             // Negative buffer size frame is a legacy hack to indicate that the buffer
             // is shareable to applications before the relevant flag was introduced
@@ -209,6 +232,14 @@ Return<void> StreamMmap<T>::getMmapPosition(IStream::getMmapPosition_cb _hidl_cb
     return Void();
 }
 
+template <typename T>
+void StreamMmap<T>::close() {
+    if (mPositionMirror != nullptr) {
+        mPositionMirror->exit();
+        mPositionMirror.clear();
+    }
+}
+
 }  // namespace implementation
 }  // namespace CPP_VERSION
 }  // namespace audio
@@ -21,6 +21,7 @@
 
 #include "Device.h"
 #include "Stream.h"
+#include "StreamStats.h"
 
 #include <atomic>
 #include <memory>
@@ -130,6 +131,7 @@ struct StreamIn : public IStreamIn {
     std::unique_ptr<StatusMQ> mStatusMQ;
     EventFlag* mEfGroup;
     std::atomic<bool> mStopReadThread;
+    StreamStats mStats;
     sp<Thread> mReadThread;
 
     virtual ~StreamIn();
@@ -21,9 +21,11 @@
 
 #include "Device.h"
 #include "Stream.h"
+#include "StreamStats.h"
 
 #include <atomic>
 #include <memory>
+#include <mutex>
 
 #include <fmq/EventFlag.h>
 #include <fmq/MessageQueue.h>
@@ -50,7 +52,7 @@ struct StreamOut : public IStreamOut {
     typedef MessageQueue<uint8_t, kSynchronizedReadWrite> DataMQ;
     typedef MessageQueue<WriteStatus, kSynchronizedReadWrite> StatusMQ;
 
-    StreamOut(const sp<Device>& device, audio_stream_out_t* stream);
+    StreamOut(const sp<Device>& device, audio_stream_out_t* stream, audio_output_flags_t flags);
 
     // Methods from ::android::hardware::audio::CPP_VERSION::IStream follow.
     Return<uint64_t> getFrameSize() override;
@@ -129,14 +131,26 @@ struct StreamOut : public IStreamOut {
     bool mIsClosed;
     const sp<Device> mDevice;
     audio_stream_out_t* mStream;
+    const audio_output_flags_t mFlags;
     const sp<Stream> mStreamCommon;
     const sp<StreamMmap<audio_stream_out_t>> mStreamMmap;
     sp<IStreamOutCallback> mCallback;
     std::unique_ptr<CommandMQ> mCommandMQ;
     std::unique_ptr<DataMQ> mDataMQ;
     std::unique_ptr<StatusMQ> mStatusMQ;
+    // How the DataMQ was sized, set once by prepareForWriting and read by
+    // debug() from another binder thread.
+    struct DataMQSizing {
+        uint32_t requestedFrames;
+        size_t capacityFrames;
+        size_t frameSize;
+        const char* policy;
+    };
+    std::mutex mDataMQSizingLock;
+    DataMQSizing mDataMQSizing = {};
     EventFlag* mEfGroup;
     std::atomic<bool> mStopWriteThread;
+    StreamStats mStats;
     sp<Thread> mWriteThread;
 
     virtual ~StreamOut();
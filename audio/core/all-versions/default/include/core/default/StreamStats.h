@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_HARDWARE_AUDIO_STREAMSTATS_H
+#define ANDROID_HARDWARE_AUDIO_STREAMSTATS_H
+
+#include <atomic>
+#include <string>
+
+#include <utils/Timers.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+/** Timing and error statistics of a stream's writer or reader thread.
+ *
+ * The thread is the only writer, so every update is a relaxed load and store
+ * without read-modify-write, and recording never allocates or locks.
+ * dump() may run concurrently on a binder thread and sees a slightly torn,
+ * but never invalid, view.
+ */
+class StreamStats {
+   public:
+    enum class Timing {
+        WAKE_TO_HAL,  // from the EventFlag wake-up to the call into the HAL
+        FMQ,          // moving data through the DataMQ
+        HAL,          // the HAL write() or read() call
+        STATUS,       // posting the StatusMQ reply and waking the client
+        CYCLE,        // between the starts of two consecutive transfers
+        COUNT
+    };
+
+    enum class Event {
+        UNDERRUN,      // WRITE with nothing in the DataMQ
+        OVERRUN,       // READ truncated because the DataMQ was full
+        STATUS_WRITE_FAILURE,
+        COUNT
+    };
+
+    /** @param name prefix for the atrace counters, e.g. "AudioOut". */
+    explicit StreamStats(const char* name);
+
+    void record(Timing timing, nsecs_t duration) {
+        mHistograms[static_cast<size_t>(timing)].record(duration);
+    }
+
+    void record(Event event) {
+        auto& counter = mEvents[static_cast<size_t>(event)];
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    /** Records the number of bytes moved by one transfer. */
+    void recordTransfer(size_t bytes) {
+        mTransferCount.store(mTransferCount.load(std::memory_order_relaxed) + 1,
+                             std::memory_order_relaxed);
+        mTransferBytes.store(mTransferBytes.load(std::memory_order_relaxed) + bytes,
+                             std::memory_order_relaxed);
+        if (bytes > mMaxTransferBytes.load(std::memory_order_relaxed)) {
+            mMaxTransferBytes.store(bytes, std::memory_order_relaxed);
+        }
+    }
+
+    size_t getMaxTransferBytes() const { return mMaxTransferBytes.load(std::memory_order_relaxed); }
+
+    /** Emits atrace counters at most once per second while audio tracing is on. */
+    void traceIfEnabled(nsecs_t now);
+
+    void dump(int fd) const;
+
+   private:
+    // Power of two microsecond buckets: [0, 1), [1, 2), [2, 4), ... [2^15, inf).
+    static constexpr size_t kBucketCount = 17;
+    static constexpr size_t kTimingCount = static_cast<size_t>(Timing::COUNT);
+    static constexpr size_t kEventCount = static_cast<size_t>(Event::COUNT);
+
+    struct Histogram {
+        std::atomic<uint64_t> buckets[kBucketCount] = {};
+        std::atomic<uint64_t> count{0};
+        std::atomic<int64_t> totalNs{0};
+        std::atomic<int64_t> maxNs{0};
+
+        void record(nsecs_t duration);
+    };
+
+    Histogram mHistograms[kTimingCount];
+    std::atomic<uint64_t> mEvents[kEventCount] = {};
+    std::atomic<uint64_t> mTransferCount{0};
+    std::atomic<uint64_t> mTransferBytes{0};
+    std::atomic<size_t> mMaxTransferBytes{0};
+
+    // Written by the stream thread only.
+    const std::string mHalTraceName;
+    const std::string mEventTraceName;
+    nsecs_t mLastTraceNs = 0;
+    uint64_t mLastTraceCount = 0;
+    int64_t mLastTraceTotalNs = 0;
+};
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
+
+#endif  // ANDROID_HARDWARE_AUDIO_STREAMSTATS_H
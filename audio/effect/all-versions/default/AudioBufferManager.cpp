@@ -25,29 +25,51 @@ namespace android {
 ANDROID_SINGLETON_STATIC_INSTANCE(AudioBufferManager);
 
 bool AudioBufferManager::wrap(const AudioBuffer& buffer, sp<AudioBufferWrapper>* wrapper) {
+    Shard& shard = getShard(buffer.id);
     // Check if we have this buffer already
-    std::lock_guard<std::mutex> lock(mLock);
-    ssize_t idx = mBuffers.indexOfKey(buffer.id);
-    if (idx >= 0) {
-        *wrapper = mBuffers[idx].promote();
-        if (*wrapper != nullptr) {
-            (*wrapper)->getHalBuffer()->frameCount = buffer.frameCount;
-            return true;
+    {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        ssize_t idx = shard.buffers.indexOfKey(buffer.id);
+        if (idx >= 0) {
+            *wrapper = shard.buffers[idx].promote();
+            if (*wrapper != nullptr) {
+                (*wrapper)->getHalBuffer()->frameCount = buffer.frameCount;
+                return true;
+            }
+            shard.buffers.removeItemsAt(idx);
         }
-        mBuffers.removeItemsAt(idx);
     }
-    // Need to create and init a new AudioBufferWrapper.
+    // Need to create and init a new AudioBufferWrapper. Mapping the memory may
+    // take a while, so do it without holding the shard lock.
     sp<AudioBufferWrapper> tempBuffer(new AudioBufferWrapper(buffer));
     if (!tempBuffer->init()) return false;
+
+    std::lock_guard<std::mutex> lock(shard.lock);
+    ssize_t idx = shard.buffers.indexOfKey(buffer.id);
+    if (idx >= 0) {
+        // Another thread has wrapped the same buffer meanwhile, share its mapping.
+        // Ours is released after the lock, and leaves the entry alone.
+        sp<AudioBufferWrapper> existing = shard.buffers[idx].promote();
+        if (existing != nullptr) {
+            existing->getHalBuffer()->frameCount = buffer.frameCount;
+            *wrapper = existing;
+            return true;
+        }
+        shard.buffers.replaceValueAt(idx, tempBuffer);
+    } else {
+        shard.buffers.add(buffer.id, tempBuffer);
+    }
     *wrapper = tempBuffer;
-    mBuffers.add(buffer.id, *wrapper);
     return true;
 }
 
-void AudioBufferManager::removeEntry(uint64_t id) {
-    std::lock_guard<std::mutex> lock(mLock);
-    ssize_t idx = mBuffers.indexOfKey(id);
-    if (idx >= 0) mBuffers.removeItemsAt(idx);
+void AudioBufferManager::removeEntry(uint64_t id, AudioBufferWrapper* wrapper) {
+    Shard& shard = getShard(id);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    ssize_t idx = shard.buffers.indexOfKey(id);
+    if (idx >= 0 && shard.buffers[idx].unsafe_get() == wrapper) {
+        shard.buffers.removeItemsAt(idx);
+    }
 }
 
 namespace hardware {
@@ -60,7 +82,7 @@ AudioBufferWrapper::AudioBufferWrapper(const AudioBuffer& buffer)
     : mHidlBuffer(buffer), mHalBuffer{0, {nullptr}} {}
 
 AudioBufferWrapper::~AudioBufferWrapper() {
-    AudioBufferManager::getInstance().removeEntry(mHidlBuffer.id);
+    AudioBufferManager::getInstance().removeEntry(mHidlBuffer.id, this);
 }
 
 bool AudioBufferWrapper::init() {
@@ -72,11 +72,25 @@ class AudioBufferManager : public Singleton<AudioBufferManager> {
    private:
     friend class hardware::audio::effect::CPP_VERSION::implementation::AudioBufferWrapper;
 
-    // Called by AudioBufferWrapper.
-    void removeEntry(uint64_t id);
+    // Buffers are spread over independently locked shards by id, so that
+    // effects set up on different buffers do not wait for each other.
+    static constexpr size_t kShardCount = 16;
 
-    std::mutex mLock;
-    KeyedVector<uint64_t, wp<AudioBufferWrapper>> mBuffers;
+    struct Shard {
+        std::mutex lock;
+        KeyedVector<uint64_t, wp<AudioBufferWrapper>> buffers;
+    };
+
+    Shard& getShard(uint64_t id) {
+        // Ids are usually sequential, mix them before picking a shard.
+        return mShards[((id * 0x9e3779b97f4a7c15ULL) >> 32) % kShardCount];
+    }
+
+    // Called by AudioBufferWrapper. Only removes the entry if it still refers
+    // to the given wrapper, as it may have been replaced meanwhile.
+    void removeEntry(uint64_t id, AudioBufferWrapper* wrapper);
+
+    Shard mShards[kShardCount];
 };
 
 }  // namespace android
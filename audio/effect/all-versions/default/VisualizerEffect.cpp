@@ -18,8 +18,14 @@
 
 #include "VisualizerEffect.h"
 
+#include <string.h>
+
+#include <atomic>
+
 #include <android/log.h>
+#include <cutils/properties.h>
 #include <system/audio_effects/effect_visualizer.h>
+#include <utils/Timers.h>
 
 #include "VersionUtils.h"
 
@@ -30,8 +36,118 @@ namespace effect {
 namespace CPP_VERSION {
 namespace implementation {
 
+namespace {
+
+constexpr size_t kSnapshotCount = 4;
+// Snapshots stop when the client has not polled for this long.
+constexpr nsecs_t kSnapshotIdleTimeoutNs = 1000000000;
+// Snapshots are taken at most once per processed buffer, so with longer
+// buffer periods than this the effect library is queried directly instead.
+constexpr nsecs_t kSnapshotMaxBufferPeriodNs = 40000000;
+
+}  // namespace
+
+// A ring of snapshots written by the processing thread and read by binder
+// threads. Each slot is guarded by a sequence lock; the writer fills the
+// slot after the latest one, so a reader is only disturbed if the writer
+// laps the whole ring while it copies.
+struct VisualizerEffect::Snapshots {
+    struct Slot {
+        std::atomic<uint32_t> sequence{0};
+        nsecs_t time = 0;
+        uint32_t captureSize = 0;  // 0 if the capture failed
+        bool hasMeasurement = false;
+        uint8_t capture[VISUALIZER_CAPTURE_SIZE_MAX];
+        int32_t measurement[MEASUREMENT_COUNT];
+    };
+
+    Snapshots(effect_handle_t handle, nsecs_t interval) : handle(handle), interval(interval) {}
+
+    void take();
+    template <typename Copy>
+    bool readLatest(Copy copy);
+
+    const effect_handle_t handle;
+    const nsecs_t interval;
+    // Written by binder threads.
+    std::atomic<uint16_t> captureSize{0};
+    std::atomic<bool> measuring{false};
+    std::atomic<nsecs_t> lastPollTime{0};
+    // Index of the latest slot, kSnapshotCount before the first snapshot.
+    std::atomic<size_t> latest{kSnapshotCount};
+    // Processing thread only.
+    nsecs_t lastTakeTime = 0;
+    size_t next = 0;
+    Slot slots[kSnapshotCount];
+};
+
+// Called on the processing thread after the visualizer has processed a buffer.
+void VisualizerEffect::Snapshots::take() {
+    const nsecs_t now = systemTime();
+    if (now - lastPollTime.load(std::memory_order_relaxed) > kSnapshotIdleTimeoutNs ||
+        now - lastTakeTime < interval) {
+        return;
+    }
+    lastTakeTime = now;
+
+    Slot& slot = slots[next];
+    const uint32_t sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.time = now;
+    slot.captureSize = 0;
+    const uint32_t size = captureSize.load(std::memory_order_relaxed);
+    if (size != 0 && size <= sizeof(slot.capture)) {
+        uint32_t replySize = size;
+        if ((*handle)->command(handle, VISUALIZER_CMD_CAPTURE, 0, NULL, &replySize,
+                               slot.capture) == 0 &&
+            replySize == size) {
+            slot.captureSize = size;
+        }
+    }
+    slot.hasMeasurement = false;
+    if (measuring.load(std::memory_order_relaxed)) {
+        uint32_t replySize = sizeof(slot.measurement);
+        slot.hasMeasurement = (*handle)->command(handle, VISUALIZER_CMD_MEASURE, 0, NULL,
+                                                 &replySize, slot.measurement) == 0 &&
+                              replySize == sizeof(slot.measurement);
+    }
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+    latest.store(next, std::memory_order_release);
+    next = (next + 1) % kSnapshotCount;
+}
+
+// Records the poll and copies the latest snapshot if it is recent enough.
+// 'copy' returns false if the snapshot lacks the requested data.
+template <typename Copy>
+bool VisualizerEffect::Snapshots::readLatest(Copy copy) {
+    const nsecs_t now = systemTime();
+    lastPollTime.store(now, std::memory_order_relaxed);
+    const size_t index = latest.load(std::memory_order_acquire);
+    if (index >= kSnapshotCount) return false;
+    const Slot& slot = slots[index];
+    const uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+    // Older snapshots mean that the stream is not being processed.
+    if ((sequence & 1) || now - slot.time > interval + kSnapshotMaxBufferPeriodNs ||
+        !copy(slot)) {
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.sequence.load(std::memory_order_relaxed) == sequence;
+}
+
 VisualizerEffect::VisualizerEffect(effect_handle_t handle)
-    : mEffect(new Effect(handle)), mCaptureSize(0), mMeasurementMode(MeasurementMode::NONE) {}
+    : mEffect(new Effect(handle)), mCaptureSize(0), mMeasurementMode(MeasurementMode::NONE) {
+    const int32_t intervalMs =
+        property_get_int32("ro.vendor.audio.hal.visualizer_snapshot_interval_ms", 10);
+    if (intervalMs > 0) {
+        mSnapshots = std::make_shared<Snapshots>(handle, ms2ns(intervalMs));
+        auto snapshots = mSnapshots;
+        mEffect->mProcessHook = [snapshots] { snapshots->take(); };
+    }
+}
 
 VisualizerEffect::~VisualizerEffect() {}
 
@@ -171,6 +287,7 @@ Return<Result> VisualizerEffect::setCaptureSize(uint16_t captureSize) {
     Result retval = mEffect->setParam(VISUALIZER_PARAM_CAPTURE_SIZE, captureSize);
     if (retval == Result::OK) {
         mCaptureSize = captureSize;
+        if (mSnapshots) mSnapshots->captureSize.store(captureSize, std::memory_order_relaxed);
     }
     return retval;
 }
@@ -204,6 +321,10 @@ Return<Result> VisualizerEffect::setMeasurementMode(
         mEffect->setParam(VISUALIZER_PARAM_MEASUREMENT_MODE, static_cast<int32_t>(measurementMode));
     if (retval == Result::OK) {
         mMeasurementMode = measurementMode;
+        if (mSnapshots) {
+            mSnapshots->measuring.store(measurementMode != MeasurementMode::NONE,
+                                        std::memory_order_relaxed);
+        }
     }
     return retval;
 }
@@ -222,8 +343,15 @@ Return<void> VisualizerEffect::capture(capture_cb _hidl_cb) {
     }
     uint32_t halCaptureSize = mCaptureSize;
     uint8_t halCapture[mCaptureSize];
-    Result retval = mEffect->sendCommandReturningData(VISUALIZER_CMD_CAPTURE, "VISUALIZER_CAPTURE",
-                                                      &halCaptureSize, halCapture);
+    Result retval = Result::OK;
+    if (!mSnapshots || !mSnapshots->readLatest([&](const Snapshots::Slot& slot) {
+            if (slot.captureSize != halCaptureSize) return false;
+            memcpy(halCapture, slot.capture, halCaptureSize);
+            return true;
+        })) {
+        retval = mEffect->sendCommandReturningData(VISUALIZER_CMD_CAPTURE, "VISUALIZER_CAPTURE",
+                                                   &halCaptureSize, halCapture);
+    }
     hidl_vec<uint8_t> capture;
     if (retval == Result::OK) {
         capture.setToExternal(&halCapture[0], halCaptureSize);
@@ -239,8 +367,15 @@ Return<void> VisualizerEffect::measure(measure_cb _hidl_cb) {
     }
     int32_t halMeasurement[MEASUREMENT_COUNT];
     uint32_t halMeasurementSize = sizeof(halMeasurement);
-    Result retval = mEffect->sendCommandReturningData(VISUALIZER_CMD_MEASURE, "VISUALIZER_MEASURE",
-                                                      &halMeasurementSize, halMeasurement);
+    Result retval = Result::OK;
+    if (!mSnapshots || !mSnapshots->readLatest([&](const Snapshots::Slot& slot) {
+            if (!slot.hasMeasurement) return false;
+            memcpy(halMeasurement, slot.measurement, sizeof(halMeasurement));
+            return true;
+        })) {
+        retval = mEffect->sendCommandReturningData(VISUALIZER_CMD_MEASURE, "VISUALIZER_MEASURE",
+                                                   &halMeasurementSize, halMeasurement);
+    }
     Measurement measurement = {.mode = MeasurementMode::PEAK_RMS};
     measurement.value.peakAndRms.peakMb = 0;
     measurement.value.peakAndRms.rmsMb = 0;
@@ -21,6 +21,8 @@
 
 #include "Effect.h"
 
+#include <memory>
+
 #include <hidl/Status.h>
 
 #include <hidl/MQDescriptor.h>
@@ -103,9 +105,15 @@ struct VisualizerEffect : public IVisualizerEffect {
     Return<void> measure(measure_cb _hidl_cb) override;
 
    private:
+    // Latest captures and measurements, taken on the processing thread while
+    // the client polls, so that polls do not call into the effect library.
+    struct Snapshots;
+
     sp<Effect> mEffect;
     uint16_t mCaptureSize;
     MeasurementMode mMeasurementMode;
+    // Shared with the processing thread, which may outlive this object.
+    std::shared_ptr<Snapshots> mSnapshots;
 
     virtual ~VisualizerEffect();
 };
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "automotive.vehicle@2.0-fake-trace-converter"
+#include <android/log.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include <vhal_v2_0/FakeValueTrace.h>
+#include <vhal_v2_0/JsonFakeValueGenerator.h>
+
+using namespace android::hardware::automotive::vehicle::V2_0;
+
+/**
+ * Converts a fake value JSON file to the binary trace format, so that it can be replayed with
+ * FakeDataCommand::StartJson without being loaded into memory.
+ */
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <input.json> <output.trace>" << std::endl;
+        return 1;
+    }
+    std::ifstream ifs(argv[1]);
+    if (!ifs) {
+        std::cerr << "Couldn't open " << argv[1] << std::endl;
+        return 1;
+    }
+    std::vector<VehiclePropValue> events = impl::JsonFakeValueGenerator::parseFakeValueJson(ifs);
+    // Traces are replayed in recording order
+    std::stable_sort(events.begin(), events.end(),
+                     [](const VehiclePropValue& lhs, const VehiclePropValue& rhs) {
+                         return lhs.timestamp < rhs.timestamp;
+                     });
+
+    impl::FakeValueTraceWriter writer;
+    if (!writer.open(argv[2])) {
+        std::cerr << "Couldn't create " << argv[2] << std::endl;
+        return 1;
+    }
+    for (const auto& event : events) {
+        if (!writer.append(event)) {
+            std::cerr << "Couldn't write " << argv[2] << std::endl;
+            return 1;
+        }
+    }
+    if (!writer.close()) {
+        std::cerr << "Couldn't write " << argv[2] << std::endl;
+        return 1;
+    }
+    std::cout << "Converted " << events.size() << " events" << std::endl;
+    return 0;
+}
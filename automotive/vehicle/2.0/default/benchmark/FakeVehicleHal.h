@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef android_hardware_automotive_vehicle_V2_0_benchmark_FakeVehicleHal_H_
+#define android_hardware_automotive_vehicle_V2_0_benchmark_FakeVehicleHal_H_
+
+#include <utils/SystemClock.h>
+
+#include <vhal_v2_0/VehicleHal.h>
+#include <vhal_v2_0/VehiclePropertyStore.h>
+#include <vhal_v2_0/VehicleUtils.h>
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+namespace benchmark {
+
+/**
+ * FakeVehicleHal serves propertyCount vendor INT32 properties from a VehiclePropertyStore. New
+ * values are published the way the emulated HAL does it: written to the store, then reported to
+ * VehicleHalManager through onHalEvent. Values are stamped with the elapsedRealtimeNano() time of
+ * their publication, so that subscribers can tell how long delivery took.
+ */
+class FakeVehicleHal : public VehicleHal {
+public:
+    FakeVehicleHal(size_t propertyCount, VehiclePropertyStore* store) : mStore(store) {
+        for (size_t i = 0; i < propertyCount; i++) {
+            VehiclePropConfig config = {
+                .prop = getProperty(i),
+                .access = VehiclePropertyAccess::READ_WRITE,
+                .changeMode = VehiclePropertyChangeMode::ON_CHANGE,
+            };
+            mStore->registerProperty(config);
+        }
+    }
+
+    static int32_t getProperty(size_t index) {
+        return static_cast<int32_t>(0x1000 + index) | VehiclePropertyGroup::VENDOR |
+               VehiclePropertyType::INT32 | VehicleArea::GLOBAL;
+    }
+
+    std::vector<VehiclePropConfig> listProperties() override { return mStore->getAllConfigs(); }
+
+    VehiclePropValuePtr get(const VehiclePropValue& requestedPropValue,
+                            StatusCode* outStatus) override {
+        auto value = mStore->readValueOrNull(requestedPropValue);
+        if (value == nullptr) {
+            *outStatus = StatusCode::INVALID_ARG;
+            return nullptr;
+        }
+        *outStatus = StatusCode::OK;
+        return getValuePool()->obtain(*value);
+    }
+
+    StatusCode set(const VehiclePropValue& propValue) override {
+        return mStore->writeValue(propValue, true) ? StatusCode::OK : StatusCode::INVALID_ARG;
+    }
+
+    StatusCode subscribe(int32_t /* property */, float /* sampleRate */) override {
+        return StatusCode::OK;
+    }
+
+    StatusCode unsubscribe(int32_t /* property */) override { return StatusCode::OK; }
+
+    void publish(size_t index, int32_t value) {
+        auto v = getValuePool()->obtainInt32(value);
+        v->prop = getProperty(index);
+        v->areaId = 0;
+        v->timestamp = elapsedRealtimeNano();
+        mStore->writeValue(*v, true);
+        doHalEvent(std::move(v));
+    }
+
+private:
+    VehiclePropertyStore* const mStore;
+};
+
+}  // namespace benchmark
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
+
+#endif  // android_hardware_automotive_vehicle_V2_0_benchmark_FakeVehicleHal_H_
@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "VehicleHalBenchmark"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <utils/SystemClock.h>
+#include <vhal_v2_0/VehicleHalManager.h>
+
+#include "FakeVehicleHal.h"
+
+// Count heap allocations so that the allocation rate of the event path can be
+// reported next to its latency.
+static std::atomic<uint64_t> gAllocationCount(0);
+
+void* operator new(size_t size) {
+    gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = malloc(size);
+    if (!ptr) {
+        abort();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+namespace benchmark {
+namespace {
+
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+constexpr auto kDeliveryTimeout = std::chrono::seconds(10);
+
+// Log-linear histogram of latencies, precise to 1/16 of a power of two, so
+// that percentiles can be reported without keeping every sample.
+class LatencyHistogram {
+   public:
+    void record(int64_t latencyNs) {
+        const uint64_t value = latencyNs > 0 ? latencyNs : 0;
+        if (value < kSubBuckets) {
+            mCounts[value]++;
+        } else {
+            const int shift = 63 - __builtin_clzll(value) - kSubBucketBits;
+            mCounts[((shift + 1) << kSubBucketBits) + ((value >> shift) - kSubBuckets)]++;
+        }
+        mTotal++;
+    }
+
+    // Lower bound of the bucket holding the given percentile.
+    int64_t percentile(int percent) const {
+        const uint64_t rank = (mTotal * percent + 99) / 100;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < mCounts.size(); i++) {
+            seen += mCounts[i];
+            if (seen >= rank && seen > 0) {
+                if (i < kSubBuckets) return i;
+                const int shift = (i >> kSubBucketBits) - 1;
+                return static_cast<int64_t>(kSubBuckets + (i & (kSubBuckets - 1))) << shift;
+            }
+        }
+        return 0;
+    }
+
+   private:
+    static constexpr int kSubBucketBits = 4;
+    static constexpr uint64_t kSubBuckets = 1 << kSubBucketBits;
+
+    std::array<uint64_t, 64 << kSubBucketBits> mCounts = {};
+    uint64_t mTotal = 0;
+};
+
+// Records how long each value took from onHalEvent to the subscriber.
+// VehicleHalManager calls all subscribers from its single dispatch thread, so
+// they share the histogram.
+class LatencyCallback : public IVehicleCallback {
+   public:
+    LatencyCallback(LatencyHistogram* histogram, std::atomic<uint64_t>* received)
+        : mHistogram(histogram), mReceived(received) {}
+
+    Return<void> onPropertyEvent(const hidl_vec<VehiclePropValue>& values) override {
+        const int64_t now = elapsedRealtimeNano();
+        for (const auto& value : values) {
+            mHistogram->record(now - value.timestamp);
+        }
+        mReceived->fetch_add(values.size(), std::memory_order_release);
+        return Void();
+    }
+
+    Return<void> onPropertySet(const VehiclePropValue& /* value */) override { return Void(); }
+
+    Return<void> onPropertySetError(StatusCode /* errorCode */, int32_t /* propId */,
+                                    int32_t /* areaId */) override {
+        return Void();
+    }
+
+   private:
+    LatencyHistogram* const mHistogram;
+    std::atomic<uint64_t>* const mReceived;
+};
+
+struct LockWaits {
+    LockWaitStats queue;
+    LockWaitStats subscriptions;
+    LockWaitStats pool;
+    LockWaitStats store;
+};
+
+LockWaits readLockWaits(const VehicleHalManager& manager, FakeVehicleHal* hal,
+                        const VehiclePropertyStore& store) {
+    return {manager.getEventQueueLockWaitStats(), manager.getSubscriptionLockWaitStats(),
+            hal->getValuePool()->getLockWaitStats(), store.getLockWaitStats()};
+}
+
+void reportLockWait(::benchmark::State& state, const char* name, const LockWaitStats& before,
+                    const LockWaitStats& after, uint64_t events) {
+    state.counters[name] =
+        ::benchmark::Counter(double(after.waitNanos - before.waitNanos) / events);
+}
+
+// state.range(0) subscribers receive state.range(1) properties, each
+// published state.range(2) times per second, or as fast as possible if 0, by
+// state.range(3) producer threads. Paced runs show the latency of a loaded
+// HAL, unpaced ones its throughput, as events queue up when it saturates.
+void BM_HalEventDelivery(::benchmark::State& state) {
+    const size_t subscriberCount = static_cast<size_t>(state.range(0));
+    const size_t propertyCount = static_cast<size_t>(state.range(1));
+    const int64_t rateHz = state.range(2);
+    const size_t producerCount = static_cast<size_t>(state.range(3));
+
+    // Subscribers write to these from the dispatch thread until the manager is destroyed, also
+    // when giving up on undelivered events, so they must outlive it.
+    LatencyHistogram histogram;
+    std::atomic<uint64_t> received(0);
+
+    VehiclePropertyStore store;
+    FakeVehicleHal hal(propertyCount, &store);
+    VehicleHalManager manager(&hal);
+
+    std::vector<SubscribeOptions> options;
+    for (size_t i = 0; i < propertyCount; i++) {
+        options.push_back({.propId = FakeVehicleHal::getProperty(i),
+                           .flags = SubscribeFlags::EVENTS_FROM_CAR});
+    }
+    std::vector<sp<IVehicleCallback>> subscribers;
+    for (size_t i = 0; i < subscriberCount; i++) {
+        sp<IVehicleCallback> callback = new LatencyCallback(&histogram, &received);
+        StatusCode status = manager.subscribe(callback, options);
+        if (status != StatusCode::OK) {
+            state.SkipWithError("failed to subscribe");
+            return;
+        }
+        subscribers.push_back(callback);
+    }
+
+    // Producer p publishes the properties whose index modulo producerCount is
+    // p, one value of each per round.
+    const nanoseconds period(rateHz > 0 ? 1000000000 / rateHz : 0);
+    std::atomic<uint64_t> published(0);
+    auto publishRound = [&](size_t producer, int32_t round) {
+        uint64_t count = 0;
+        for (size_t i = producer; i < propertyCount; i += producerCount) {
+            hal.publish(i, round);
+            count++;
+        }
+        published.fetch_add(count, std::memory_order_relaxed);
+    };
+
+    std::atomic<bool> started(false);
+    std::atomic<bool> running(true);
+    steady_clock::time_point start;
+    std::vector<std::thread> producers;
+    for (size_t p = 1; p < producerCount; p++) {
+        producers.emplace_back([&, p] {
+            while (!started.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (int32_t round = 0; running.load(std::memory_order_relaxed); round++) {
+                publishRound(p, round);
+                if (period.count() > 0) {
+                    std::this_thread::sleep_until(start + period * (round + 1));
+                }
+            }
+        });
+    }
+
+    const LockWaits waitsBefore = readLockWaits(manager, &hal, store);
+    const uint64_t allocationsBefore = gAllocationCount.load(std::memory_order_relaxed);
+    start = steady_clock::now();
+    started.store(true, std::memory_order_release);
+
+    int32_t round = 0;
+    for (auto _ : state) {
+        publishRound(0, round++);
+        if (period.count() > 0) {
+            std::this_thread::sleep_until(start + period * round);
+        }
+    }
+
+    running.store(false, std::memory_order_relaxed);
+    for (auto& producer : producers) {
+        producer.join();
+    }
+    const uint64_t events = published.load();
+    const uint64_t expected = events * subscriberCount;
+    const auto deadline = steady_clock::now() + kDeliveryTimeout;
+    while (received.load(std::memory_order_acquire) < expected && steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    const double seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+    const uint64_t allocations = gAllocationCount.load(std::memory_order_relaxed) -
+                                 allocationsBefore;
+    const LockWaits waitsAfter = readLockWaits(manager, &hal, store);
+
+    if (received.load(std::memory_order_acquire) < expected) {
+        state.SkipWithError("timed out waiting for events to be delivered");
+        return;
+    }
+    if (events == 0) return;
+
+    using ::benchmark::Counter;
+    state.counters["events_per_s"] = Counter(events / seconds);
+    state.counters["deliveries_per_s"] = Counter(expected / seconds);
+    state.counters["latency_p50_ns"] = Counter(histogram.percentile(50));
+    state.counters["latency_p99_ns"] = Counter(histogram.percentile(99));
+    state.counters["allocs_per_event"] = Counter(double(allocations) / events);
+    // Average time an event spent waiting for each component's locks.
+    reportLockWait(state, "queue_wait_ns", waitsBefore.queue, waitsAfter.queue, events);
+    reportLockWait(state, "subscriptions_wait_ns", waitsBefore.subscriptions,
+                   waitsAfter.subscriptions, events);
+    reportLockWait(state, "pool_wait_ns", waitsBefore.pool, waitsAfter.pool, events);
+    reportLockWait(state, "store_wait_ns", waitsBefore.store, waitsAfter.store, events);
+}
+
+void DeliveryArguments(::benchmark::internal::Benchmark* b) {
+    b->ArgNames({"subscribers", "properties", "rate_hz", "producers"});
+    for (int subscribers : {1, 8}) {
+        for (int properties : {4, 64}) {
+            for (int rateHz : {0, 100}) {
+                for (int producers : {1, 4}) {
+                    b->Args({subscribers, properties, rateHz, producers});
+                }
+            }
+        }
+    }
+    b->UseRealTime();
+}
+
+BENCHMARK(BM_HalEventDelivery)->Apply(DeliveryArguments);
+
+}  // namespace
+}  // namespace benchmark
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
+
+BENCHMARK_MAIN();
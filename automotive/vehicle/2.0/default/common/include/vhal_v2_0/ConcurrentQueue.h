@@ -17,71 +17,349 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_ConcurrentQueue_H_
 #define android_hardware_automotive_vehicle_V2_0_ConcurrentQueue_H_
 
-#include <queue>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <climits>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <thread>
-#include <condition_variable>
-#include <iostream>
+#include <type_traits>
+#include <vector>
+
+#include "TimedMutex.h"
 
 namespace android {
 
+/* Multi-producer, single-consumer queue.
+ *
+ * Items are pushed into a bounded lock-free ring, in which each cell carries a sequence number
+ * telling whether it is free for the producer of a given round or holds an item for the consumer.
+ * The consumer sleeps on a futex and producers only make the wake up syscall if it's waiting for
+ * the number of items they just reached.
+ *
+ * When the ring is full, items go to an overflow list under a mutex until the consumer drains it,
+ * so that nothing is dropped and the items of each producer stay in order.
+ */
 template<typename T>
 class ConcurrentQueue {
 public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t kDefaultCapacity = 1024;
+
     void waitForItems() {
-        std::unique_lock<std::mutex> g(mLock);
-        while (mQueue.empty() && mIsActive) {
-            mCond.wait(g);
-        }
+        waitUntil(1, nullptr);
+    }
+
+    /* Waits until at least minItems are queued or the oldest queued item has been waiting for
+     * maxDelay. Returns right away if the queue is empty or inactive.
+     */
+    void waitForBatch(size_t minItems, std::chrono::nanoseconds maxDelay) {
+        Clock::time_point oldestPushTime;
+        if (!peekOldestPushTime(&oldestPushTime)) return;
+        Clock::time_point deadline = oldestPushTime + maxDelay;
+        waitUntil(minItems, &deadline);
     }
 
-    std::vector<T> flush() {
+    /* Takes all queued items. If oldestPushTime isn't null, it receives the time the oldest of
+     * them was pushed.
+     */
+    std::vector<T> flush(Clock::time_point* oldestPushTime = nullptr) {
         std::vector<T> items;
+        flushInto(&items, oldestPushTime);
+        return items;
+    }
 
-        MuxGuard g(mLock);
-        if (mQueue.empty() || !mIsActive) {
-            return items;
+    /* Same as flush(), but replaces the content of items, so that its storage is reused. */
+    void flushInto(std::vector<T>* items, Clock::time_point* oldestPushTime = nullptr) {
+        items->clear();
+        if (!mIsActive.load(std::memory_order_acquire)) {
+            return;
         }
-        while (!mQueue.empty()) {
-            items.push_back(std::move(mQueue.front()));
-            mQueue.pop();
+
+        // Items are taken in push order, so the first one is the oldest.
+        bool first = true;
+        // Bounded, so that busy producers can't keep the consumer here.
+        for (size_t i = 0; i < mCapacity; i++) {
+            size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+            Cell& cell = mCells[pos & mMask];
+            if (cell.sequence.load(std::memory_order_acquire) != pos + 1) break;
+
+            T* item = cell.item();
+            if (first && oldestPushTime != nullptr) {
+                *oldestPushTime = getPushTime(cell);
+            }
+            first = false;
+            items->push_back(std::move(*item));
+            item->~T();
+            cell.sequence.store(pos + mCapacity, std::memory_order_release);
+            mDequeuePos.store(pos + 1, std::memory_order_relaxed);
         }
-        return items;
-    }
 
-    void push(T&& item) {
-        {
-            MuxGuard g(mLock);
-            if (!mIsActive) {
+        if (mOverflowing.load(std::memory_order_acquire)) {
+            MuxGuard g(mOverflowLock);
+            // A producer only overflows after its earlier items were written to the ring, but they
+            // may still be held up behind a cell that another producer is writing. Overflowed
+            // items then wait for the next flush, so that each producer's items stay in order.
+            if (mEnqueuePos.load(std::memory_order_relaxed) !=
+                mDequeuePos.load(std::memory_order_relaxed)) {
                 return;
             }
-            mQueue.push(std::move(item));
+            if (first && oldestPushTime != nullptr && !mOverflow.empty()) {
+                *oldestPushTime = mOverflow.front().second;
+            }
+            for (auto& entry : mOverflow) {
+                items->push_back(std::move(entry.first));
+            }
+            mOverflow.clear();
+            mOverflowing.store(false, std::memory_order_release);
         }
-        mCond.notify_one();
+    }
+
+    void push(T&& item) {
+        if (!mIsActive.load(std::memory_order_acquire)) {
+            return;
+        }
+        // Once items overflowed, later ones must follow them until the consumer catches up.
+        if (mOverflowing.load(std::memory_order_acquire) || !tryPush(&item)) {
+            MuxGuard g(mOverflowLock);
+            mOverflow.emplace_back(std::move(item), Clock::now());
+            mOverflowing.store(true, std::memory_order_release);
+            mOverflowCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        wakeConsumerIfNeeded();
     }
 
     /* Deactivates the queue, thus no one can push items to it, also
      * notifies all waiting thread.
      */
     void deactivate() {
-        {
-            MuxGuard g(mLock);
-            mIsActive = false;
+        mIsActive.store(false, std::memory_order_release);
+        mWakeEpoch.fetch_add(1, std::memory_order_release);
+        futex(FUTEX_WAKE_PRIVATE, INT_MAX, nullptr);  // To unblock all waiting consumers.
+    }
+
+    /* Number of items that didn't fit in the ring. */
+    uint64_t getOverflowCount() const {
+        return mOverflowCount.load(std::memory_order_relaxed);
+    }
+
+    /* Time the producers and the consumer waited for each other on the overflow list. */
+    LockWaitStats getLockWaitStats() const {
+        return mOverflowLock.getWaitStats();
+    }
+
+    explicit ConcurrentQueue(size_t capacity = kDefaultCapacity)
+        : mCapacity(roundUpToPowerOfTwo(capacity)),
+          mMask(mCapacity - 1),
+          mCells(new Cell[mCapacity]) {
+        for (size_t i = 0; i < mCapacity; i++) {
+            mCells[i].sequence.store(i, std::memory_order_relaxed);
         }
-        mCond.notify_all();  // To unblock all waiting consumers.
     }
 
-    ConcurrentQueue() = default;
+    ~ConcurrentQueue() {
+        for (size_t pos = mDequeuePos.load(); pos != mEnqueuePos.load(); pos++) {
+            Cell& cell = mCells[pos & mMask];
+            if (cell.sequence.load() == pos + 1) {
+                cell.item()->~T();
+            }
+        }
+    }
 
     ConcurrentQueue(const ConcurrentQueue &) = delete;
     ConcurrentQueue &operator=(const ConcurrentQueue &) = delete;
 private:
-    using MuxGuard = std::lock_guard<std::mutex>;
+    using MuxGuard = std::lock_guard<TimedMutex>;
+
+    struct Cell {
+        std::atomic<size_t> sequence;
+        // Reading the clock on every push would cost more than the push itself, so only the item
+        // pushed to an empty queue, which is the oldest of the next batch, gets a push time.
+        Clock::time_point pushTime;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
 
-    bool mIsActive = true;
-    mutable std::mutex mLock;
-    std::condition_variable mCond;
-    std::queue<T> mQueue;
+        T* item() { return reinterpret_cast<T*>(&storage); }
+    };
+
+    static size_t roundUpToPowerOfTwo(size_t value) {
+        size_t result = 2;
+        while (result < value) {
+            result <<= 1;
+        }
+        return result;
+    }
+
+    bool tryPush(T* item) {
+        size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &mCells[pos & mMask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;  // The consumer hasn't taken the item of the previous round yet.
+            } else {
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        new (&cell->storage) T(std::move(*item));
+        bool wasEmpty = mDequeuePos.load(std::memory_order_relaxed) == pos;
+        cell->pushTime = wasEmpty ? Clock::now() : Clock::time_point();
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /* Push time of the cell, if it has one. Otherwise the item was pushed behind others that have
+     * been taken since, and now is the closest known bound.
+     */
+    static Clock::time_point getPushTime(const Cell& cell) {
+        return cell.pushTime != Clock::time_point() ? cell.pushTime : Clock::now();
+    }
+
+    bool peekOldestPushTime(Clock::time_point* pushTime) {
+        size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        Cell& cell = mCells[pos & mMask];
+        if (cell.sequence.load(std::memory_order_acquire) == pos + 1) {
+            *pushTime = getPushTime(cell);
+            return true;
+        }
+        if (mOverflowing.load(std::memory_order_acquire)) {
+            MuxGuard g(mOverflowLock);
+            if (!mOverflow.empty()) {
+                *pushTime = mOverflow.front().second;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* Whether at least minItems are queued. Items being pushed count as well, except when the
+     * consumer waits for the first one, which must be readable. A queue that overflowed is full,
+     * unless the ring is held up by an item being pushed, as the overflowed items can only be
+     * taken after it. Its producer wakes the consumer once it's written.
+     */
+    bool hasItems(size_t minItems) {
+        size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        bool headReadable =
+                mCells[pos & mMask].sequence.load(std::memory_order_acquire) == pos + 1;
+        if (mOverflowing.load(std::memory_order_acquire)) {
+            return headReadable || mEnqueuePos.load(std::memory_order_relaxed) == pos;
+        }
+        if (minItems <= 1) {
+            return headReadable;
+        }
+        size_t enqueuePos = mEnqueuePos.load(std::memory_order_relaxed);
+        return enqueuePos > pos && enqueuePos - pos >= minItems;
+    }
+
+    void waitUntil(size_t minItems, const Clock::time_point* deadline) {
+        while (mIsActive.load(std::memory_order_acquire)) {
+            int32_t epoch = mWakeEpoch.load(std::memory_order_acquire);
+            if (hasItems(minItems)) return;
+
+            mWaitThreshold.store(minItems, std::memory_order_relaxed);
+            // Pairs with the fence in wakeConsumerIfNeeded(): either the producer sees the
+            // threshold or we see its item.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (hasItems(minItems) || !mIsActive.load(std::memory_order_acquire)) break;
+
+            struct timespec timeout;
+            if (deadline != nullptr) {
+                auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        *deadline - Clock::now()).count();
+                if (remaining <= 0) break;
+                timeout.tv_sec = remaining / 1000000000;
+                timeout.tv_nsec = remaining % 1000000000;
+            }
+            futex(FUTEX_WAIT_PRIVATE, epoch, deadline != nullptr ? &timeout : nullptr);
+        }
+        mWaitThreshold.store(0, std::memory_order_relaxed);
+    }
+
+    void wakeConsumerIfNeeded() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        size_t threshold = mWaitThreshold.load(std::memory_order_relaxed);
+        if (threshold == 0 || !hasItems(threshold)) return;
+        // Only one producer makes the syscall.
+        if (mWaitThreshold.compare_exchange_strong(threshold, 0, std::memory_order_relaxed)) {
+            mWakeEpoch.fetch_add(1, std::memory_order_release);
+            futex(FUTEX_WAKE_PRIVATE, 1, nullptr);
+        }
+    }
+
+    long futex(int op, int32_t value, const struct timespec* timeout) {
+        static_assert(sizeof(mWakeEpoch) == sizeof(int32_t), "futex word must be 32 bits");
+        return syscall(__NR_futex, reinterpret_cast<int32_t*>(&mWakeEpoch), op, value, timeout,
+                       nullptr, 0);
+    }
+
+    const size_t mCapacity;
+    const size_t mMask;
+    const std::unique_ptr<Cell[]> mCells;
+
+    // Producers contend on mEnqueuePos, which gets a cache line of its own. mDequeuePos, only
+    // written by the consumer, shares the next line with the wait state, which producers only
+    // write when they wake the consumer.
+    alignas(64) std::atomic<size_t> mEnqueuePos { 0 };
+    alignas(64) std::atomic<size_t> mDequeuePos { 0 };
+    std::atomic<size_t> mWaitThreshold { 0 };  // Items the consumer waits for, 0 if not waiting.
+    std::atomic<int32_t> mWakeEpoch { 0 };     // Futex word.
+    std::atomic<bool> mIsActive { true };
+
+    std::atomic<bool> mOverflowing { false };
+    std::atomic<uint64_t> mOverflowCount { 0 };
+    TimedMutex mOverflowLock;
+    std::deque<std::pair<T, Clock::time_point>> mOverflow;  // Guarded by mOverflowLock.
+};
+
+/* Statistics of the batches delivered by BatchingConsumer. They are only updated by the consumer
+ * thread, but can be read from any thread.
+ */
+struct BatchingStats {
+    static constexpr size_t kBucketCount = 16;
+    using Histogram = std::array<std::atomic<uint64_t>, kBucketCount>;
+
+    /* Bucket 0 counts zeros, bucket i counts values in [2^(i-1), 2^i) and the last bucket also
+     * counts all larger values.
+     */
+    static size_t getBucket(uint64_t value) {
+        size_t bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+        return bucket < kBucketCount ? bucket : kBucketCount - 1;
+    }
+
+    void record(std::chrono::nanoseconds latency, size_t size, bool immediate) {
+        auto latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+        latencyUsHistogram[getBucket(latencyUs > 0 ? latencyUs : 0)]++;
+        batchSizeHistogram[getBucket(size)]++;
+        batches++;
+        items += size;
+        if (immediate) {
+            immediateBatches++;
+        }
+    }
+
+    // Time from the push of the oldest item of a batch to the delivery of the batch.
+    Histogram latencyUsHistogram {};
+    Histogram batchSizeHistogram {};
+    std::atomic<uint64_t> batches { 0 };
+    std::atomic<uint64_t> items { 0 };
+    // Batches delivered without waiting for more items because the queue was cold.
+    std::atomic<uint64_t> immediateBatches { 0 };
 };
 
 template<typename T>
@@ -102,11 +380,19 @@ public:
 
     using OnBatchReceivedFunc = std::function<void(const std::vector<T>& vec)>;
 
+    /* Delivers the items pushed to the queue in batches.
+     *
+     * An item that arrives after the queue was idle for batchInterval is delivered right away.
+     * Items that keep coming within batchInterval of the previous batch are batched until
+     * maxBatchSize of them are queued or the oldest one has waited for batchInterval.
+     */
     void run(ConcurrentQueue<T>* queue,
              std::chrono::nanoseconds batchInterval,
-             const OnBatchReceivedFunc& func) {
+             const OnBatchReceivedFunc& func,
+             size_t maxBatchSize = std::numeric_limits<size_t>::max()) {
         mQueue = queue;
         mBatchInterval = batchInterval;
+        mMaxBatchSize = maxBatchSize;
 
         mWorkerThread = std::thread(
             &BatchingConsumer<T>::runInternal, this, func);
@@ -122,20 +408,36 @@ public:
         }
     }
 
+    const BatchingStats& getStats() const {
+        return mStats;
+    }
+
 private:
+    using Clock = std::chrono::steady_clock;
+
     void runInternal(const OnBatchReceivedFunc& onBatchReceived) {
         if (mState.exchange(State::RUNNING) == State::INIT) {
+            Clock::time_point lastBatchTime;
+            std::vector<T> items;
             while (State::RUNNING == mState) {
                 mQueue->waitForItems();
                 if (State::STOP_REQUESTED == mState) break;
 
-                std::this_thread::sleep_for(mBatchInterval);
-                if (State::STOP_REQUESTED == mState) break;
+                bool cold = Clock::now() - lastBatchTime >= mBatchInterval;
+                if (!cold) {
+                    mQueue->waitForBatch(mMaxBatchSize, mBatchInterval);
+                    if (State::STOP_REQUESTED == mState) break;
+                }
 
-                std::vector<T> items = mQueue->flush();
+                Clock::time_point oldestPushTime;
+                mQueue->flushInto(&items, &oldestPushTime);
 
                 if (items.size() > 0) {
+                    lastBatchTime = Clock::now();
+                    mStats.record(lastBatchTime - oldestPushTime, items.size(), cold);
                     onBatchReceived(items);
+                    // Release the items now, but keep the storage for the next batch.
+                    items.clear();
                 }
             }
         }
@@ -148,7 +450,9 @@ private:
 
     std::atomic<State> mState;
     std::chrono::nanoseconds mBatchInterval;
+    size_t mMaxBatchSize;
     ConcurrentQueue<T>* mQueue;
+    BatchingStats mStats;
 };
 
 }  // namespace android
@@ -17,13 +17,14 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_RecurrentTimer_H_
 #define android_hardware_automotive_vehicle_V2_0_RecurrentTimer_H_
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <functional>
-#include <list>
 #include <mutex>
-#include <set>
+#include <queue>
 #include <thread>
 #include <unordered_map>
 #include <vector>
@@ -31,6 +32,12 @@
 /**
  * This class allows to specify multiple time intervals to receive
  * notifications. A single thread is used internally.
+ *
+ * Event times are aligned to multiples of their interval, so all events sharing an interval are
+ * due at the same time. They are kept in one group per interval and the thread only looks at the
+ * group due next, from a min-heap that has an entry per distinct interval. Registering and
+ * unregistering are O(1) amortized, and a wake-up costs the number of due events plus a heap
+ * operation per due interval, however many events are registered.
  */
 class RecurrentTimer {
 private:
@@ -40,6 +47,38 @@ private:
 public:
     using Action = std::function<void(const std::vector<int32_t>& cookies)>;
 
+    /* How late the timer thread fires events, in power of two buckets. */
+    struct Stats {
+        static constexpr size_t kBucketCount = 16;
+
+        /* Bucket 0 counts zeros, bucket i counts values in [2^(i-1), 2^i) and the last bucket
+         * also counts all larger values.
+         */
+        static size_t getBucket(uint64_t value) {
+            size_t bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+            return bucket < kBucketCount ? bucket : kBucketCount - 1;
+        }
+
+        void record(Nanos drift, int64_t skippedTicks) {
+            auto driftUs = std::chrono::duration_cast<std::chrono::microseconds>(drift).count();
+            uint64_t us = driftUs > 0 ? driftUs : 0;
+            driftUsHistogram[getBucket(us)]++;
+            ticks++;
+            skipped += skippedTicks;
+            if (us > maxDriftUs.load(std::memory_order_relaxed)) {
+                maxDriftUs.store(us, std::memory_order_relaxed);
+            }
+        }
+
+        // Delay between the time an interval was due and the time its events were fired.
+        std::array<std::atomic<uint64_t>, kBucketCount> driftUsHistogram {};
+        std::atomic<uint64_t> maxDriftUs { 0 };
+        // Firings of an interval, each delivering all events registered with it.
+        std::atomic<uint64_t> ticks { 0 };
+        // Ticks not fired because the thread was late by more than an interval.
+        std::atomic<uint64_t> skipped { 0 };
+    };
+
     RecurrentTimer(const Action& action) : mAction(action) {
         mTimerThread = std::thread(&RecurrentTimer::loop, this, action);
     }
@@ -51,17 +90,28 @@ public:
     /**
      * Registers recurrent event for a given interval. Registred events are distinguished by
      * cookies thus calling this method multiple times with the same cookie will override the
-     * interval provided before.
+     * interval provided before. The event is fired once right away.
      */
     void registerRecurrentEvent(std::chrono::nanoseconds interval, int32_t cookie) {
-        TimePoint now = Clock::now();
-        // Align event time point among all intervals. Thus if we have two intervals 1ms and 2ms,
-        // during every second wake-up both intervals will be triggered.
-        TimePoint absoluteTime = now - Nanos(now.time_since_epoch().count() % interval.count());
-
         {
             std::lock_guard<std::mutex> g(mLock);
-            mCookieToEventsMap[cookie] = { interval, cookie, absoluteTime };
+            removeCookieLocked(cookie);
+
+            auto it = mGroups.find(interval.count());
+            if (it == mGroups.end()) {
+                TimePoint now = Clock::now();
+                // Align event time point among all intervals. Thus if we have two intervals 1ms
+                // and 2ms, during every second wake-up both intervals will be triggered.
+                TimePoint absoluteTime = now - Nanos(now.time_since_epoch().count()
+                                                     % interval.count());
+                it = mGroups.emplace(interval.count(), IntervalGroup { absoluteTime, {} }).first;
+                mQueue.push({ absoluteTime, interval });
+            } else if (it->second.absoluteTime > Clock::now()) {
+                // The group was already fired for the current interval.
+                mFireNow.push_back(cookie);
+            }
+            mCookies[cookie] = { interval, it->second.cookies.size() };
+            it->second.cookies.push_back(cookie);
         }
         mCond.notify_one();
     }
@@ -69,68 +119,111 @@ public:
     void unregisterRecurrentEvent(int32_t cookie) {
         {
             std::lock_guard<std::mutex> g(mLock);
-            mCookieToEventsMap.erase(cookie);
+            removeCookieLocked(cookie);
         }
         mCond.notify_one();
     }
 
+    const Stats& getStats() const {
+        return mStats;
+    }
 
 private:
+    /* Events of an interval, all due at the same time. */
+    struct IntervalGroup {
+        TimePoint absoluteTime;  // Absolute time of the next event.
+        std::vector<int32_t> cookies;
+    };
 
-    struct RecurrentEvent {
+    struct CookieLocation {
         Nanos interval;
-        int32_t cookie;
-        TimePoint absoluteTime;  // Absolute time of the next event.
+        size_t index;  // Into IntervalGroup::cookies.
+    };
 
-        void updateNextEventTime(TimePoint now) {
-            // We want to move time to next event by adding some number of intervals (usually 1)
-            // to previous absoluteTime.
-            int intervalMultiplier = (now - absoluteTime) / interval;
-            if (intervalMultiplier <= 0) intervalMultiplier = 1;
-            absoluteTime += intervalMultiplier * interval;
+    /* Heap entry, stale if its group was removed or has moved on to a later time since. */
+    struct QueueEntry {
+        TimePoint absoluteTime;
+        Nanos interval;
+
+        bool operator>(const QueueEntry& other) const {
+            return absoluteTime > other.absoluteTime;
         }
     };
 
-    void loop(const Action& action) {
-        static constexpr auto kInvalidTime = TimePoint(Nanos::max());
+    void removeCookieLocked(int32_t cookie) {
+        auto it = mCookies.find(cookie);
+        if (it == mCookies.end()) return;
+
+        auto groupIt = mGroups.find(it->second.interval.count());
+        std::vector<int32_t>& cookies = groupIt->second.cookies;
+        cookies[it->second.index] = cookies.back();
+        mCookies[cookies.back()].index = it->second.index;
+        cookies.pop_back();
+        if (cookies.empty()) {
+            mGroups.erase(groupIt);  // Its queue entry is dropped once it gets to the top.
+        }
+        mCookies.erase(it);
+        mFireNow.erase(std::remove(mFireNow.begin(), mFireNow.end(), cookie), mFireNow.end());
+    }
+
+    /* Collects cookies of due groups into outCookies and returns the time of the next event. */
+    TimePoint fireDueGroupsLocked(TimePoint now, std::vector<int32_t>* outCookies) {
+        outCookies->insert(outCookies->end(), mFireNow.begin(), mFireNow.end());
+        mFireNow.clear();
+
+        while (!mQueue.empty()) {
+            QueueEntry entry = mQueue.top();
+            auto it = mGroups.find(entry.interval.count());
+            if (it == mGroups.end() || it->second.absoluteTime != entry.absoluteTime) {
+                mQueue.pop();
+                continue;
+            }
+            if (entry.absoluteTime > now) {
+                return entry.absoluteTime;
+            }
+            mQueue.pop();
+
+            IntervalGroup& group = it->second;
+            outCookies->insert(outCookies->end(), group.cookies.begin(), group.cookies.end());
+            // We want to move time to next event by adding some number of intervals (usually 1)
+            // to previous absoluteTime, skipping ticks already missed.
+            int64_t missedTicks = (now - group.absoluteTime) / entry.interval;
+            mStats.record(now - group.absoluteTime, missedTicks);
+            group.absoluteTime += (missedTicks + 1) * entry.interval;
+            mQueue.push({ group.absoluteTime, entry.interval });
+        }
+        return TimePoint(Nanos::max());
+    }
 
+    void loop(const Action& action) {
         std::vector<int32_t> cookies;
 
+        std::unique_lock<std::mutex> g(mLock);
         while (!mStopRequested) {
-            auto now = Clock::now();
-            auto nextEventTime = kInvalidTime;
             cookies.clear();
-
-            {
-                std::unique_lock<std::mutex> g(mLock);
-
-                for (auto&& it : mCookieToEventsMap) {
-                    RecurrentEvent& event = it.second;
-                    if (event.absoluteTime <= now) {
-                        event.updateNextEventTime(now);
-                        cookies.push_back(event.cookie);
-                    }
-
-                    if (nextEventTime > event.absoluteTime) {
-                        nextEventTime = event.absoluteTime;
-                    }
-                }
-            }
+            TimePoint nextEventTime = fireDueGroupsLocked(Clock::now(), &cookies);
 
             if (cookies.size() != 0) {
+                g.unlock();
                 action(cookies);
+                g.lock();
+                // Events may have been registered while the action ran.
+                continue;
             }
 
-            std::unique_lock<std::mutex> g(mLock);
-            mCond.wait_until(g, nextEventTime);  // nextEventTime can be nanoseconds::max()
+            if (!mStopRequested) {
+                mCond.wait_until(g, nextEventTime);  // nextEventTime can be nanoseconds::max()
+            }
         }
     }
 
     void stop() {
-        mStopRequested = true;
         {
             std::lock_guard<std::mutex> g(mLock);
-            mCookieToEventsMap.clear();
+            mStopRequested = true;
+            mCookies.clear();
+            mGroups.clear();
+            mFireNow.clear();
         }
         mCond.notify_one();
         if (mTimerThread.joinable()) {
@@ -143,7 +236,11 @@ private:
     std::condition_variable mCond;
     std::atomic_bool mStopRequested { false };
     Action mAction;
-    std::unordered_map<int32_t, RecurrentEvent> mCookieToEventsMap;
+    std::unordered_map<int32_t, CookieLocation> mCookies;
+    std::unordered_map<Nanos::rep, IntervalGroup> mGroups;  // By interval.
+    std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry>> mQueue;
+    std::vector<int32_t> mFireNow;  // Registered into a group that was already fired.
+    Stats mStats;
 };
 
 
@@ -17,18 +17,23 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_SubscriptionManager_H_
 #define android_hardware_automotive_vehicle_V2_0_SubscriptionManager_H_
 
+#include <atomic>
 #include <memory>
 #include <map>
 #include <set>
 #include <list>
+#include <unordered_map>
+#include <vector>
 
 #include <android/log.h>
 #include <hidl/HidlSupport.h>
 #include <utils/SortedVector.h>
+#include <utils/SystemClock.h>
 
 #include <android/hardware/automotive/vehicle/2.0/IVehicle.h>
 
 #include "ConcurrentQueue.h"
+#include "TimedMutex.h"
 #include "VehicleObjectPool.h"
 
 namespace android {
@@ -50,6 +55,7 @@ public:
 
     void addOrUpdateSubscription(const SubscribeOptions &opts);
     bool isSubscribed(int32_t propId, SubscribeFlags flags);
+    bool getSubscription(int32_t propId, SubscribeOptions* outOpts) const;
     std::vector<int32_t> getSubscribedProperties() const;
 
 private:
@@ -75,7 +81,7 @@ public:
 
 struct HalClientValues {
     sp<HalClient> client;
-    std::list<VehiclePropValue *> values;
+    std::vector<VehiclePropValue *> values;
 };
 
 using ClientId = uint64_t;
@@ -107,12 +113,33 @@ public:
                                        std::list<SubscribeOptions>* outUpdatedOptions);
 
     /**
-     * Returns a list of IVehicleCallback -> list of VehiclePropValue ready for
-     * dispatching to its clients.
+     * Groups values by the clients subscribed to them, ready for dispatching.
+     *
+     * outClientValues is meant to be kept by the caller and passed again for the next batch, so
+     * that its vectors are reused. It gets one entry per client that has subscriptions, entries of
+     * clients that get no values from this batch are left empty. Doesn't take any lock.
+     *
+     * Clients that subscribed to a continuous property at a lower rate than the HAL produces it
+     * get values at their own rate: a value arriving before the client is due for the next one
+     * is dropped for that client, and of several values of the same property and area in a batch
+     * only the latest is delivered. nowNanos is the elapsedRealtimeNano() arrival time of the
+     * batch. Must not be called from several threads at once.
      */
-    std::list<HalClientValues> distributeValuesToClients(
+    void distributeValuesToClients(
             const std::vector<recyclable_ptr<VehiclePropValue>>& propValues,
-            SubscribeFlags flags) const;
+            SubscribeFlags flags,
+            std::vector<HalClientValues>* outClientValues,
+            int64_t nowNanos = elapsedRealtimeNano()) const;
+
+    /** Returns the number of values not delivered to a client due to its sample rate. */
+    uint64_t getRateLimitedCount() const {
+        return mRateLimitedCount.load(std::memory_order_relaxed);
+    }
+
+    /** Returns the time threads waited for each other to change subscriptions. */
+    LockWaitStats getLockWaitStats() const {
+        return mLock.getWaitStats();
+    }
 
     std::list<sp<HalClient>> getSubscribedClients(int32_t propId, SubscribeFlags flags) const;
     /**
@@ -121,8 +148,45 @@ public:
      */
     void unsubscribe(ClientId clientId, int32_t propId);
 private:
-    std::list<sp<HalClient>> getSubscribedClientsLocked(int32_t propId,
-                                                        SubscribeFlags flags) const;
+    /**
+     * Subscriptions as seen by the event path: for each property, the clients subscribed to it
+     * with their flags. Clients are stored once, so that distribution can group values by client
+     * index. A table is never modified, it's rebuilt under mLock whenever subscriptions change
+     * and published with std::atomic_store, so readers don't take mLock.
+     */
+    struct RoutingTable {
+        /**
+         * Delivery schedule of a client subscribed at a lower rate than the HAL produces the
+         * property. Only used by distributeValuesToClients() and carried over when the table is
+         * rebuilt, so that subscribe calls don't reset it.
+         */
+        struct RateLimiter {
+            struct AreaState {
+                int64_t nextDueNanos = 0;
+                // Batch and client value index of the last delivered value, so that later values
+                // of the same batch replace it.
+                uint64_t batch = 0;
+                size_t valueIndex = 0;
+            };
+
+            explicit RateLimiter(int64_t period) : periodNanos(period) {}
+
+            const int64_t periodNanos;
+            std::unordered_map<int32_t, AreaState> areas;
+        };
+
+        struct Route {
+            size_t clientIndex;  // Into clients.
+            SubscribeFlags flags;
+            std::shared_ptr<RateLimiter> rateLimiter;  // Null if the client gets every value.
+        };
+
+        uint64_t version = 0;
+        std::vector<sp<HalClient>> clients;
+        std::unordered_map<int32_t, std::vector<Route>> routes;
+    };
+
+    void rebuildRoutingTableLocked();
 
     bool updateHalEventSubscriptionLocked(const SubscribeOptions& opts, SubscribeOptions* out);
 
@@ -156,14 +220,20 @@ private:
     };
 
 private:
-    using MuxGuard = std::lock_guard<std::mutex>;
+    using MuxGuard = std::lock_guard<TimedMutex>;
 
-    mutable std::mutex mLock;
+    mutable TimedMutex mLock;
 
     std::map<ClientId, sp<HalClient>> mClients;
     std::map<int32_t, sp<HalClientVector>> mPropToClients;
     std::map<int32_t, SubscribeOptions> mHalEventSubscribeOptions;
 
+    // Accessed with std::atomic_load and std::atomic_store.
+    std::shared_ptr<const RoutingTable> mRoutingTable = std::make_shared<RoutingTable>();
+    // Counts calls to distributeValuesToClients() for RateLimiter::AreaState::batch.
+    mutable uint64_t mDistributedBatches = 0;
+    mutable std::atomic<uint64_t> mRateLimitedCount { 0 };
+
     OnPropertyUnsubscribed mOnPropertyUnsubscribed;
     sp<DeathRecipient> mCallbackDeathRecipient;
 };
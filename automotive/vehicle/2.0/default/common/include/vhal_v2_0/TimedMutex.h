@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef android_hardware_automotive_vehicle_V2_0_TimedMutex_H_
+#define android_hardware_automotive_vehicle_V2_0_TimedMutex_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+namespace android {
+
+/* How often and how long threads had to wait for a lock. */
+struct LockWaitStats {
+    uint64_t waits = 0;
+    uint64_t waitNanos = 0;
+
+    LockWaitStats& operator+=(const LockWaitStats& other) {
+        waits += other.waits;
+        waitNanos += other.waitNanos;
+        return *this;
+    }
+};
+
+/**
+ * std::mutex that measures the time threads spend blocked on it. Taking a free lock costs a single
+ * try_lock, only a thread that has to wait reads the clock.
+ */
+class TimedMutex {
+public:
+    void lock() {
+        if (mMutex.try_lock()) return;
+        auto start = std::chrono::steady_clock::now();
+        mMutex.lock();
+        auto waited = std::chrono::steady_clock::now() - start;
+        mWaits.fetch_add(1, std::memory_order_relaxed);
+        mWaitNanos.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count(),
+                             std::memory_order_relaxed);
+    }
+
+    bool try_lock() { return mMutex.try_lock(); }
+
+    void unlock() { mMutex.unlock(); }
+
+    LockWaitStats getWaitStats() const {
+        LockWaitStats stats;
+        stats.waits = mWaits.load(std::memory_order_relaxed);
+        stats.waitNanos = mWaitNanos.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    std::mutex mMutex;
+    std::atomic<uint64_t> mWaits { 0 };
+    std::atomic<uint64_t> mWaitNanos { 0 };
+};
+
+}  // namespace android
+
+#endif  // android_hardware_automotive_vehicle_V2_0_TimedMutex_H_
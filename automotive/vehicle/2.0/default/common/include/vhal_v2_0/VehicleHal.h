@@ -70,6 +70,11 @@ public:
      */
     virtual void onCreate() {}
 
+    /**
+     * Override this method to add HAL specific statistics to the debug output.
+     */
+    virtual std::string dump() { return std::string(); }
+
     void init(
         VehiclePropValuePool* valueObjectPool,
         const HalEventFunction& onHalEvent,
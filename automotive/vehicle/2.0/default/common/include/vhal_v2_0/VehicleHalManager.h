@@ -25,6 +25,7 @@
 #include <map>
 #include <memory>
 #include <set>
+#include <string>
 
 #include <android/hardware/automotive/vehicle/2.0/IVehicle.h>
 
@@ -73,6 +74,17 @@ public:
                                    int32_t propId)  override;
     Return<void> debugDump(debugDump_cb _hidl_cb = nullptr) override;
 
+    // Methods derived from IBase
+    Return<void> debug(const hidl_handle& fd, const hidl_vec<hidl_string>& options) override;
+
+    // Time threads waited for the locks of the event queue and of the subscriptions.
+    LockWaitStats getEventQueueLockWaitStats() const {
+        return mEventQueue.getLockWaitStats();
+    }
+    LockWaitStats getSubscriptionLockWaitStats() const {
+        return mSubscriptionManager.getLockWaitStats();
+    }
+
 private:
     using VehiclePropValuePtr = VehicleHal::VehiclePropValuePtr;
     // Returns true if needs to call again shortly.
@@ -102,12 +114,16 @@ private:
     static float checkSampleRate(const VehiclePropConfig& config,
                                  float sampleRate);
     static ClientId getClientId(const sp<IVehicleCallback>& callback);
+
+    std::string dumpEventBatchingStats() const;
 private:
     VehicleHal* mHal;
     std::unique_ptr<VehiclePropConfigIndex> mConfigIndex;
     SubscriptionManager mSubscriptionManager;
 
     hidl_vec<VehiclePropValue> mHidlVecOfVehiclePropValuePool;
+    // Only used by the BatchingConsumer thread, kept to reuse its storage.
+    std::vector<HalClientValues> mBatchClientValues;
 
     ConcurrentQueue<VehiclePropValuePtr> mEventQueue;
     BatchingConsumer<VehiclePropValuePtr> mBatchingConsumer;
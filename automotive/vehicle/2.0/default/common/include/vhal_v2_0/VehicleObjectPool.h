@@ -18,12 +18,17 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_VehicleObjectPool_H_
 #define android_hardware_automotive_vehicle_V2_0_VehicleObjectPool_H_
 
-#include <deque>
-#include <map>
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <unordered_map>
+#include <vector>
 
 #include <android/hardware/automotive/vehicle/2.0/types.h>
 
+#include "TimedMutex.h"
+
 namespace android {
 namespace hardware {
 namespace automotive {
@@ -31,11 +36,68 @@ namespace vehicle {
 namespace V2_0 {
 
 // Handy metric mostly for unit tests and debug.
-#define INC_METRIC_IF_DEBUG(val) PoolStats::instance()->val++;
+#define INC_METRIC_IF_DEBUG(val) PoolStats::instance()->val.increment();
 struct PoolStats {
-    std::atomic<uint32_t> Obtained {0};
-    std::atomic<uint32_t> Created {0};
-    std::atomic<uint32_t> Recycled {0};
+    /**
+     * Counter incremented on the hot path of all threads. Each thread adds to one of kShards
+     * slots on its own cache line, so that threads don't bounce a shared line, and reads sum the
+     * slots up.
+     */
+    class Counter {
+    public:
+        void increment() {
+            mShards[getThreadShard()].value.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        uint32_t load() const {
+            uint32_t sum = 0;
+            for (const Shard& shard : mShards) {
+                sum += shard.value.load(std::memory_order_relaxed);
+            }
+            return sum;
+        }
+
+        operator uint32_t() const { return load(); }
+
+        /* Not atomic with respect to concurrent increments. */
+        Counter& operator=(uint32_t value) {
+            for (Shard& shard : mShards) {
+                shard.value.store(0, std::memory_order_relaxed);
+            }
+            mShards[0].value.store(value, std::memory_order_relaxed);
+            return *this;
+        }
+
+    private:
+        static constexpr size_t kShards = 16;
+
+        struct alignas(64) Shard {
+            std::atomic<uint32_t> value {0};
+        };
+
+        static size_t getThreadShard() {
+            static std::atomic<size_t> nextShard {0};
+            thread_local size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % kShards;
+            return shard;
+        }
+
+        Shard mShards[kShards];
+    };
+
+    Counter Obtained;
+    Counter Created;
+    Counter Recycled;
+    // Obtained objects taken from the calling thread's cache, or from the shared pool.
+    Counter ThreadCacheHits;
+    Counter SharedPoolHits;
+    // Values handed out without pooling: strings, mixed and oversized vectors.
+    Counter NotPooled;
+
+    // Share of obtained objects that were reused rather than created.
+    float hitRate() const {
+        uint32_t obtained = Obtained;
+        return obtained == 0 ? 0 : float(ThreadCacheHits + SharedPoolHits) / obtained;
+    }
 
     static PoolStats* instance() {
         static PoolStats inst;
@@ -74,25 +136,34 @@ using recyclable_ptr = typename std::unique_ptr<T, Deleter<T>>;
  * multiple threads is OK, also client can obtain an object in one thread and
  * then move ownership to another thread.
  *
+ * Each thread keeps a magazine of up to magazineSize objects of the pool, from
+ * which it obtains and to which it recycles without locking. Only refilling an
+ * empty magazine from the shared pool, or handing half of a full one back to
+ * it, takes the lock. This way a thread that obtains objects recycled by
+ * another thread takes the lock once per half magazine. At most
+ * maxSharedObjects objects are kept in the shared pool, others are deleted.
+ *
+ * Objects left in the magazine of a thread are deleted when the thread exits.
  */
 template<typename T>
 class ObjectPool {
 public:
-    ObjectPool() = default;
+    static constexpr size_t kDefaultMagazineSize = 32;
+
+    explicit ObjectPool(size_t magazineSize = kDefaultMagazineSize,
+                        size_t maxSharedObjects = SIZE_MAX)
+        : mId(nextPoolId()),
+          mMagazineSize(magazineSize > 0 ? magazineSize : 1),
+          mMaxSharedObjects(maxSharedObjects) {}
     virtual ~ObjectPool() = default;
 
     virtual recyclable_ptr<T> obtain() {
-        std::lock_guard<std::mutex> g(mLock);
-        INC_METRIC_IF_DEBUG(Obtained)
-        if (mObjects.empty()) {
-            INC_METRIC_IF_DEBUG(Created)
-            return wrap(createObject());
-        }
-
-        auto o = wrap(mObjects.front().release());
-        mObjects.pop_front();
+        return wrap(obtainRaw());
+    }
 
-        return o;
+    /* Time threads waited for each other to move objects to or from the shared pool. */
+    LockWaitStats getLockWaitStats() const {
+        return mLock.getWaitStats();
     }
 
     ObjectPool& operator =(const ObjectPool &) = delete;
@@ -101,13 +172,74 @@ public:
 protected:
     virtual T* createObject() = 0;
 
+    /* Same as #obtain(), for subclasses that hand out objects with their own deleter. */
+    T* obtainRaw() {
+        INC_METRIC_IF_DEBUG(Obtained)
+        std::vector<std::unique_ptr<T>>& magazine = getThreadMagazine();
+        if (!magazine.empty()) {
+            INC_METRIC_IF_DEBUG(ThreadCacheHits)
+        } else {
+            std::lock_guard<TimedMutex> g(mLock);
+            size_t count = std::min(mObjects.size(), (mMagazineSize + 1) / 2);
+            for (size_t i = mObjects.size() - count; i < mObjects.size(); i++) {
+                magazine.push_back(std::move(mObjects[i]));
+            }
+            mObjects.resize(mObjects.size() - count);
+            if (count == 0) {
+                INC_METRIC_IF_DEBUG(Created)
+                return createObject();
+            }
+            INC_METRIC_IF_DEBUG(SharedPoolHits)
+        }
+
+        T* o = magazine.back().release();
+        magazine.pop_back();
+        return o;
+    }
+
     virtual void recycle(T* o) {
         INC_METRIC_IF_DEBUG(Recycled)
-        std::lock_guard<std::mutex> g(mLock);
-        mObjects.push_back(std::unique_ptr<T> { o } );
+        std::vector<std::unique_ptr<T>>& magazine = getThreadMagazine();
+        magazine.emplace_back(o);
+        if (magazine.size() <= mMagazineSize) {
+            return;
+        }
+
+        size_t keep = mMagazineSize / 2;
+        {
+            std::lock_guard<TimedMutex> g(mLock);
+            size_t count = std::min(magazine.size() - keep,
+                                    mMaxSharedObjects - std::min(mMaxSharedObjects,
+                                                                 mObjects.size()));
+            for (size_t i = magazine.size() - count; i < magazine.size(); i++) {
+                mObjects.push_back(std::move(magazine[i]));
+            }
+            magazine.resize(magazine.size() - count);
+        }
+        magazine.resize(keep);  // Deletes what the shared pool had no room for.
     }
 
 private:
+    static uint64_t nextPoolId() {
+        static std::atomic<uint64_t> lastId {0};
+        return ++lastId;
+    }
+
+    /* Magazines are found by pool id rather than address, as a pool may be
+     * destroyed while threads still have its objects cached and another one
+     * created at the same address. */
+    std::vector<std::unique_ptr<T>>& getThreadMagazine() {
+        thread_local std::unordered_map<uint64_t, std::vector<std::unique_ptr<T>>> magazines;
+        thread_local uint64_t lastPoolId = 0;
+        thread_local std::vector<std::unique_ptr<T>>* lastMagazine = nullptr;
+
+        if (lastPoolId != mId) {
+            lastMagazine = &magazines[mId];
+            lastPoolId = mId;
+        }
+        return *lastMagazine;
+    }
+
     const Deleter<T>& getDeleter() {
         if (!mDeleter.get()) {
             Deleter<T> *d = new Deleter<T>(std::bind(
@@ -122,8 +254,11 @@ private:
     }
 
 private:
-    mutable std::mutex mLock;
-    std::deque<std::unique_ptr<T>> mObjects;
+    const uint64_t mId;
+    const size_t mMagazineSize;
+    const size_t mMaxSharedObjects;
+    mutable TimedMutex mLock;
+    std::vector<std::unique_ptr<T>> mObjects;  // Guarded by mLock.
     std::unique_ptr<Deleter<T>> mDeleter;
 };
 
@@ -138,11 +273,19 @@ private:
  * safely pass it around. Once this object goes out of scope, it will be
  * returned the the object pool.
  *
- * Some objects are not recycable: strings and vector data types with
- * vector length > maxRecyclableVectorSize (provided in the constructor). These
- * objects will be deleted immediately once the go out of scope. There's no
- * synchornization penalty for these objects since we do not store them in the
- * pool.
+ * Values with vector length up to maxRecyclableVectorSize (provided in the
+ * constructor) are pooled by exact vector size. Longer vectors, such as OBD2
+ * frames or the bytes of VMS messages, are pooled by size class: the vector is
+ * set to external storage of the next power of two size, up to
+ * kMaxSizeClassBytes, so that a value can be reused for any length of its
+ * class. Users must not move such a vector out of the value, as its storage
+ * goes back to the pool with the value. Copies of mixed values, such as VMS
+ * messages, are pooled by size class of their bytes.
+ *
+ * Some objects are not recycable: strings, other mixed values and vectors
+ * longer than kMaxSizeClassBytes. These objects will be deleted immediately once the
+ * go out of scope. There's no synchornization penalty for these objects since
+ * we do not store them in the pool.
  *
  * This class is thread-safe. Users can obtain an object in one thread and pass
  * it to another.
@@ -174,7 +317,11 @@ public:
      *
      */
     VehiclePropValuePool(size_t maxRecyclableVectorSize = 4) :
-        mMaxRecyclableVectorSize(maxRecyclableVectorSize) {};
+        mMaxRecyclableVectorSize(maxRecyclableVectorSize),
+        mExactSizePools(kPooledTypeCount * (maxRecyclableVectorSize + 1)) {};
+    ~VehiclePropValuePool();
+
+    static constexpr size_t kMaxSizeClassBytes = 64 * 1024;
 
     RecyclableType obtain(VehiclePropertyType type);
 
@@ -187,18 +334,31 @@ public:
     RecyclableType obtainString(const char* cstr);
     RecyclableType obtainComplex();
 
+    /* Sum of the lock waits of all pools. */
+    LockWaitStats getLockWaitStats() const;
+
     VehiclePropValuePool(VehiclePropValuePool& ) = delete;
     VehiclePropValuePool& operator=(VehiclePropValuePool&) = delete;
 private:
-    bool isDisposable(VehiclePropertyType type, size_t vecSize) const {
-        return vecSize > mMaxRecyclableVectorSize || VehiclePropertyType::STRING == type ||
-               VehiclePropertyType::MIXED == type;
-    }
+    // Types other than STRING and MIXED, see getPooledTypeIndex().
+    static constexpr size_t kPooledTypeCount = 8;
+    // Size classes are indexed by log2 of their capacity.
+    static constexpr size_t kSizeClassCount = 17;
+
+    /* Returns the index of a type in the pool tables, or -1 if the type is not pooled. */
+    static int getPooledTypeIndex(VehiclePropertyType type);
 
     RecyclableType obtainDisposable(VehiclePropertyType valueType,
                                     size_t vectorSize) const;
-    RecyclableType obtainRecylable(VehiclePropertyType type,
+    RecyclableType obtainRecylable(int typeIndex, VehiclePropertyType type,
                                    size_t vecSize);
+    RecyclableType obtainSizeClassed(int typeIndex, VehiclePropertyType type,
+                                     size_t vecSize);
+    RecyclableType obtainMixed(size_t bytesSize);
+
+    static size_t getSizeClass(size_t vecSize) {
+        return vecSize <= 1 ? 0 : 64 - __builtin_clzll(vecSize - 1);
+    }
 
     class InternalPool: public ObjectPool<VehiclePropValue> {
     public:
@@ -223,6 +383,47 @@ private:
         size_t mVectorSize;
     };
 
+    /* Value whose vector is set to storage of its size class capacity. */
+    struct SizeClassedValue : public VehiclePropValue {
+        std::unique_ptr<char[]> storage;
+    };
+
+    class SizeClassPool : public ObjectPool<SizeClassedValue> {
+    public:
+        // Large values, so threads and the shared pool keep fewer of them.
+        static constexpr size_t kMagazineSize = 4;
+        static constexpr size_t kMaxSharedObjects = 16;
+
+        SizeClassPool(VehiclePropertyType type, size_t capacity, size_t elementSize);
+
+        RecyclableType obtainVector(size_t vecSize);
+    protected:
+        SizeClassedValue* createObject() override;
+        void recycle(SizeClassedValue* o) override;
+    private:
+        bool check(VehiclePropValue::RawValue* v);
+    private:
+        const VehiclePropertyType mPropType;
+        const size_t mCapacity;
+        const size_t mElementSize;
+        const Deleter<VehiclePropValue> mDeleter;
+    };
+
+    /* Returns the pool in *slot, creating it if needed. Lock-free, as pools are never removed. */
+    template <typename Pool, typename... Args>
+    static Pool* getOrCreatePool(std::atomic<Pool*>* slot, Args... args) {
+        Pool* pool = slot->load(std::memory_order_acquire);
+        if (pool == nullptr) {
+            Pool* newPool = new Pool(args...);
+            if (slot->compare_exchange_strong(pool, newPool, std::memory_order_acq_rel)) {
+                pool = newPool;
+            } else {
+                delete newPool;  // Created concurrently by another thread.
+            }
+        }
+        return pool;
+    }
+
 private:
     const Deleter<VehiclePropValue> mDisposableDeleter {
         [] (VehiclePropValue* v) {
@@ -231,9 +432,12 @@ private:
     };
 
 private:
-    mutable std::mutex mLock;
     const size_t mMaxRecyclableVectorSize;
-    std::map<int32_t, std::unique_ptr<InternalPool>> mValueTypePools;
+    // Indexed by type index * (mMaxRecyclableVectorSize + 1) + vector size.
+    std::vector<std::atomic<InternalPool*>> mExactSizePools;
+    std::atomic<SizeClassPool*> mSizeClassPools[kPooledTypeCount][kSizeClassCount] {};
+    // Mixed values by size class of their bytes.
+    std::atomic<SizeClassPool*> mMixedPools[kSizeClassCount] {};
 };
 
 }  // namespace V2_0
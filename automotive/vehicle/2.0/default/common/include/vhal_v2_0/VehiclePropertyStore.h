@@ -17,13 +17,18 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_impl_PropertyDb_H_
 #define android_hardware_automotive_vehicle_V2_0_impl_PropertyDb_H_
 
+#include <array>
+#include <atomic>
 #include <cstdint>
-#include <unordered_map>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <vector>
 
 #include <android/hardware/automotive/vehicle/2.0/IVehicle.h>
 
+#include "TimedMutex.h"
+
 namespace android {
 namespace hardware {
 namespace automotive {
@@ -34,21 +39,23 @@ namespace V2_0 {
  * Encapsulates work related to storing and accessing configuration, storing and modifying
  * vehicle property values.
  *
- * VehiclePropertyValues stored in a sorted map thus it makes easier to get range of values, e.g.
- * to get value for all areas for particular property.
- *
- * This class is thread-safe, however it uses blocking synchronization across all methods.
+ * This class is thread-safe. Properties are spread over shards by property id and writers only
+ * lock the shard of the property they update. Values are stored as immutable snapshots that are
+ * replaced on every write, RCU style, so the latest value of a (property, area) pair is read
+ * without taking a lock, as long as the property has no token function. Values of properties
+ * with a token function (e.g. OBD2 freeze frames keyed by timestamp) are kept in a sorted map
+ * under the shard lock.
  */
 class VehiclePropertyStore {
 public:
     /* Function that used to calculate unique token for given VehiclePropValue */
     using TokenFunction = std::function<int64_t(const VehiclePropValue& value)>;
 
+    /* Stored value shared with the store. It is never modified, a write replaces it. */
+    using ValueSnapshot = std::shared_ptr<const VehiclePropValue>;
+
 private:
-    struct RecordConfig {
-        VehiclePropConfig propConfig;
-        TokenFunction tokenFunction;
-    };
+    static constexpr size_t kShardCount = 16;
 
     struct RecordId {
         int32_t prop;
@@ -59,8 +66,40 @@ private:
         bool operator<(const RecordId& other) const;
     };
 
-    using PropertyMap = std::map<RecordId, VehiclePropValue>;
-    using PropertyMapRange = std::pair<PropertyMap::const_iterator, PropertyMap::const_iterator>;
+    /* Latest value of one area of a property without a token function. */
+    struct AreaSlot {
+        const int32_t area;
+        ValueSnapshot value;  // Accessed with std::atomic_load and std::atomic_store.
+
+        explicit AreaSlot(int32_t area) : area(area) {}
+    };
+    using AreaTable = std::vector<AreaSlot*>;  // Sorted by area.
+
+    struct PropertyRecord {
+        const VehiclePropConfig propConfig;
+        const TokenFunction tokenFunction;
+        std::atomic<const AreaTable*> areas { nullptr };
+
+        // Guarded by the lock of the shard.
+        std::vector<std::unique_ptr<AreaSlot>> slots;
+        std::vector<std::unique_ptr<const AreaTable>> areaTables;  // Current and replaced ones.
+        std::map<RecordId, ValueSnapshot> tokenValues;
+
+        PropertyRecord(const VehiclePropConfig& config, TokenFunction tokenFunc)
+            : propConfig(config), tokenFunction(std::move(tokenFunc)) {}
+    };
+    using PropertyTable = std::vector<PropertyRecord*>;  // Sorted by property id.
+
+    struct Shard {
+        // Serializes writers of the shard, readers only need it for token values.
+        mutable TimedMutex lock;
+        std::atomic<const PropertyTable*> properties { nullptr };
+
+        // Guarded by lock. Records and tables are only released with the store, so a reader
+        // never sees freed memory. Registration is rare, so replaced tables are cheap to keep.
+        std::vector<std::unique_ptr<PropertyRecord>> records;
+        std::vector<std::unique_ptr<const PropertyTable>> tables;
+    };
 
 public:
     void registerProperty(const VehiclePropConfig& config, TokenFunction tokenFunc = nullptr);
@@ -78,21 +117,30 @@ public:
     std::unique_ptr<VehiclePropValue> readValueOrNull(int32_t prop, int32_t area = 0,
                                                       int64_t token = 0) const;
 
+    /* Same as readValueOrNull, but shares the stored value instead of copying it. */
+    ValueSnapshot readSnapshotOrNull(const VehiclePropValue& request) const;
+    ValueSnapshot readSnapshotOrNull(int32_t prop, int32_t area = 0, int64_t token = 0) const;
+
     std::vector<VehiclePropConfig> getAllConfigs() const;
     const VehiclePropConfig* getConfigOrNull(int32_t propId) const;
     const VehiclePropConfig* getConfigOrDie(int32_t propId) const;
 
-private:
-    RecordId getRecordIdLocked(const VehiclePropValue& valuePrototype) const;
-    const VehiclePropValue* getValueOrNullLocked(const RecordId& recId) const;
-    PropertyMapRange findRangeLocked(int32_t propId) const;
+    /* Time writers, and readers of token values, waited for the locks of the shards. */
+    LockWaitStats getLockWaitStats() const;
 
 private:
-    using MuxGuard = std::lock_guard<std::mutex>;
-    mutable std::mutex mLock;
-    std::unordered_map<int32_t /* VehicleProperty */, RecordConfig> mConfigs;
+    using MuxGuard = std::lock_guard<TimedMutex>;
 
-    PropertyMap mPropertyValues;  // Sorted map of RecordId : VehiclePropValue.
+    Shard& getShard(int32_t propId) const;
+    PropertyRecord* findRecord(int32_t propId) const;
+    AreaSlot* findSlot(const PropertyRecord& record, int32_t area) const;
+    AreaSlot* getOrCreateSlotLocked(PropertyRecord* record, int32_t area);
+    RecordId getRecordId(const PropertyRecord& record,
+                         const VehiclePropValue& valuePrototype) const;
+    ValueSnapshot readSnapshot(const PropertyRecord& record, const RecordId& recId) const;
+
+private:
+    mutable std::array<Shard, kShardCount> mShards;
 };
 
 }  // namespace V2_0
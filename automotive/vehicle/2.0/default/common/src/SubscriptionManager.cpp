@@ -31,6 +31,25 @@ namespace automotive {
 namespace vehicle {
 namespace V2_0 {
 
+namespace {
+
+/*
+ * Rate limited clients are delivered the first value on or after each point of a grid spaced by
+ * their sampling period. Values are accepted a quarter period early, so that a client subscribed
+ * at the rate the HAL produces values at, give or take some jitter, doesn't lose half of them.
+ */
+bool isDue(int64_t nextDueNanos, int64_t periodNanos, int64_t nowNanos) {
+    return nowNanos >= nextDueNanos - periodNanos / 4;
+}
+
+int64_t nextDue(int64_t nextDueNanos, int64_t periodNanos, int64_t nowNanos) {
+    // Keep to the grid, unless the property went quiet for more than a period.
+    return nowNanos - nextDueNanos < periodNanos ? nextDueNanos + periodNanos
+                                                 : nowNanos + periodNanos;
+}
+
+}  // namespace
+
 bool mergeSubscribeOptions(const SubscribeOptions &oldOpts,
                            const SubscribeOptions &newOpts,
                            SubscribeOptions *outResult) {
@@ -74,6 +93,15 @@ bool HalClient::isSubscribed(int32_t propId,
     return res;
 }
 
+bool HalClient::getSubscription(int32_t propId, SubscribeOptions* outOpts) const {
+    auto it = mSubscriptions.find(propId);
+    if (it == mSubscriptions.end()) {
+        return false;
+    }
+    *outOpts = it->second;
+    return true;
+}
+
 std::vector<int32_t> HalClient::getSubscribedProperties() const {
     std::vector<int32_t> props;
     for (const auto& subscription : mSubscriptions) {
@@ -113,53 +141,74 @@ StatusCode SubscriptionManager::addOrUpdateSubscription(
             }
         }
     }
+    rebuildRoutingTableLocked();
 
     return StatusCode::OK;
 }
 
-std::list<HalClientValues> SubscriptionManager::distributeValuesToClients(
+void SubscriptionManager::distributeValuesToClients(
         const std::vector<recyclable_ptr<VehiclePropValue>>& propValues,
-        SubscribeFlags flags) const {
-    std::map<sp<HalClient>, std::list<VehiclePropValue*>> clientValuesMap;
+        SubscribeFlags flags,
+        std::vector<HalClientValues>* outClientValues,
+        int64_t nowNanos) const {
+    std::shared_ptr<const RoutingTable> table = std::atomic_load(&mRoutingTable);
+    uint64_t batch = ++mDistributedBatches;
+    uint64_t rateLimited = 0;
+
+    outClientValues->resize(table->clients.size());
+    for (size_t i = 0; i < table->clients.size(); i++) {
+        HalClientValues& clientValues = (*outClientValues)[i];
+        if (clientValues.client != table->clients[i]) {
+            clientValues.client = table->clients[i];
+        }
+        clientValues.values.clear();
+    }
 
-    {
-        MuxGuard g(mLock);
-        for (const auto& propValue: propValues) {
-            VehiclePropValue* v = propValue.get();
-            auto clients = getSubscribedClientsLocked(v->prop, flags);
-            for (const auto& client : clients) {
-                clientValuesMap[client].push_back(v);
+    for (const auto& propValue : propValues) {
+        VehiclePropValue* v = propValue.get();
+        auto it = table->routes.find(v->prop);
+        if (it == table->routes.end()) continue;
+        for (const RoutingTable::Route& route : it->second) {
+            if (!(route.flags & flags)) continue;
+
+            auto& values = (*outClientValues)[route.clientIndex].values;
+            if (route.rateLimiter == nullptr) {
+                values.push_back(v);
+                continue;
+            }
+
+            RoutingTable::RateLimiter::AreaState& area = route.rateLimiter->areas[v->areaId];
+            if (area.batch == batch) {
+                // Coalesce with the value already delivered from this batch.
+                values[area.valueIndex] = v;
+                rateLimited++;
+            } else if (!isDue(area.nextDueNanos, route.rateLimiter->periodNanos, nowNanos)) {
+                rateLimited++;
+            } else {
+                area.nextDueNanos = nextDue(area.nextDueNanos, route.rateLimiter->periodNanos,
+                                            nowNanos);
+                area.batch = batch;
+                area.valueIndex = values.size();
+                values.push_back(v);
             }
         }
     }
 
-    std::list<HalClientValues> clientValues;
-    for (const auto& entry : clientValuesMap) {
-        clientValues.push_back(HalClientValues {
-            .client = entry.first,
-            .values = entry.second
-        });
+    if (rateLimited != 0) {
+        mRateLimitedCount.fetch_add(rateLimited, std::memory_order_relaxed);
     }
-
-    return clientValues;
 }
 
 std::list<sp<HalClient>> SubscriptionManager::getSubscribedClients(int32_t propId,
                                                                    SubscribeFlags flags) const {
-    MuxGuard g(mLock);
-    return getSubscribedClientsLocked(propId, flags);
-}
-
-std::list<sp<HalClient>> SubscriptionManager::getSubscribedClientsLocked(
-    int32_t propId, SubscribeFlags flags) const {
     std::list<sp<HalClient>> subscribedClients;
 
-    sp<HalClientVector> propClients = getClientsForPropertyLocked(propId);
-    if (propClients.get() != nullptr) {
-        for (size_t i = 0; i < propClients->size(); i++) {
-            const auto& client = propClients->itemAt(i);
-            if (client->isSubscribed(propId, flags)) {
-                subscribedClients.push_back(client);
+    std::shared_ptr<const RoutingTable> table = std::atomic_load(&mRoutingTable);
+    auto it = table->routes.find(propId);
+    if (it != table->routes.end()) {
+        for (const RoutingTable::Route& route : it->second) {
+            if (route.flags & flags) {
+                subscribedClients.push_back(table->clients[route.clientIndex]);
             }
         }
     }
@@ -167,6 +216,61 @@ std::list<sp<HalClient>> SubscriptionManager::getSubscribedClientsLocked(
     return subscribedClients;
 }
 
+void SubscriptionManager::rebuildRoutingTableLocked() {
+    auto table = std::make_shared<RoutingTable>();
+    table->version = mRoutingTable->version + 1;
+
+    // Rate limiters of the current table, to carry their schedule over.
+    std::map<std::pair<int32_t, HalClient*>, std::shared_ptr<RoutingTable::RateLimiter>>
+            rateLimiters;
+    for (const auto& propRoutes : mRoutingTable->routes) {
+        for (const RoutingTable::Route& route : propRoutes.second) {
+            if (route.rateLimiter != nullptr) {
+                rateLimiters[{propRoutes.first, mRoutingTable->clients[route.clientIndex].get()}] =
+                        route.rateLimiter;
+            }
+        }
+    }
+
+    std::map<sp<HalClient>, size_t> clientIndices;
+    for (const auto& propClients : mPropToClients) {
+        int32_t propId = propClients.first;
+        const sp<HalClientVector>& clients = propClients.second;
+        for (size_t i = 0; i < clients->size(); i++) {
+            const sp<HalClient>& client = clients->itemAt(i);
+            SubscribeOptions opts;
+            if (!client->getSubscription(propId, &opts)) continue;
+
+            auto indexIt = clientIndices.find(client);
+            if (indexIt == clientIndices.end()) {
+                indexIt = clientIndices.emplace(client, table->clients.size()).first;
+                table->clients.push_back(client);
+            }
+            std::shared_ptr<RoutingTable::RateLimiter> rateLimiter;
+            auto halOpts = mHalEventSubscribeOptions.find(propId);
+            if (opts.sampleRate > 0 && halOpts != mHalEventSubscribeOptions.end()
+                    && opts.sampleRate < halOpts->second.sampleRate) {
+                int64_t period = static_cast<int64_t>(1e9 / opts.sampleRate);
+                auto old = rateLimiters.find({propId, client.get()});
+                if (old != rateLimiters.end() && old->second->periodNanos == period) {
+                    rateLimiter = old->second;
+                } else {
+                    rateLimiter = std::make_shared<RoutingTable::RateLimiter>(period);
+                }
+            }
+
+            table->routes[propId].push_back(RoutingTable::Route {
+                .clientIndex = indexIt->second,
+                .flags = opts.flags,
+                .rateLimiter = std::move(rateLimiter) });
+        }
+    }
+
+    ALOGI("%s: version %" PRIu64 ", %zu clients, %zu properties", __func__, table->version,
+          table->clients.size(), table->routes.size());
+    std::atomic_store(&mRoutingTable, std::shared_ptr<const RoutingTable>(std::move(table)));
+}
+
 bool SubscriptionManager::updateHalEventSubscriptionLocked(
         const SubscribeOptions &opts, SubscribeOptions *outUpdated) {
     bool updated = false;
@@ -245,6 +349,7 @@ void SubscriptionManager::unsubscribe(ClientId clientId,
             if (propertyClients->isEmpty()) {
                 mPropToClients.erase(propId);
             }
+            rebuildRoutingTableLocked();
         }
 
         bool isClientSubscribedToOtherProps = false;
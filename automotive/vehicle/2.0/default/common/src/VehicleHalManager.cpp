@@ -18,6 +18,8 @@
 
 #include "VehicleHalManager.h"
 
+#include <stdio.h>
+
 #include <cmath>
 #include <fstream>
 
@@ -36,6 +38,12 @@ using namespace std::placeholders;
 
 constexpr std::chrono::milliseconds kHalEventBatchingTimeWindow(10);
 
+/**
+ * Number of queued HAL events after which a batch is delivered without waiting for the rest of
+ * kHalEventBatchingTimeWindow.
+ */
+constexpr size_t kHalEventMaxBatchSize = 64;
+
 const VehiclePropValue kEmptyValue{};
 
 /**
@@ -168,10 +176,66 @@ Return<StatusCode> VehicleHalManager::unsubscribe(const sp<IVehicleCallback>& ca
 }
 
 Return<void> VehicleHalManager::debugDump(IVehicle::debugDump_cb _hidl_cb) {
-    _hidl_cb("");
+    _hidl_cb(dumpEventBatchingStats() + mHal->dump());
     return Void();
 }
 
+Return<void> VehicleHalManager::debug(const hidl_handle& fd,
+                                      const hidl_vec<hidl_string>& /* options */) {
+    if (fd.getNativeHandle() != nullptr && fd->numFds == 1) {
+        dprintf(fd->data[0], "%s%s", dumpEventBatchingStats().c_str(), mHal->dump().c_str());
+    }
+    return Void();
+}
+
+std::string VehicleHalManager::dumpEventBatchingStats() const {
+    const BatchingStats& stats = mBatchingConsumer.getStats();
+    auto appendHistogram = [](std::string* out, const char* name,
+                              const BatchingStats::Histogram& histogram) {
+        char buf[64];
+        out->append(name);
+        for (size_t b = 0; b < BatchingStats::kBucketCount; b++) {
+            uint64_t count = histogram[b].load(std::memory_order_relaxed);
+            if (count == 0) continue;
+            if (b == BatchingStats::kBucketCount - 1) {
+                snprintf(buf, sizeof(buf), " >=%" PRIu64 ":%" PRIu64, uint64_t(1) << (b - 1), count);
+            } else {
+                snprintf(buf, sizeof(buf), " <%" PRIu64 ":%" PRIu64, uint64_t(1) << b, count);
+            }
+            out->append(buf);
+        }
+        out->append("\n");
+    };
+
+    char buf[224];
+    snprintf(buf, sizeof(buf), "HAL events: %" PRIu64 " in %" PRIu64 " batches, %" PRIu64
+             " delivered without batching, %" PRIu64 " overflowed the queue, %" PRIu64
+             " dropped for clients subscribed at a lower rate\n",
+             stats.items.load(), stats.batches.load(), stats.immediateBatches.load(),
+             mEventQueue.getOverflowCount(), mSubscriptionManager.getRateLimitedCount());
+    std::string dump(buf);
+    appendHistogram(&dump, "  batch latency (us):", stats.latencyUsHistogram);
+    appendHistogram(&dump, "  batch size:", stats.batchSizeHistogram);
+
+    const PoolStats& poolStats = *PoolStats::instance();
+    snprintf(buf, sizeof(buf), "Value pool: %u obtained, %u created, hit rate %.1f%% (%u from "
+             "thread caches), %u not pooled\n",
+             poolStats.Obtained.load(), poolStats.Created.load(), poolStats.hitRate() * 100,
+             poolStats.ThreadCacheHits.load(), poolStats.NotPooled.load());
+    dump.append(buf);
+
+    LockWaitStats queueWaits = mEventQueue.getLockWaitStats();
+    LockWaitStats subscriptionWaits = mSubscriptionManager.getLockWaitStats();
+    LockWaitStats poolWaits = mValueObjectPool.getLockWaitStats();
+    snprintf(buf, sizeof(buf), "Lock waits: event queue %" PRIu64 " (%" PRIu64 " us), "
+             "subscriptions %" PRIu64 " (%" PRIu64 " us), value pool %" PRIu64 " (%" PRIu64
+             " us)\n",
+             queueWaits.waits, queueWaits.waitNanos / 1000, subscriptionWaits.waits,
+             subscriptionWaits.waitNanos / 1000, poolWaits.waits, poolWaits.waitNanos / 1000);
+    dump.append(buf);
+    return dump;
+}
+
 void VehicleHalManager::init() {
     ALOGI("VehicleHalManager::init");
 
@@ -181,7 +245,8 @@ void VehicleHalManager::init() {
     mBatchingConsumer.run(&mEventQueue,
                           kHalEventBatchingTimeWindow,
                           std::bind(&VehicleHalManager::onBatchHalEvent,
-                                    this, _1));
+                                    this, _1),
+                          kHalEventMaxBatchSize);
 
     mHal->init(&mValueObjectPool,
                std::bind(&VehicleHalManager::onHalEvent, this, _1),
@@ -224,11 +289,12 @@ void VehicleHalManager::onHalPropertySetError(StatusCode errorCode,
 }
 
 void VehicleHalManager::onBatchHalEvent(const std::vector<VehiclePropValuePtr>& values) {
-    const auto& clientValues =
-        mSubscriptionManager.distributeValuesToClients(values, SubscribeFlags::EVENTS_FROM_CAR);
+    mSubscriptionManager.distributeValuesToClients(values, SubscribeFlags::EVENTS_FROM_CAR,
+                                                   &mBatchClientValues);
 
-    for (const HalClientValues& cv : clientValues) {
+    for (const HalClientValues& cv : mBatchClientValues) {
         auto vecSize = cv.values.size();
+        if (vecSize == 0) continue;
         hidl_vec<VehiclePropValue> vec;
         if (vecSize < kMaxHidlVecOfVehiclPropValuePoolSize) {
             vec.setToExternal(&mHidlVecOfVehiclePropValuePool[0], vecSize);
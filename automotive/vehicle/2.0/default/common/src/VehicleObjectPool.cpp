@@ -18,6 +18,8 @@
 
 #include "VehicleObjectPool.h"
 
+#include <algorithm>
+
 #include <log/log.h>
 
 #include "VehicleUtils.h"
@@ -28,11 +30,99 @@ namespace automotive {
 namespace vehicle {
 namespace V2_0 {
 
+namespace {
+
+size_t getElementSize(VehiclePropertyType type) {
+    switch (type) {
+        case VehiclePropertyType::INT64:
+        case VehiclePropertyType::INT64_VEC:
+            return sizeof(int64_t);
+        case VehiclePropertyType::BYTES:
+            return sizeof(uint8_t);
+        default:
+            return sizeof(int32_t);
+    }
+}
+
+// Copies into dest without reallocating it when sizes match, as dest may use pooled storage.
+template <typename T>
+void copyHidlVecInPlace(hidl_vec<T>* dest, const hidl_vec<T>& src) {
+    if (dest->size() == src.size()) {
+        std::copy(src.begin(), src.end(), dest->begin());
+    } else {
+        *dest = src;
+    }
+}
+
+template <typename T>
+void setToStorage(hidl_vec<T>* vec, char* storage, size_t size) {
+    vec->setToExternal(reinterpret_cast<T*>(storage), size);
+}
+
+}  // namespace
+
+VehiclePropValuePool::~VehiclePropValuePool() {
+    for (auto& pool : mExactSizePools) {
+        delete pool.load();
+    }
+    for (auto& typePools : mSizeClassPools) {
+        for (auto& pool : typePools) {
+            delete pool.load();
+        }
+    }
+    for (auto& pool : mMixedPools) {
+        delete pool.load();
+    }
+}
+
+LockWaitStats VehiclePropValuePool::getLockWaitStats() const {
+    LockWaitStats stats;
+    auto add = [&stats](const auto* pool) {
+        if (pool != nullptr) {
+            stats += pool->getLockWaitStats();
+        }
+    };
+    for (const auto& pool : mExactSizePools) {
+        add(pool.load(std::memory_order_acquire));
+    }
+    for (const auto& typePools : mSizeClassPools) {
+        for (const auto& pool : typePools) {
+            add(pool.load(std::memory_order_acquire));
+        }
+    }
+    for (const auto& pool : mMixedPools) {
+        add(pool.load(std::memory_order_acquire));
+    }
+    return stats;
+}
+
+int VehiclePropValuePool::getPooledTypeIndex(VehiclePropertyType type) {
+    switch (type) {
+        case VehiclePropertyType::BOOLEAN:   return 0;
+        case VehiclePropertyType::INT32:     return 1;
+        case VehiclePropertyType::INT32_VEC: return 2;
+        case VehiclePropertyType::INT64:     return 3;
+        case VehiclePropertyType::INT64_VEC: return 4;
+        case VehiclePropertyType::FLOAT:     return 5;
+        case VehiclePropertyType::FLOAT_VEC: return 6;
+        case VehiclePropertyType::BYTES:     return 7;
+        default:                             return -1;
+    }
+}
+
 VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtain(
         VehiclePropertyType type, size_t vecSize) {
-    return isDisposable(type, vecSize)
-           ? obtainDisposable(type, vecSize)
-           : obtainRecylable(type, vecSize);
+    int typeIndex = getPooledTypeIndex(type);
+    if (typeIndex < 0) {
+        return obtainDisposable(type, vecSize);
+    }
+    if (vecSize <= mMaxRecyclableVectorSize) {
+        return obtainRecylable(typeIndex, type, vecSize);
+    }
+    if (vecSize * getElementSize(type) <= kMaxSizeClassBytes) {
+        return obtainSizeClassed(typeIndex, type, vecSize);
+    }
+    return obtainDisposable(type, vecSize);
 }
 
 VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtain(
@@ -43,13 +133,18 @@ VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtain(
     }
     VehiclePropertyType type = getPropType(src.prop);
     size_t vecSize = getVehicleRawValueVectorSize(src.value, type);;
-    auto dest = obtain(type, vecSize);
+    auto dest = VehiclePropertyType::MIXED == type ? obtainMixed(src.value.bytes.size())
+                                                   : obtain(type, vecSize);
 
     dest->prop = src.prop;
     dest->areaId = src.areaId;
     dest->status = src.status;
     dest->timestamp = src.timestamp;
-    copyVehicleRawValue(&dest->value, src.value);
+    copyHidlVecInPlace(&dest->value.int32Values, src.value.int32Values);
+    copyHidlVecInPlace(&dest->value.floatValues, src.value.floatValues);
+    copyHidlVecInPlace(&dest->value.int64Values, src.value.int64Values);
+    copyHidlVecInPlace(&dest->value.bytes, src.value.bytes);
+    dest->value.stringValue = src.value.stringValue;
 
     return dest;
 }
@@ -87,19 +182,27 @@ VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtainComplex() {
 }
 
 VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtainRecylable(
-        VehiclePropertyType type, size_t vecSize) {
-    // VehiclePropertyType is not overlapping with vectorSize.
-    int32_t key = static_cast<int32_t>(type)
-                  | static_cast<int32_t>(vecSize);
+        int typeIndex, VehiclePropertyType type, size_t vecSize) {
+    auto slot = &mExactSizePools[typeIndex * (mMaxRecyclableVectorSize + 1) + vecSize];
+    return getOrCreatePool(slot, type, vecSize)->obtain();
+}
 
-    std::lock_guard<std::mutex> g(mLock);
-    auto it = mValueTypePools.find(key);
+VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtainSizeClassed(
+        int typeIndex, VehiclePropertyType type, size_t vecSize) {
+    size_t sizeClass = getSizeClass(vecSize);
+    auto slot = &mSizeClassPools[typeIndex][sizeClass];
+    return getOrCreatePool(slot, type, size_t(1) << sizeClass, getElementSize(type))
+            ->obtainVector(vecSize);
+}
 
-    if (it == mValueTypePools.end()) {
-        auto newPool(std::make_unique<InternalPool>(type, vecSize));
-        it = mValueTypePools.emplace(key, std::move(newPool)).first;
+VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtainMixed(size_t bytesSize) {
+    if (bytesSize == 0 || bytesSize > kMaxSizeClassBytes) {
+        return obtainDisposable(VehiclePropertyType::MIXED, 0);
     }
-    return it->second->obtain();
+    size_t sizeClass = getSizeClass(bytesSize);
+    return getOrCreatePool(&mMixedPools[sizeClass], VehiclePropertyType::MIXED,
+                           size_t(1) << sizeClass, sizeof(uint8_t))
+            ->obtainVector(bytesSize);
 }
 
 VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtainBoolean(
@@ -109,6 +212,7 @@ VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtainBoolean(
 
 VehiclePropValuePool::RecyclableType VehiclePropValuePool::obtainDisposable(
         VehiclePropertyType valueType, size_t vectorSize) const {
+    INC_METRIC_IF_DEBUG(NotPooled)
     return RecyclableType {
         createVehiclePropValue(valueType, vectorSize).release(),
         mDisposableDeleter
@@ -153,6 +257,81 @@ VehiclePropValue* VehiclePropValuePool::InternalPool::createObject() {
     return createVehiclePropValue(mPropType, mVectorSize).release();
 }
 
+VehiclePropValuePool::SizeClassPool::SizeClassPool(VehiclePropertyType type, size_t capacity,
+                                                   size_t elementSize)
+    : ObjectPool<SizeClassedValue>(kMagazineSize, kMaxSharedObjects),
+      mPropType(type),
+      mCapacity(capacity),
+      mElementSize(elementSize),
+      mDeleter([this](VehiclePropValue* v) { recycle(static_cast<SizeClassedValue*>(v)); }) {}
+
+VehiclePropValuePool::RecyclableType VehiclePropValuePool::SizeClassPool::obtainVector(
+        size_t vecSize) {
+    SizeClassedValue* o = obtainRaw();
+    char* storage = o->storage.get();
+    switch (mPropType) {
+        case VehiclePropertyType::INT32:
+        case VehiclePropertyType::INT32_VEC:
+        case VehiclePropertyType::BOOLEAN:
+            setToStorage(&o->value.int32Values, storage, vecSize);
+            break;
+        case VehiclePropertyType::FLOAT:
+        case VehiclePropertyType::FLOAT_VEC:
+            setToStorage(&o->value.floatValues, storage, vecSize);
+            break;
+        case VehiclePropertyType::INT64:
+        case VehiclePropertyType::INT64_VEC:
+            setToStorage(&o->value.int64Values, storage, vecSize);
+            break;
+        case VehiclePropertyType::BYTES:
+        case VehiclePropertyType::MIXED:
+            setToStorage(&o->value.bytes, storage, vecSize);
+            break;
+        default:
+            break;
+    }
+    return RecyclableType { o, mDeleter };
+}
+
+void VehiclePropValuePool::SizeClassPool::recycle(SizeClassedValue* o) {
+    if (!check(&o->value)) {
+        ALOGE("Discarding value for prop 0x%x because it contains "
+                  "data that is not consistent with this pool. "
+                  "Expected type: %d, capacity: %zu",
+              o->prop, mPropType, mCapacity);
+        delete o;
+    } else {
+        ObjectPool<SizeClassedValue>::recycle(o);
+    }
+}
+
+bool VehiclePropValuePool::SizeClassPool::check(VehiclePropValue::RawValue* v) {
+    if (VehiclePropertyType::MIXED == mPropType) {
+        return true;  // Only obtained as copies, which overwrite every field.
+    }
+    // The vector of the type may have been resized or reassigned, obtainVector() sets it to the
+    // storage again. Others must be left empty.
+    auto isEmptyUnlessOfType = [](size_t size, bool ofType) { return ofType || size == 0; };
+    return isEmptyUnlessOfType(v->int32Values.size(),
+                               VehiclePropertyType::INT32 == mPropType ||
+                               VehiclePropertyType::INT32_VEC == mPropType ||
+                               VehiclePropertyType::BOOLEAN == mPropType) &&
+           isEmptyUnlessOfType(v->floatValues.size(),
+                               VehiclePropertyType::FLOAT == mPropType ||
+                               VehiclePropertyType::FLOAT_VEC == mPropType) &&
+           isEmptyUnlessOfType(v->int64Values.size(),
+                               VehiclePropertyType::INT64 == mPropType ||
+                               VehiclePropertyType::INT64_VEC == mPropType) &&
+           isEmptyUnlessOfType(v->bytes.size(), VehiclePropertyType::BYTES == mPropType) &&
+           v->stringValue.size() == 0;
+}
+
+VehiclePropValuePool::SizeClassedValue* VehiclePropValuePool::SizeClassPool::createObject() {
+    auto o = new SizeClassedValue();
+    o->storage.reset(new char[mCapacity * mElementSize]);
+    return o;
+}
+
 }  // namespace V2_0
 }  // namespace vehicle
 }  // namespace automotive
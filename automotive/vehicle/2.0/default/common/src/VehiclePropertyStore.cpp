@@ -16,6 +16,8 @@
 #define LOG_TAG "VehiclePropertyStore"
 #include <log/log.h>
 
+#include <algorithm>
+
 #include <common/include/vhal_v2_0/VehicleUtils.h>
 #include "VehiclePropertyStore.h"
 
@@ -37,96 +39,196 @@ bool VehiclePropertyStore::RecordId::operator<(const VehiclePropertyStore::Recor
 
 void VehiclePropertyStore::registerProperty(const VehiclePropConfig& config,
                                             VehiclePropertyStore::TokenFunction tokenFunc) {
-    MuxGuard g(mLock);
-    mConfigs.insert({ config.prop, RecordConfig { config, tokenFunc } });
+    Shard& shard = getShard(config.prop);
+    MuxGuard g(shard.lock);
+    if (findRecord(config.prop) != nullptr) return;
+
+    auto record = std::make_unique<PropertyRecord>(config, tokenFunc);
+    if (tokenFunc == nullptr) {
+        // Create the slots of known areas up front, so that writes rarely replace the table.
+        if (isGlobalProp(config.prop)) {
+            getOrCreateSlotLocked(record.get(), 0);
+        } else {
+            for (const auto& areaConfig : config.areaConfigs) {
+                getOrCreateSlotLocked(record.get(), areaConfig.areaId);
+            }
+        }
+    }
+
+    const PropertyTable* current = shard.properties.load(std::memory_order_relaxed);
+    auto table = std::make_unique<PropertyTable>();
+    if (current != nullptr) {
+        *table = *current;
+    }
+    auto it = std::lower_bound(table->begin(), table->end(), config.prop,
+                               [](const PropertyRecord* r, int32_t prop) {
+                                   return r->propConfig.prop < prop;
+                               });
+    table->insert(it, record.get());
+    shard.records.push_back(std::move(record));
+    shard.properties.store(table.get(), std::memory_order_release);
+    shard.tables.push_back(std::move(table));
 }
 
 bool VehiclePropertyStore::writeValue(const VehiclePropValue& propValue,
                                         bool updateStatus) {
-    MuxGuard g(mLock);
-    if (!mConfigs.count(propValue.prop)) return false;
+    Shard& shard = getShard(propValue.prop);
+    MuxGuard g(shard.lock);
+    PropertyRecord* record = findRecord(propValue.prop);
+    if (record == nullptr) return false;
 
-    RecordId recId = getRecordIdLocked(propValue);
-    VehiclePropValue* valueToUpdate = const_cast<VehiclePropValue*>(getValueOrNullLocked(recId));
-    if (valueToUpdate == nullptr) {
-        mPropertyValues.insert({ recId, propValue });
+    RecordId recId = getRecordId(*record, propValue);
+    auto valueToStore = std::make_shared<VehiclePropValue>(propValue);
+    if (record->tokenFunction != nullptr) {
+        auto it = record->tokenValues.find(recId);
+        if (it == record->tokenValues.end()) {
+            record->tokenValues.insert({ recId, std::move(valueToStore) });
+            return true;
+        }
+        valueToStore->areaId = it->second->areaId;
+        if (!updateStatus) {
+            valueToStore->status = it->second->status;
+        }
+        it->second = std::move(valueToStore);
     } else {
-        valueToUpdate->timestamp = propValue.timestamp;
-        valueToUpdate->value = propValue.value;
-        if (updateStatus) {
-            valueToUpdate->status = propValue.status;
+        AreaSlot* slot = getOrCreateSlotLocked(record, recId.area);
+        // Writers hold the shard lock, so the value can't change under us.
+        ValueSnapshot current = std::atomic_load(&slot->value);
+        if (current != nullptr) {
+            valueToStore->areaId = current->areaId;
+            if (!updateStatus) {
+                valueToStore->status = current->status;
+            }
         }
+        std::atomic_store(&slot->value, ValueSnapshot(std::move(valueToStore)));
     }
     return true;
 }
 
 void VehiclePropertyStore::removeValue(const VehiclePropValue& propValue) {
-    MuxGuard g(mLock);
-    RecordId recId = getRecordIdLocked(propValue);
-    auto it = mPropertyValues.find(recId);
-    if (it != mPropertyValues.end()) {
-        mPropertyValues.erase(it);
+    Shard& shard = getShard(propValue.prop);
+    MuxGuard g(shard.lock);
+    PropertyRecord* record = findRecord(propValue.prop);
+    if (record == nullptr) return;
+
+    RecordId recId = getRecordId(*record, propValue);
+    if (record->tokenFunction != nullptr) {
+        record->tokenValues.erase(recId);
+    } else {
+        AreaSlot* slot = findSlot(*record, recId.area);
+        if (slot != nullptr) {
+            std::atomic_store(&slot->value, ValueSnapshot());
+        }
     }
 }
 
 void VehiclePropertyStore::removeValuesForProperty(int32_t propId) {
-    MuxGuard g(mLock);
-    auto range = findRangeLocked(propId);
-    mPropertyValues.erase(range.first, range.second);
+    Shard& shard = getShard(propId);
+    MuxGuard g(shard.lock);
+    PropertyRecord* record = findRecord(propId);
+    if (record == nullptr) return;
+
+    record->tokenValues.clear();
+    for (auto& slot : record->slots) {
+        std::atomic_store(&slot->value, ValueSnapshot());
+    }
 }
 
 std::vector<VehiclePropValue> VehiclePropertyStore::readAllValues() const {
-    MuxGuard g(mLock);
+    std::vector<std::pair<RecordId, ValueSnapshot>> snapshots;
+    for (const Shard& shard : mShards) {
+        MuxGuard g(shard.lock);
+        const PropertyTable* table = shard.properties.load(std::memory_order_acquire);
+        if (table == nullptr) continue;
+        for (const PropertyRecord* record : *table) {
+            for (const auto& it : record->tokenValues) {
+                snapshots.push_back(it);
+            }
+            for (const auto& slot : record->slots) {
+                ValueSnapshot value = std::atomic_load(&slot->value);
+                if (value != nullptr) {
+                    snapshots.push_back({ { record->propConfig.prop, slot->area, 0 }, value });
+                }
+            }
+        }
+    }
+
+    // Keep the order of a store sorted by RecordId.
+    std::sort(snapshots.begin(), snapshots.end(),
+              [](const auto& a, const auto& b) { return a.first < b.first; });
     std::vector<VehiclePropValue> allValues;
-    allValues.reserve(mPropertyValues.size());
-    for (auto&& it : mPropertyValues) {
-        allValues.push_back(it.second);
+    allValues.reserve(snapshots.size());
+    for (const auto& it : snapshots) {
+        allValues.push_back(*it.second);
     }
     return allValues;
 }
 
 std::vector<VehiclePropValue> VehiclePropertyStore::readValuesForProperty(int32_t propId) const {
     std::vector<VehiclePropValue> values;
-    MuxGuard g(mLock);
-    auto range = findRangeLocked(propId);
-    for (auto it = range.first; it != range.second; ++it) {
-        values.push_back(it->second);
+    const PropertyRecord* record = findRecord(propId);
+    if (record == nullptr) return values;
+
+    if (record->tokenFunction != nullptr) {
+        MuxGuard g(getShard(propId).lock);
+        for (const auto& it : record->tokenValues) {
+            values.push_back(*it.second);
+        }
+        return values;
     }
 
+    const AreaTable* areas = record->areas.load(std::memory_order_acquire);
+    if (areas == nullptr) return values;
+    for (const AreaSlot* slot : *areas) {
+        ValueSnapshot value = std::atomic_load(&slot->value);
+        if (value != nullptr) {
+            values.push_back(*value);
+        }
+    }
     return values;
 }
 
 std::unique_ptr<VehiclePropValue> VehiclePropertyStore::readValueOrNull(
         const VehiclePropValue& request) const {
-    MuxGuard g(mLock);
-    RecordId recId = getRecordIdLocked(request);
-    const VehiclePropValue* internalValue = getValueOrNullLocked(recId);
-    return internalValue ? std::make_unique<VehiclePropValue>(*internalValue) : nullptr;
+    ValueSnapshot value = readSnapshotOrNull(request);
+    return value ? std::make_unique<VehiclePropValue>(*value) : nullptr;
 }
 
 std::unique_ptr<VehiclePropValue> VehiclePropertyStore::readValueOrNull(
         int32_t prop, int32_t area, int64_t token) const {
-    RecordId recId = {prop, isGlobalProp(prop) ? 0 : area, token };
-    MuxGuard g(mLock);
-    const VehiclePropValue* internalValue = getValueOrNullLocked(recId);
-    return internalValue ? std::make_unique<VehiclePropValue>(*internalValue) : nullptr;
+    ValueSnapshot value = readSnapshotOrNull(prop, area, token);
+    return value ? std::make_unique<VehiclePropValue>(*value) : nullptr;
+}
+
+VehiclePropertyStore::ValueSnapshot VehiclePropertyStore::readSnapshotOrNull(
+        const VehiclePropValue& request) const {
+    const PropertyRecord* record = findRecord(request.prop);
+    if (record == nullptr) return nullptr;
+    return readSnapshot(*record, getRecordId(*record, request));
 }
 
+VehiclePropertyStore::ValueSnapshot VehiclePropertyStore::readSnapshotOrNull(
+        int32_t prop, int32_t area, int64_t token) const {
+    const PropertyRecord* record = findRecord(prop);
+    if (record == nullptr) return nullptr;
+    return readSnapshot(*record, RecordId { prop, isGlobalProp(prop) ? 0 : area, token });
+}
 
 std::vector<VehiclePropConfig> VehiclePropertyStore::getAllConfigs() const {
-    MuxGuard g(mLock);
     std::vector<VehiclePropConfig> configs;
-    configs.reserve(mConfigs.size());
-    for (auto&& recordConfigIt: mConfigs) {
-        configs.push_back(recordConfigIt.second.propConfig);
+    for (const Shard& shard : mShards) {
+        const PropertyTable* table = shard.properties.load(std::memory_order_acquire);
+        if (table == nullptr) continue;
+        for (const PropertyRecord* record : *table) {
+            configs.push_back(record->propConfig);
+        }
     }
     return configs;
 }
 
 const VehiclePropConfig* VehiclePropertyStore::getConfigOrNull(int32_t propId) const {
-    MuxGuard g(mLock);
-    auto recordConfigIt = mConfigs.find(propId);
-    return recordConfigIt != mConfigs.end() ? &recordConfigIt->second.propConfig : nullptr;
+    const PropertyRecord* record = findRecord(propId);
+    return record != nullptr ? &record->propConfig : nullptr;
 }
 
 const VehiclePropConfig* VehiclePropertyStore::getConfigOrDie(int32_t propId) const {
@@ -138,35 +240,85 @@ const VehiclePropConfig* VehiclePropertyStore::getConfigOrDie(int32_t propId) co
     return cfg;
 }
 
-VehiclePropertyStore::RecordId VehiclePropertyStore::getRecordIdLocked(
-        const VehiclePropValue& valuePrototype) const {
+LockWaitStats VehiclePropertyStore::getLockWaitStats() const {
+    LockWaitStats stats;
+    for (const Shard& shard : mShards) {
+        stats += shard.lock.getWaitStats();
+    }
+    return stats;
+}
+
+VehiclePropertyStore::Shard& VehiclePropertyStore::getShard(int32_t propId) const {
+    static_assert(kShardCount == 16, "the shard is picked from the top 4 bits of the hash");
+    // Property ids of a group differ in their low bits only, mix them before picking a shard.
+    uint32_t hash = static_cast<uint32_t>(propId) * 0x9e3779b1u;
+    return mShards[hash >> 28];
+}
+
+VehiclePropertyStore::PropertyRecord* VehiclePropertyStore::findRecord(int32_t propId) const {
+    const PropertyTable* table = getShard(propId).properties.load(std::memory_order_acquire);
+    if (table == nullptr) return nullptr;
+    auto it = std::lower_bound(table->begin(), table->end(), propId,
+                               [](const PropertyRecord* r, int32_t prop) {
+                                   return r->propConfig.prop < prop;
+                               });
+    return it != table->end() && (*it)->propConfig.prop == propId ? *it : nullptr;
+}
+
+VehiclePropertyStore::AreaSlot* VehiclePropertyStore::findSlot(const PropertyRecord& record,
+                                                               int32_t area) const {
+    const AreaTable* areas = record.areas.load(std::memory_order_acquire);
+    if (areas == nullptr) return nullptr;
+    auto it = std::lower_bound(areas->begin(), areas->end(), area,
+                               [](const AreaSlot* s, int32_t a) { return s->area < a; });
+    return it != areas->end() && (*it)->area == area ? *it : nullptr;
+}
+
+VehiclePropertyStore::AreaSlot* VehiclePropertyStore::getOrCreateSlotLocked(
+        PropertyRecord* record, int32_t area) {
+    AreaSlot* slot = findSlot(*record, area);
+    if (slot != nullptr) return slot;
+
+    const AreaTable* current = record->areas.load(std::memory_order_relaxed);
+    auto table = std::make_unique<AreaTable>();
+    if (current != nullptr) {
+        *table = *current;
+    }
+    record->slots.push_back(std::make_unique<AreaSlot>(area));
+    slot = record->slots.back().get();
+    auto it = std::lower_bound(table->begin(), table->end(), area,
+                               [](const AreaSlot* s, int32_t a) { return s->area < a; });
+    table->insert(it, slot);
+    record->areas.store(table.get(), std::memory_order_release);
+    record->areaTables.push_back(std::move(table));
+    return slot;
+}
+
+VehiclePropertyStore::RecordId VehiclePropertyStore::getRecordId(
+        const PropertyRecord& record, const VehiclePropValue& valuePrototype) const {
     RecordId recId = {
         .prop = valuePrototype.prop,
         .area = isGlobalProp(valuePrototype.prop) ? 0 : valuePrototype.areaId,
         .token = 0
     };
 
-    auto it = mConfigs.find(recId.prop);
-    if (it == mConfigs.end()) return {};
-
-    if (it->second.tokenFunction != nullptr) {
-        recId.token = it->second.tokenFunction(valuePrototype);
+    if (record.tokenFunction != nullptr) {
+        recId.token = record.tokenFunction(valuePrototype);
     }
     return recId;
 }
 
-const VehiclePropValue* VehiclePropertyStore::getValueOrNullLocked(
-        const VehiclePropertyStore::RecordId& recId) const  {
-    auto it = mPropertyValues.find(recId);
-    return it == mPropertyValues.end() ? nullptr : &it->second;
-}
-
-VehiclePropertyStore::PropertyMapRange VehiclePropertyStore::findRangeLocked(int32_t propId) const {
-    // Based on the fact that mPropertyValues is a sorted map by RecordId.
-    auto beginIt = mPropertyValues.lower_bound( RecordId { propId, INT32_MIN, 0 });
-    auto endIt = mPropertyValues.lower_bound( RecordId { propId + 1, INT32_MIN, 0 });
-
-    return  PropertyMapRange { beginIt, endIt };
+VehiclePropertyStore::ValueSnapshot VehiclePropertyStore::readSnapshot(
+        const PropertyRecord& record, const RecordId& recId) const {
+    if (record.tokenFunction != nullptr) {
+        MuxGuard g(getShard(recId.prop).lock);
+        auto it = record.tokenValues.find(recId);
+        return it != record.tokenValues.end() ? it->second : nullptr;
+    }
+    // Values of properties without a token function are always stored with token 0.
+    if (recId.token != 0) return nullptr;
+    AreaSlot* slot = findSlot(record, recId.area);
+    return slot != nullptr ? std::atomic_load(&slot->value) : nullptr;
 }
 
 }  // namespace V2_0
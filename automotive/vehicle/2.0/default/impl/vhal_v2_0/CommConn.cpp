@@ -16,6 +16,7 @@
 
 #define LOG_TAG "CommConn"
 
+#include <inttypes.h>
 #include <thread>
 
 #include <android/hardware/automotive/vehicle/2.0/IVehicle.h>
@@ -32,24 +33,81 @@ namespace V2_0 {
 namespace impl {
 
 void CommConn::start() {
+    mWriteThread = std::make_unique<std::thread>(std::bind(&CommConn::writeThread, this));
     mReadThread = std::make_unique<std::thread>(std::bind(&CommConn::readThread, this));
 }
 
 void CommConn::stop() {
-    if (mReadThread->joinable()) {
+    {
+        std::lock_guard<std::mutex> g(mWriteLock);
+        mStopWriting = true;
+    }
+    mWriteCond.notify_one();
+    if (mWriteThread && mWriteThread->joinable()) {
+        mWriteThread->join();
+    }
+    if (mReadThread && mReadThread->joinable()) {
         mReadThread->join();
     }
 }
 
 void CommConn::sendMessage(emulator::EmulatorMessage const& msg) {
-    int numBytes = msg.ByteSize();
-    std::vector<uint8_t> buffer(static_cast<size_t>(numBytes));
-    if (!msg.SerializeToArray(buffer.data(), numBytes)) {
-        ALOGE("%s: SerializeToString failed!", __func__);
-        return;
+    {
+        std::lock_guard<std::mutex> g(mWriteLock);
+        if (msg.msg_type() == emulator::SET_PROPERTY_ASYNC) {
+            if (mPendingValues + msg.value_size() > kMaxPendingValues) {
+                uint64_t droppedBefore = mDroppedValues;
+                mDroppedValues += msg.value_size();
+                if (droppedBefore == 0 || droppedBefore / 1000 != mDroppedValues / 1000) {
+                    ALOGW("%s: Connection is not keeping up, %" PRIu64 " values dropped",
+                          __func__, mDroppedValues);
+                }
+                return;
+            }
+            mPendingValues += msg.value_size();
+
+            if (!mPendingMessages.empty()) {
+                emulator::EmulatorMessage& last = mPendingMessages.back();
+                if (last.msg_type() == emulator::SET_PROPERTY_ASYNC &&
+                    last.status() == msg.status()) {
+                    // The write thread was already notified of the message.
+                    last.mutable_value()->MergeFrom(msg.value());
+                    return;
+                }
+            }
+        }
+        mPendingMessages.push_back(msg);
     }
+    mWriteCond.notify_one();
+}
 
-    write(buffer);
+void CommConn::writeThread() {
+    std::vector<emulator::EmulatorMessage> messages;
+    // Reused for every message, so that it only grows to the size of the largest one.
+    std::vector<uint8_t> buffer;
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> g(mWriteLock);
+            mWriteCond.wait(g, [this] { return mStopWriting || !mPendingMessages.empty(); });
+            if (mStopWriting) {
+                return;
+            }
+            messages.swap(mPendingMessages);
+            mPendingValues = 0;
+        }
+
+        for (const emulator::EmulatorMessage& msg : messages) {
+            int numBytes = msg.ByteSize();
+            buffer.resize(static_cast<size_t>(numBytes));
+            if (!msg.SerializeToArray(buffer.data(), numBytes)) {
+                ALOGE("%s: SerializeToArray failed!", __func__);
+                continue;
+            }
+            write(buffer);
+        }
+        messages.clear();
+    }
 }
 
 void CommConn::readThread() {
@@ -18,6 +18,8 @@
 #define android_hardware_automotive_vehicle_V2_0_impl_CommBase_H_
 
 #include <android/hardware/automotive/vehicle/2.0/IVehicle.h>
+#include <condition_variable>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -50,7 +52,8 @@ class MessageProcessor {
 
 /**
  * This is the interface that both PipeComm and SocketComm use to represent a connection. The
- * connection will listen for commands on a separate 'read' thread.
+ * connection will listen for commands on a separate 'read' thread, and send messages from a
+ * separate 'write' thread, so that a slow reader on the other side only delays its own connection.
  */
 class CommConn {
    public:
@@ -59,12 +62,13 @@ class CommConn {
     virtual ~CommConn() {}
 
     /**
-     * Start the read thread reading messages from this connection.
+     * Start the read thread reading messages from this connection, and the write thread sending
+     * messages to it.
      */
     virtual void start();
 
     /**
-     * Closes a connection if it is open.
+     * Closes a connection if it is open. Messages not sent yet are dropped.
      */
     virtual void stop();
 
@@ -91,12 +95,15 @@ class CommConn {
     virtual int write(const std::vector<uint8_t>& data) = 0;
 
     /**
-     * Serialized and send the given message to the other side.
+     * Queues the given message to be serialized and sent to the other side by the write thread.
+     * Values of SET_PROPERTY_ASYNC messages that wait for the write thread are merged into one
+     * message. Up to kMaxPendingValues of them wait for a slow reader, further ones are dropped.
      */
     void sendMessage(emulator::EmulatorMessage const& msg);
 
    protected:
     std::unique_ptr<std::thread> mReadThread;
+    std::unique_ptr<std::thread> mWriteThread;
     MessageProcessor* mMessageProcessor;
 
     /**
@@ -104,6 +111,23 @@ class CommConn {
      * stop().
      */
     void readThread();
+
+    /**
+     * A thread that serializes and writes queued messages in a loop. You can stop this thread by
+     * calling stop().
+     */
+    void writeThread();
+
+   private:
+    static constexpr int kMaxPendingValues = 4096;
+
+    std::mutex mWriteLock;
+    std::condition_variable mWriteCond;
+    // Guarded by mWriteLock.
+    std::vector<emulator::EmulatorMessage> mPendingMessages;
+    int mPendingValues = 0;
+    uint64_t mDroppedValues = 0;
+    bool mStopWriting = false;
 };
 
 }  // namespace impl
@@ -119,10 +119,14 @@ enum class FakeDataCommand : int32_t {
     /**
      * Starts JSON-based fake data generation. It iterates through JSON-encoded VHAL events from a
      * file and inject them to VHAL. The iteration can be repeated multiple times or infinitely.
-     * Caller must provide additional data:
+     * The file may also be a binary trace converted by the fake-trace-converter tool, which is
+     * streamed instead of loaded into memory. Caller must provide additional data:
      *     int32Values[1] - number of iterations. If it is not provided or -1. The iteration will be
      *                      repeated infinite times.
-     *     stringValue    - path to the fake values JSON file
+     *     int32Values[2] - optional replay rate from 1 (recorded speed, the default) to 50.
+     *     int32Values[3...] - optional list of properties to replay. All properties are replayed
+     *                      if it is not provided.
+     *     stringValue    - path to the fake values JSON file or trace
      */
     StartJson = 2,
 
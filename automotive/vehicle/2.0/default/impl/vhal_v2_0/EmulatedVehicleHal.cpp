@@ -17,6 +17,7 @@
 
 #include <android/log.h>
 #include <android-base/macros.h>
+#include <inttypes.h>
 
 #include "EmulatedVehicleHal.h"
 #include "JsonFakeValueGenerator.h"
@@ -116,7 +117,7 @@ VehicleHal::VehiclePropValuePtr EmulatedVehicleHal::get(
             *outStatus = fillObd2DtcInfo(v.get());
             break;
         default:
-            auto internalPropValue = mPropStore->readValueOrNull(requestedPropValue);
+            auto internalPropValue = mPropStore->readSnapshotOrNull(requestedPropValue);
             if (internalPropValue != nullptr) {
                 v = getValuePool()->obtain(*internalPropValue);
             }
@@ -137,7 +138,7 @@ StatusCode EmulatedVehicleHal::set(const VehiclePropValue& propValue) {
             return status;
         }
     } else if (mHvacPowerProps.count(propValue.prop)) {
-        auto hvacPowerOn = mPropStore->readValueOrNull(
+        auto hvacPowerOn = mPropStore->readSnapshotOrNull(
             toInt(VehicleProperty::HVAC_POWER_ON),
             (VehicleAreaSeat::ROW_1_LEFT | VehicleAreaSeat::ROW_1_RIGHT |
              VehicleAreaSeat::ROW_2_LEFT | VehicleAreaSeat::ROW_2_CENTER |
@@ -188,7 +189,7 @@ StatusCode EmulatedVehicleHal::set(const VehiclePropValue& propValue) {
         // its underlying hardware
         return StatusCode::INVALID_ARG;
     }
-    auto currentPropValue = mPropStore->readValueOrNull(propValue);
+    auto currentPropValue = mPropStore->readSnapshotOrNull(propValue);
 
     if (currentPropValue == nullptr) {
         return StatusCode::INVALID_ARG;
@@ -282,7 +283,7 @@ void EmulatedVehicleHal::onContinuousPropertyTimer(const std::vector<int32_t>& p
 
     for (int32_t property : properties) {
         if (isContinuousProperty(property)) {
-            auto internalPropValue = mPropStore->readValueOrNull(property);
+            auto internalPropValue = mPropStore->readSnapshotOrNull(property);
             if (internalPropValue != nullptr) {
                 v = pool.obtain(*internalPropValue);
             }
@@ -314,6 +315,27 @@ StatusCode EmulatedVehicleHal::unsubscribe(int32_t property) {
     return StatusCode::OK;
 }
 
+std::string EmulatedVehicleHal::dump() {
+    const RecurrentTimer::Stats& stats = mRecurrentTimer.getStats();
+    char buf[160];
+    snprintf(buf, sizeof(buf), "Continuous property timer: %" PRIu64 " ticks, %" PRIu64
+             " skipped, max drift %" PRIu64 " us\n  drift (us):",
+             stats.ticks.load(), stats.skipped.load(), stats.maxDriftUs.load());
+    std::string dump(buf);
+    for (size_t b = 0; b < RecurrentTimer::Stats::kBucketCount; b++) {
+        uint64_t count = stats.driftUsHistogram[b].load(std::memory_order_relaxed);
+        if (count == 0) continue;
+        if (b == RecurrentTimer::Stats::kBucketCount - 1) {
+            snprintf(buf, sizeof(buf), " >=%" PRIu64 ":%" PRIu64, uint64_t(1) << (b - 1), count);
+        } else {
+            snprintf(buf, sizeof(buf), " <%" PRIu64 ":%" PRIu64, uint64_t(1) << b, count);
+        }
+        dump.append(buf);
+    }
+    dump.append("\n");
+    return dump;
+}
+
 bool EmulatedVehicleHal::isContinuousProperty(int32_t propId) const {
     const VehiclePropConfig* config = mPropStore->getConfigOrNull(propId);
     if (config == nullptr) {
@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "FakeValueTrace"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <log/log.h>
+
+#include "FakeValueTrace.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace impl {
+
+namespace {
+
+// Consumed pages are released in chunks of this size to keep the number of madvise calls low.
+constexpr size_t kReleaseChunkBytes = 1 << 20;
+
+size_t alignTo(size_t size, size_t alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+// 64 bits wide, so that counts of a corrupt record can't overflow it.
+uint64_t payloadSize(const FakeValueTraceRecord& record) {
+    return uint64_t(record.int64Count) * sizeof(int64_t) +
+           uint64_t(record.int32Count) * sizeof(int32_t) +
+           uint64_t(record.floatCount) * sizeof(float) + record.byteCount + record.stringLength;
+}
+
+template <typename T>
+uint8_t* encodeArray(uint8_t* dest, const hidl_vec<T>& values) {
+    if (values.size() > 0) {
+        memcpy(dest, values.data(), values.size() * sizeof(T));
+    }
+    return dest + values.size() * sizeof(T);
+}
+
+template <typename T>
+const uint8_t* decodeArray(const uint8_t* src, size_t count, hidl_vec<T>* values) {
+    values->resize(count);
+    if (count > 0) {
+        memcpy(values->data(), src, count * sizeof(T));
+    }
+    return src + count * sizeof(T);
+}
+
+}  // namespace
+
+FakeValueTraceWriter::~FakeValueTraceWriter() {
+    if (mFile != nullptr) {
+        fclose(mFile);
+    }
+}
+
+bool FakeValueTraceWriter::open(const char* path) {
+    mFile = fopen(path, "wbe");
+    if (mFile == nullptr) {
+        ALOGE("%s: couldn't create %s: %s", __func__, path, strerror(errno));
+        return false;
+    }
+    mHeader = {
+        .magic = FakeValueTraceHeader::kMagic,
+        .version = FakeValueTraceHeader::kVersion,
+    };
+    // The header is rewritten with the final counts on close()
+    return fwrite(&mHeader, sizeof(mHeader), 1, mFile) == 1;
+}
+
+bool FakeValueTraceWriter::append(const VehiclePropValue& event) {
+    if (mFile == nullptr) {
+        ALOGE("%s: trace is not open", __func__);
+        return false;
+    }
+    if (mHeader.recordCount > 0 && event.timestamp < mHeader.lastTimestamp) {
+        ALOGE("%s: event of property 0x%x is out of timestamp order", __func__, event.prop);
+        return false;
+    }
+    const auto& v = event.value;
+    FakeValueTraceRecord record = {
+        .prop = event.prop,
+        .areaId = event.areaId,
+        .int32Count = static_cast<uint32_t>(v.int32Values.size()),
+        .timestamp = event.timestamp,
+        .int64Count = static_cast<uint32_t>(v.int64Values.size()),
+        .floatCount = static_cast<uint32_t>(v.floatValues.size()),
+        .byteCount = static_cast<uint32_t>(v.bytes.size()),
+        .stringLength = static_cast<uint32_t>(v.stringValue.size()),
+    };
+    record.size = alignTo(sizeof(record) + payloadSize(record), 8);
+
+    mBuffer.assign(record.size, 0);
+    memcpy(mBuffer.data(), &record, sizeof(record));
+    uint8_t* payload = mBuffer.data() + sizeof(record);
+    payload = encodeArray(payload, v.int64Values);
+    payload = encodeArray(payload, v.int32Values);
+    payload = encodeArray(payload, v.floatValues);
+    payload = encodeArray(payload, v.bytes);
+    memcpy(payload, v.stringValue.c_str(), v.stringValue.size());
+
+    if (fwrite(mBuffer.data(), mBuffer.size(), 1, mFile) != 1) {
+        ALOGE("%s: write failed: %s", __func__, strerror(errno));
+        return false;
+    }
+    if (mHeader.recordCount == 0) {
+        mHeader.firstTimestamp = event.timestamp;
+    }
+    mHeader.lastTimestamp = event.timestamp;
+    mHeader.recordCount++;
+    return true;
+}
+
+bool FakeValueTraceWriter::close() {
+    if (mFile == nullptr) {
+        ALOGE("%s: trace is not open", __func__);
+        return false;
+    }
+    bool ok = fseek(mFile, 0, SEEK_SET) == 0 && fwrite(&mHeader, sizeof(mHeader), 1, mFile) == 1;
+    ok = fclose(mFile) == 0 && ok;
+    mFile = nullptr;
+    if (!ok) {
+        ALOGE("%s: couldn't complete trace: %s", __func__, strerror(errno));
+    }
+    return ok;
+}
+
+FakeValueTraceReader::~FakeValueTraceReader() {
+    if (mData != nullptr) {
+        munmap(const_cast<uint8_t*>(mData), mSize);
+    }
+}
+
+bool FakeValueTraceReader::open(const char* path, bool* isTrace) {
+    *isTrace = false;
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("%s: couldn't open %s: %s", __func__, path, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(mHeader) ||
+        pread(fd, &mHeader, sizeof(mHeader), 0) != sizeof(mHeader) ||
+        mHeader.magic != FakeValueTraceHeader::kMagic) {
+        ::close(fd);
+        return false;
+    }
+    *isTrace = true;
+    if (mHeader.version != FakeValueTraceHeader::kVersion) {
+        ALOGE("%s: %s has unsupported trace version %u", __func__, path, mHeader.version);
+        ::close(fd);
+        return false;
+    }
+
+    // The mapping only reserves address space: pages are read in on access and dropped once
+    // consumed.
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        ALOGE("%s: couldn't map %s: %s", __func__, path, strerror(errno));
+        return false;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    mData = static_cast<const uint8_t*>(data);
+    mSize = st.st_size;
+    rewind();
+    return true;
+}
+
+const FakeValueTraceRecord* FakeValueTraceReader::nextRecord() {
+    if (mSize - mOffset < sizeof(FakeValueTraceRecord)) {
+        return nullptr;
+    }
+    // Records are 8-byte aligned within the page-aligned mapping
+    auto record = reinterpret_cast<const FakeValueTraceRecord*>(mData + mOffset);
+    if (record->size < sizeof(*record) || record->size % 8 != 0 || record->size > mSize - mOffset ||
+        sizeof(*record) + payloadSize(*record) > record->size) {
+        ALOGE("%s: corrupt record at offset %zu, stopping", __func__, mOffset);
+        mOffset = mSize;
+        return nullptr;
+    }
+    releaseConsumedPages(mOffset, false /* all */);
+    mOffset += record->size;
+    return record;
+}
+
+void FakeValueTraceReader::decode(const FakeValueTraceRecord& record, VehiclePropValue* event) {
+    event->prop = record.prop;
+    event->areaId = record.areaId;
+    event->timestamp = record.timestamp;
+    auto& v = event->value;
+    auto payload = reinterpret_cast<const uint8_t*>(&record) + sizeof(record);
+    payload = decodeArray(payload, record.int64Count, &v.int64Values);
+    payload = decodeArray(payload, record.int32Count, &v.int32Values);
+    payload = decodeArray(payload, record.floatCount, &v.floatValues);
+    payload = decodeArray(payload, record.byteCount, &v.bytes);
+    v.stringValue = std::string(reinterpret_cast<const char*>(payload), record.stringLength);
+}
+
+void FakeValueTraceReader::rewind() {
+    releaseConsumedPages(mOffset, true /* all */);
+    mOffset = sizeof(FakeValueTraceHeader);
+    mReleasedOffset = 0;
+}
+
+void FakeValueTraceReader::releaseConsumedPages(size_t end, bool all) {
+    static const size_t pageSize = getpagesize();
+    if (all) {
+        end = std::min(alignTo(end, pageSize), mSize);
+    } else {
+        end &= ~(pageSize - 1);
+    }
+    if (end > mReleasedOffset && (all || end - mReleasedOffset >= kReleaseChunkBytes)) {
+        madvise(const_cast<uint8_t*>(mData) + mReleasedOffset, end - mReleasedOffset,
+                MADV_DONTNEED);
+        mReleasedOffset = end;
+    }
+}
+
+}  // namespace impl
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef android_hardware_automotive_vehicle_V2_0_impl_FakeValueTrace_H_
+#define android_hardware_automotive_vehicle_V2_0_impl_FakeValueTrace_H_
+
+#include <stdio.h>
+
+#include <vector>
+
+#include <android/hardware/automotive/vehicle/2.0/types.h>
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace impl {
+
+/**
+ * Compact binary encoding of recorded VHAL events, replayed by JsonFakeValueGenerator. Unlike the
+ * JSON format, a trace is memory-mapped and decoded one record at a time, so that hours-long
+ * recordings can be replayed without loading them into memory. Traces are converted from fake value
+ * JSON files by android.hardware.automotive.vehicle@2.0-fake-trace-converter.
+ *
+ * A trace is a FakeValueTraceHeader followed by recordCount records in timestamp order. Each record
+ * is a FakeValueTraceRecord followed by its int64Values, int32Values, floatValues, bytes and
+ * stringValue, padded to a multiple of 8 bytes. All fields are in host byte order.
+ */
+struct FakeValueTraceHeader {
+    static constexpr uint32_t kMagic = 0x52544856;  // "VHTR"
+    static constexpr uint32_t kVersion = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t recordCount;
+    int64_t firstTimestamp;
+    int64_t lastTimestamp;
+};
+
+struct FakeValueTraceRecord {
+    uint32_t size;  // Of the record including its payload and padding
+    int32_t prop;
+    int32_t areaId;
+    uint32_t int32Count;
+    int64_t timestamp;
+    uint32_t int64Count;
+    uint32_t floatCount;
+    uint32_t byteCount;
+    uint32_t stringLength;
+};
+
+static_assert(sizeof(FakeValueTraceHeader) == 32, "FakeValueTraceHeader layout changed");
+static_assert(sizeof(FakeValueTraceRecord) == 40, "FakeValueTraceRecord layout changed");
+
+/**
+ * Writes a trace one event at a time. Events must be appended in timestamp order.
+ */
+class FakeValueTraceWriter {
+public:
+    ~FakeValueTraceWriter();
+
+    bool open(const char* path);
+
+    bool append(const VehiclePropValue& event);
+
+    /**
+     * Completes the header and closes the file. The trace is unusable if this fails.
+     */
+    bool close();
+
+private:
+    FILE* mFile = nullptr;
+    FakeValueTraceHeader mHeader{};
+    std::vector<uint8_t> mBuffer;  // Reused to encode each record
+};
+
+/**
+ * Reads a memory-mapped trace sequentially. Pages that were already read are dropped from memory as
+ * the reader advances, so the resident size stays bounded no matter how long the trace is.
+ */
+class FakeValueTraceReader {
+public:
+    ~FakeValueTraceReader();
+
+    /**
+     * Returns false if the file could not be mapped or is not a trace; *isTrace tells which.
+     */
+    bool open(const char* path, bool* isTrace);
+
+    bool isOpen() const { return mData != nullptr; }
+
+    const FakeValueTraceHeader& header() const { return mHeader; }
+
+    /**
+     * Returns the next record, or nullptr at the end of the trace or if the record is corrupt. The
+     * record points into the mapping and stays valid while the reader is open.
+     */
+    const FakeValueTraceRecord* nextRecord();
+
+    static void decode(const FakeValueTraceRecord& record, VehiclePropValue* event);
+
+    /** Restarts reading from the first record. */
+    void rewind();
+
+private:
+    /**
+     * Drops pages before end from memory, once there is at least a chunk of them unless all is set.
+     */
+    void releaseConsumedPages(size_t end, bool all);
+
+private:
+    const uint8_t* mData = nullptr;
+    size_t mSize = 0;
+    size_t mOffset = 0;
+    size_t mReleasedOffset = 0;  // Everything before it is no longer resident
+    FakeValueTraceHeader mHeader{};
+};
+
+}  // namespace impl
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
+
+#endif  // android_hardware_automotive_vehicle_V2_0_impl_FakeValueTrace_H_
@@ -16,6 +16,7 @@
 
 #define LOG_TAG "JsonFakeValueGenerator"
 
+#include <algorithm>
 #include <fstream>
 #include <type_traits>
 #include <typeinfo>
@@ -36,16 +37,28 @@ namespace impl {
 JsonFakeValueGenerator::JsonFakeValueGenerator(const VehiclePropValue& request) {
     const auto& v = request.value;
     const char* file = v.stringValue.c_str();
-    std::ifstream ifs(file);
-    if (!ifs) {
-        ALOGE("%s: couldn't open %s for parsing.", __func__, file);
+    bool isTrace;
+    if (!mTrace.open(file, &isTrace) && !isTrace) {
+        std::ifstream ifs(file);
+        if (!ifs) {
+            ALOGE("%s: couldn't open %s for parsing.", __func__, file);
+        }
+        mGenCfg = {
+            .index = 0,
+            .events = parseFakeValueJson(ifs),
+        };
     }
-    mGenCfg = {
-        .index = 0,
-        .events = parseFakeValueJson(ifs),
-    };
     // Iterate infinitely if repetition number is not provided
     mNumOfIterations = v.int32Values.size() < 2 ? -1 : v.int32Values[1];
+    int32_t rate = v.int32Values.size() < 3 ? 1 : v.int32Values[2];
+    mRate = std::min(std::max(rate, 1), kMaxReplayRate);
+    if (mRate != rate) {
+        ALOGW("%s: replay rate %d is out of range, using %d", __func__, rate, mRate);
+    }
+    for (size_t i = 3; i < v.int32Values.size(); i++) {
+        mPropFilter.insert(v.int32Values[i]);
+    }
+    fetchNextEvent();
 }
 
 VehiclePropValue JsonFakeValueGenerator::nextEvent() {
@@ -53,28 +66,73 @@ VehiclePropValue JsonFakeValueGenerator::nextEvent() {
     if (!hasNext()) {
         return generatedValue;
     }
-    TimePoint eventTime = Clock::now();
-    if (mGenCfg.index != 0) {
-        // All events (start from 2nd one) are supposed to happen in the future with a delay
-        // equals to the duration between previous and current event.
-        eventTime += Nanos(mGenCfg.events[mGenCfg.index].timestamp -
-                           mGenCfg.events[mGenCfg.index - 1].timestamp);
+    generatedValue = std::move(mNextEvent);
+    if (mNewIteration) {
+        mNewIteration = false;
+        mIterationStartTime = Clock::now();
+        mIterationStartTimestamp = generatedValue.timestamp;
     }
-    generatedValue = mGenCfg.events[mGenCfg.index];
+    // All events (start from 2nd one) are supposed to happen in the future with a delay equal to
+    // the duration since the first event of the iteration, shortened by the replay rate.
+    TimePoint eventTime =
+        mIterationStartTime + Nanos((generatedValue.timestamp - mIterationStartTimestamp) / mRate);
     generatedValue.timestamp = eventTime.time_since_epoch().count();
 
-    mGenCfg.index++;
-    if (mGenCfg.index == mGenCfg.events.size()) {
-        mGenCfg.index = 0;
+    fetchNextEvent();
+    return generatedValue;
+}
+
+bool JsonFakeValueGenerator::hasNext() {
+    return mHasNextEvent;
+}
+
+void JsonFakeValueGenerator::fetchNextEvent() {
+    mHasNextEvent = false;
+    bool restarted = false;
+    while (mNumOfIterations != 0) {
+        if (readRecordedEvent(&mNextEvent)) {
+            mHasNextEvent = true;
+            return;
+        }
         if (mNumOfIterations > 0) {
             mNumOfIterations--;
         }
+        // Stop if there is nothing to replay at all, e.g. no event passes the filter
+        if (restarted) {
+            return;
+        }
+        restarted = true;
+        mGenCfg.index = 0;
+        if (mTrace.isOpen()) {
+            mTrace.rewind();
+        }
+        mNewIteration = true;
     }
-    return generatedValue;
 }
 
-bool JsonFakeValueGenerator::hasNext() {
-    return mNumOfIterations != 0 && mGenCfg.events.size() > 0;
+bool JsonFakeValueGenerator::readRecordedEvent(VehiclePropValue* event) {
+    if (mTrace.isOpen()) {
+        // Only decode records that pass the filter
+        while (const FakeValueTraceRecord* record = mTrace.nextRecord()) {
+            if (!isFiltered(record->prop)) {
+                FakeValueTraceReader::decode(*record, event);
+                return true;
+            }
+        }
+        return false;
+    }
+    while (mGenCfg.index < mGenCfg.events.size()) {
+        const VehiclePropValue& recorded = mGenCfg.events[mGenCfg.index++];
+        if (!isFiltered(recorded.prop)) {
+            *event = recorded;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool JsonFakeValueGenerator::isFiltered(int32_t prop) const {
+    return !mPropFilter.empty() && mPropFilter.find(prop) == mPropFilter.end();
 }
 
 std::vector<VehiclePropValue> JsonFakeValueGenerator::parseFakeValueJson(std::istream& is) {
@@ -19,10 +19,12 @@
 
 #include <chrono>
 #include <iostream>
+#include <unordered_set>
 
 #include <json/json.h>
 
 #include "FakeValueGenerator.h"
+#include "FakeValueTrace.h"
 
 namespace android {
 namespace hardware {
@@ -32,6 +34,12 @@ namespace V2_0 {
 
 namespace impl {
 
+/**
+ * Replays recorded VHAL events from either a JSON file or a binary trace (see FakeValueTrace.h).
+ * JSON events are parsed up front, while traces are streamed from a memory mapping, which makes
+ * them the format of choice for long recordings. Replay can be sped up and restricted to a subset
+ * of properties, see FakeDataCommand::StartJson.
+ */
 class JsonFakeValueGenerator : public FakeValueGenerator {
 private:
     struct GeneratorCfg {
@@ -40,6 +48,8 @@ private:
     };
 
 public:
+    static constexpr int32_t kMaxReplayRate = 50;
+
     JsonFakeValueGenerator(const VehiclePropValue& request);
     ~JsonFakeValueGenerator() = default;
 
@@ -47,20 +57,42 @@ public:
 
     bool hasNext();
 
+    static std::vector<VehiclePropValue> parseFakeValueJson(std::istream& is);
+
 private:
-    std::vector<VehiclePropValue> parseFakeValueJson(std::istream& is);
-    void copyMixedValueJson(VehiclePropValue::RawValue& dest, const Json::Value& jsonValue);
+    /**
+     * Reads the next event that passes the property filter into mNextEvent, starting a new
+     * iteration at the end of the recording. Sets mHasNextEvent to false once all iterations are
+     * done.
+     */
+    void fetchNextEvent();
+    bool readRecordedEvent(VehiclePropValue* event);
+    bool isFiltered(int32_t prop) const;
+
+    static void copyMixedValueJson(VehiclePropValue::RawValue& dest, const Json::Value& jsonValue);
 
     template <typename T>
-    void copyJsonArray(hidl_vec<T>& dest, const Json::Value& jsonArray);
+    static void copyJsonArray(hidl_vec<T>& dest, const Json::Value& jsonArray);
 
-    bool isDiagnosticProperty(int32_t prop);
-    hidl_vec<uint8_t> generateDiagnosticBytes(const VehiclePropValue::RawValue& diagnosticValue);
-    void setBit(hidl_vec<uint8_t>& bytes, size_t idx);
+    static bool isDiagnosticProperty(int32_t prop);
+    static hidl_vec<uint8_t> generateDiagnosticBytes(
+        const VehiclePropValue::RawValue& diagnosticValue);
+    static void setBit(hidl_vec<uint8_t>& bytes, size_t idx);
 
 private:
     GeneratorCfg mGenCfg;
+    FakeValueTraceReader mTrace;
     int32_t mNumOfIterations;
+    int32_t mRate;
+    std::unordered_set<int32_t> mPropFilter;  // Replay all properties if empty
+
+    VehiclePropValue mNextEvent;
+    bool mHasNextEvent = false;
+    // Events of an iteration are scheduled relative to its first event, so that delays do not
+    // accumulate.
+    bool mNewIteration = true;
+    TimePoint mIterationStartTime;
+    int64_t mIterationStartTimestamp = 0;
 };
 
 }  // namespace impl
@@ -18,7 +18,10 @@
 
 #include <android/hardware/automotive/vehicle/2.0/IVehicle.h>
 #include <log/log.h>
+#include <poll.h>
 #include <qemu_pipe.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 #include "PipeComm.h"
 
@@ -33,7 +36,8 @@ namespace V2_0 {
 
 namespace impl {
 
-PipeComm::PipeComm(MessageProcessor* messageProcessor) : CommConn(messageProcessor), mPipeFd(-1) {}
+PipeComm::PipeComm(MessageProcessor* messageProcessor)
+    : CommConn(messageProcessor), mPipeFd(-1), mWakeFd(-1), mOpen(false) {}
 
 void PipeComm::start() {
     int fd = qemu_pipe_open(CAR_SERVICE_NAME);
@@ -43,18 +47,32 @@ void PipeComm::start() {
         return;
     }
 
+    int wakeFd = eventfd(0, EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        ALOGE("%s: eventfd() failed: %s", __FUNCTION__, strerror(errno));
+        ::close(fd);
+        return;
+    }
+
     ALOGI("%s: Starting pipe connection, fd=%d", __FUNCTION__, fd);
     mPipeFd = fd;
+    mWakeFd = wakeFd;
+    mOpen = true;
 
     CommConn::start();
 }
 
 void PipeComm::stop() {
     if (mPipeFd > 0) {
+        // Wakes up and joins the read and write threads before closing the pipe they use.
+        mOpen = false;
+        eventfd_write(mWakeFd, 1);
+        CommConn::stop();
         ::close(mPipeFd);
+        ::close(mWakeFd);
         mPipeFd = -1;
+        mWakeFd = -1;
     }
-    CommConn::stop();
 }
 
 std::vector<uint8_t> PipeComm::read() {
@@ -62,6 +80,18 @@ std::vector<uint8_t> PipeComm::read() {
     std::vector<uint8_t> msg = std::vector<uint8_t>(MAX_RX_MSG_SZ);
     int numBytes;
 
+    struct pollfd fds[2] = {
+        { mPipeFd, POLLIN, 0 },
+        { mWakeFd, POLLIN, 0 },
+    };
+    int ready;
+    do {
+        ready = ::poll(fds, 2, -1);
+    } while (ready < 0 && errno == EINTR);
+    if (ready < 0 || fds[1].revents != 0) {
+        return std::vector<uint8_t>();
+    }
+
     numBytes = qemu_pipe_frame_recv(mPipeFd, msg.data(), msg.size());
 
     if (numBytes == MAX_RX_MSG_SZ) {
@@ -71,7 +101,7 @@ std::vector<uint8_t> PipeComm::read() {
         return msg;
     } else {
         ALOGD("%s: Connection terminated on pipe %d, numBytes=%d", __FUNCTION__, mPipeFd, numBytes);
-        mPipeFd = -1;
+        mOpen = false;
     }
 
     return std::vector<uint8_t>();
@@ -80,7 +110,7 @@ std::vector<uint8_t> PipeComm::read() {
 int PipeComm::write(const std::vector<uint8_t>& data) {
     int retVal = 0;
 
-    if (mPipeFd != -1) {
+    if (mOpen) {
         retVal = qemu_pipe_frame_send(mPipeFd, data.data(), data.size());
     }
 
@@ -17,6 +17,7 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_impl_PipeComm_H_
 #define android_hardware_automotive_vehicle_V2_0_impl_PipeComm_H_
 
+#include <atomic>
 #include <mutex>
 #include <vector>
 #include "CommConn.h"
@@ -46,10 +47,15 @@ class PipeComm : public CommConn {
     std::vector<uint8_t> read() override;
     int write(const std::vector<uint8_t>& data) override;
 
-    inline bool isOpen() override { return mPipeFd > 0; }
+    inline bool isOpen() override { return mOpen; }
 
    private:
+    // Only changed by start() and stop(), while the read and write threads are not running.
     int mPipeFd;
+    // Signaled by stop() to wake up the read thread.
+    int mWakeFd;
+    // Cleared once the emulator closed the connection, or on stop().
+    std::atomic<bool> mOpen;
 };
 
 }  // impl
@@ -22,6 +22,10 @@
 #include <log/log.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <iterator>
 
 #include "SocketComm.h"
 
@@ -52,18 +56,36 @@ void SocketComm::start() {
 
 void SocketComm::stop() {
     if (mListenFd > 0) {
+        ::shutdown(mListenFd, SHUT_RDWR);
         ::close(mListenFd);
         if (mListenThread->joinable()) {
             mListenThread->join();
         }
         mListenFd = -1;
     }
-}
 
-void SocketComm::sendMessage(emulator::EmulatorMessage const& msg) {
     std::lock_guard<std::mutex> lock(mMutex);
     for (std::unique_ptr<SocketConn> const& conn : mOpenConnections) {
-        conn->sendMessage(msg);
+        conn->stop();
+    }
+    mOpenConnections.clear();
+}
+
+void SocketComm::sendMessage(emulator::EmulatorMessage const& msg) {
+    bool hasClosedConnections = false;
+    {
+        // Only queues the message on each connection, which have their own write thread.
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (std::unique_ptr<SocketConn> const& conn : mOpenConnections) {
+            if (conn->isOpen()) {
+                conn->sendMessage(msg);
+            } else {
+                hasClosedConnections = true;
+            }
+        }
+    }
+    if (hasClosedConnections) {
+        removeClosedConnections();
     }
 }
 
@@ -119,6 +141,7 @@ void SocketComm::listenThread() {
             return;
         }
 
+        removeClosedConnections();
         conn->start();
         {
             std::lock_guard<std::mutex> lock(mMutex);
@@ -128,12 +151,23 @@ void SocketComm::listenThread() {
 }
 
 /**
- * Called occasionally to clean up connections that have been closed.
+ * Called on new connections and messages to clean up connections that have been closed.
  */
 void SocketComm::removeClosedConnections() {
-    std::lock_guard<std::mutex> lock(mMutex);
-    std::remove_if(mOpenConnections.begin(), mOpenConnections.end(),
-                   [](std::unique_ptr<SocketConn> const& c) { return !c->isOpen(); });
+    std::vector<std::unique_ptr<SocketConn>> closedConnections;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto closed = std::partition(mOpenConnections.begin(), mOpenConnections.end(),
+                                     [](std::unique_ptr<SocketConn> const& c) {
+                                         return c->isOpen();
+                                     });
+        std::move(closed, mOpenConnections.end(), std::back_inserter(closedConnections));
+        mOpenConnections.erase(closed, mOpenConnections.end());
+    }
+    // Joining their threads does not hold up messages to the other connections.
+    for (std::unique_ptr<SocketConn> const& conn : closedConnections) {
+        conn->stop();
+    }
 }
 
 SocketConn::SocketConn(MessageProcessor* messageProcessor, int sfd)
@@ -146,10 +180,12 @@ SocketConn::SocketConn(MessageProcessor* messageProcessor, int sfd)
 std::vector<uint8_t> readExactly(int fd, int numBytes) {
     std::vector<uint8_t> buffer(numBytes);
     int totalRead = 0;
-    int offset = 0;
     while (totalRead < numBytes) {
-        int numRead = ::read(fd, &buffer.data()[offset], numBytes - offset);
-        if (numRead == 0) {
+        int numRead = ::read(fd, &buffer.data()[totalRead], numBytes - totalRead);
+        if (numRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numRead <= 0) {
             buffer.resize(0);
             return buffer;
         }
@@ -177,6 +213,7 @@ std::vector<uint8_t> SocketConn::read() {
     int32_t msgSize = readInt(mSockFd);
     if (msgSize <= 0) {
         ALOGD("%s: Connection terminated on socket %d", __FUNCTION__, mSockFd);
+        mPeerClosed = true;
         return std::vector<uint8_t>();
     }
 
@@ -185,32 +222,55 @@ std::vector<uint8_t> SocketConn::read() {
 
 void SocketConn::stop() {
     if (mSockFd > 0) {
+        // Unblocks the read and write threads before joining them.
+        ::shutdown(mSockFd, SHUT_RDWR);
+        CommConn::stop();
         close(mSockFd);
         mSockFd = -1;
     }
 }
 
 int SocketConn::write(const std::vector<uint8_t>& data) {
-    static constexpr int MSG_HEADER_LEN = 4;
-    int retVal = 0;
-    union {
-        uint32_t msgLen;
-        uint8_t msgLenBytes[MSG_HEADER_LEN];
-    };
-
-    // Prepare header for the message
-    msgLen = static_cast<uint32_t>(data.size());
-    msgLen = htonl(msgLen);
+    if (mSockFd <= 0) {
+        return 0;
+    }
 
-    if (mSockFd > 0) {
-        retVal = ::write(mSockFd, msgLenBytes, MSG_HEADER_LEN);
+    // Prepare header for the message, sent along with it in a single call.
+    uint32_t msgLen = htonl(static_cast<uint32_t>(data.size()));
+    struct iovec iov[2] = {
+        { &msgLen, sizeof(msgLen) },
+        { const_cast<uint8_t*>(data.data()), data.size() },
+    };
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    size_t remaining = sizeof(msgLen) + data.size();
+    while (remaining > 0) {
+        // MSG_NOSIGNAL, as a client that went away must not raise SIGPIPE.
+        ssize_t numWritten = ::sendmsg(mSockFd, &msg, MSG_NOSIGNAL);
+        if (numWritten < 0 && errno == EINTR) {
+            continue;
+        }
+        if (numWritten <= 0) {
+            ALOGD("%s: Write failed on socket %d, errno=%d", __FUNCTION__, mSockFd, errno);
+            return -1;
+        }
+        remaining -= numWritten;
 
-        if (retVal == MSG_HEADER_LEN) {
-            retVal = ::write(mSockFd, data.data(), data.size());
+        // Skip what was written, in case of a partial write.
+        while (msg.msg_iovlen > 0 && static_cast<size_t>(numWritten) >= msg.msg_iov->iov_len) {
+            numWritten -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = static_cast<uint8_t*>(msg.msg_iov->iov_base) + numWritten;
+            msg.msg_iov->iov_len -= numWritten;
         }
     }
 
-    return retVal;
+    return static_cast<int>(data.size());
 }
 
 }  // impl
@@ -17,6 +17,7 @@
 #ifndef android_hardware_automotive_vehicle_V2_0_impl_SocketComm_H_
 #define android_hardware_automotive_vehicle_V2_0_impl_SocketComm_H_
 
+#include <atomic>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -74,6 +75,9 @@ class SocketComm {
 
     void listenThread();
 
+    /**
+     * Stops and deletes connections that the client closed.
+     */
     void removeClosedConnections();
 };
 
@@ -107,10 +111,12 @@ class SocketConn : public CommConn {
      */
     int write(const std::vector<uint8_t>& data) override;
 
-    inline bool isOpen() override { return mSockFd > 0; }
+    inline bool isOpen() override { return mSockFd > 0 && !mPeerClosed; }
 
    private:
     int mSockFd;
+    // Set by the read thread when the client closed the connection, just before it exits.
+    std::atomic<bool> mPeerClosed{false};
 };
 
 }  // impl
@@ -148,42 +148,48 @@ void VehicleEmulator::doGetPropertyAll(VehicleEmulator::EmulatorMessage const& /
 
 void VehicleEmulator::doSetProperty(VehicleEmulator::EmulatorMessage const& rxMsg,
                                     VehicleEmulator::EmulatorMessage& respMsg) {
-    emulator::VehiclePropValue protoVal = rxMsg.value(0);
-    VehiclePropValue val = {
-        .prop = protoVal.prop(),
-        .areaId = protoVal.area_id(),
-        .status = (VehiclePropertyStatus)protoVal.status(),
-        .timestamp = elapsedRealtimeNano(),
-    };
-
     respMsg.set_msg_type(emulator::SET_PROPERTY_RESP);
 
-    // Copy value data if it is set.  This automatically handles complex data types if needed.
-    if (protoVal.has_string_value()) {
-        val.value.stringValue = protoVal.string_value().c_str();
-    }
+    // A message may carry many values, for instance when replaying a recorded drive. The status
+    // is only OK if all of them were set.
+    bool halRes = rxMsg.value_size() > 0;
+    for (const emulator::VehiclePropValue& protoVal : rxMsg.value()) {
+        VehiclePropValue val = {
+            .prop = protoVal.prop(),
+            .areaId = protoVal.area_id(),
+            .status = (VehiclePropertyStatus)protoVal.status(),
+            .timestamp = elapsedRealtimeNano(),
+        };
+
+        // Copy value data if it is set.  This automatically handles complex data types if needed.
+        if (protoVal.has_string_value()) {
+            val.value.stringValue = protoVal.string_value().c_str();
+        }
 
-    if (protoVal.has_bytes_value()) {
-        val.value.bytes = std::vector<uint8_t> { protoVal.bytes_value().begin(),
-                                                 protoVal.bytes_value().end() };
-    }
+        if (protoVal.has_bytes_value()) {
+            val.value.bytes = std::vector<uint8_t> { protoVal.bytes_value().begin(),
+                                                     protoVal.bytes_value().end() };
+        }
 
-    if (protoVal.int32_values_size() > 0) {
-        val.value.int32Values = std::vector<int32_t> { protoVal.int32_values().begin(),
-                                                       protoVal.int32_values().end() };
-    }
+        if (protoVal.int32_values_size() > 0) {
+            val.value.int32Values = std::vector<int32_t> { protoVal.int32_values().begin(),
+                                                           protoVal.int32_values().end() };
+        }
 
-    if (protoVal.int64_values_size() > 0) {
-        val.value.int64Values = std::vector<int64_t> { protoVal.int64_values().begin(),
-                                                       protoVal.int64_values().end() };
-    }
+        if (protoVal.int64_values_size() > 0) {
+            val.value.int64Values = std::vector<int64_t> { protoVal.int64_values().begin(),
+                                                           protoVal.int64_values().end() };
+        }
 
-    if (protoVal.float_values_size() > 0) {
-        val.value.floatValues = std::vector<float> { protoVal.float_values().begin(),
-                                                     protoVal.float_values().end() };
-    }
+        if (protoVal.float_values_size() > 0) {
+            val.value.floatValues = std::vector<float> { protoVal.float_values().begin(),
+                                                         protoVal.float_values().end() };
+        }
 
-    bool halRes = mHal->setPropertyFromVehicle(val);
+        if (!mHal->setPropertyFromVehicle(val)) {
+            halRes = false;
+        }
+    }
     respMsg.set_status(halRes ? emulator::RESULT_OK : emulator::ERROR_INVALID_PROPERTY);
 }
 
@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "vhal_v2_0/ConcurrentQueue.h"
+
+namespace android {
+
+namespace {
+
+using std::chrono::milliseconds;
+using Clock = std::chrono::steady_clock;
+
+constexpr milliseconds kBatchInterval(100);
+constexpr milliseconds kLongBatchInterval(10000);
+
+TEST(ConcurrentQueueTest, keepsOrderOfEachProducer) {
+    constexpr int kProducers = 4;
+    constexpr int kItemsPerProducer = 20000;
+    // Small enough for the producers to overflow the ring.
+    ConcurrentQueue<std::unique_ptr<int>> queue(16);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; p++) {
+        producers.emplace_back([&queue, p] {
+            for (int i = 0; i < kItemsPerProducer; i++) {
+                queue.push(std::make_unique<int>(p * kItemsPerProducer + i));
+            }
+        });
+    }
+
+    std::vector<int> next(kProducers, 0);
+    std::vector<std::unique_ptr<int>> items;
+    int received = 0;
+    while (received < kProducers * kItemsPerProducer) {
+        queue.waitForItems();
+        queue.flushInto(&items);
+        for (const auto& item : items) {
+            int producer = *item / kItemsPerProducer;
+            ASSERT_EQ(next[producer]++, *item % kItemsPerProducer);
+        }
+        received += items.size();
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+
+    queue.flushInto(&items);
+    ASSERT_TRUE(items.empty());
+}
+
+/* Item of a producer, whose first move, into the queue, can be held up to keep a ring cell claimed
+ * but unwritten.
+ */
+struct SequencedItem {
+    int producer;
+    int sequence;
+    std::atomic<bool>* release;  // If set, the first move yields until it's true
+    std::atomic<bool>* moving;
+
+    SequencedItem(int producer, int sequence, std::atomic<bool>* release = nullptr,
+                  std::atomic<bool>* moving = nullptr)
+        : producer(producer), sequence(sequence), release(release), moving(moving) {}
+
+    SequencedItem(SequencedItem&& other)
+        : producer(other.producer), sequence(other.sequence), release(nullptr), moving(nullptr) {
+        if (other.release != nullptr) {
+            if (other.moving != nullptr) *other.moving = true;
+            do {
+                std::this_thread::yield();
+            } while (!*other.release);
+            other.release = nullptr;
+        }
+    }
+
+    SequencedItem& operator=(SequencedItem&& other) = default;
+};
+
+TEST(ConcurrentQueueTest, overflowWaitsForItemsBeingPushed) {
+    ConcurrentQueue<SequencedItem> queue(2);
+    std::vector<SequencedItem> items;
+
+    // Producer 1 claims the first cell and stalls before writing it.
+    std::atomic<bool> release { false };
+    std::atomic<bool> moving { false };
+    std::thread stalled([&] { queue.push(SequencedItem(1, 0, &release, &moving)); });
+    while (!moving) {
+        std::this_thread::yield();
+    }
+
+    // Producer 0 fills the ring and overflows.
+    queue.push(SequencedItem(0, 0));
+    queue.push(SequencedItem(0, 1));
+    ASSERT_EQ(1u, queue.getOverflowCount());
+
+    // Its overflowed item must not be taken before the one stuck behind producer 1's cell.
+    queue.flushInto(&items);
+    ASSERT_TRUE(items.empty());
+
+    release = true;
+    stalled.join();
+    queue.waitForItems();
+    queue.flushInto(&items);
+    ASSERT_EQ(3u, items.size());
+    ASSERT_EQ(1, items[0].producer);
+    ASSERT_EQ(0, items[1].producer);
+    ASSERT_EQ(0, items[1].sequence);
+    ASSERT_EQ(0, items[2].producer);
+    ASSERT_EQ(1, items[2].sequence);
+}
+
+TEST(ConcurrentQueueTest, keepsOrderOfEachProducerUnderStalls) {
+    constexpr int kProducers = 8;
+    constexpr int kItemsPerProducer = 20000;
+    // Every so often a producer stalls between claiming a cell and writing it, while the others
+    // overflow the tiny ring.
+    constexpr int kStallEvery = 64;
+    ConcurrentQueue<SequencedItem> queue(2);
+    std::atomic<bool> released { true };
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; p++) {
+        producers.emplace_back([&queue, &released, p] {
+            for (int i = 0; i < kItemsPerProducer; i++) {
+                queue.push(SequencedItem(p, i, (i + p) % kStallEvery == 0 ? &released : nullptr));
+            }
+        });
+    }
+
+    std::vector<int> next(kProducers, 0);
+    std::vector<SequencedItem> items;
+    int received = 0;
+    while (received < kProducers * kItemsPerProducer) {
+        queue.waitForItems();
+        queue.flushInto(&items);
+        for (const auto& item : items) {
+            ASSERT_EQ(next[item.producer]++, item.sequence) << "producer " << item.producer;
+        }
+        received += items.size();
+    }
+    for (auto& producer : producers) {
+        producer.join();
+    }
+}
+
+TEST(ConcurrentQueueTest, waitForBatch) {
+    ConcurrentQueue<int> queue;
+    // Returns right away on an empty queue.
+    queue.waitForBatch(2, std::chrono::hours(1));
+
+    auto beforePush = Clock::now();
+    queue.push(1);
+    auto afterPush = Clock::now();
+    // Only a lower bound holds on a loaded machine.
+    queue.waitForBatch(2, milliseconds(20));
+    ASSERT_GE(Clock::now() - beforePush, milliseconds(20));
+
+    std::thread producer([&queue] {
+        std::this_thread::sleep_for(milliseconds(10));
+        queue.push(2);
+    });
+    queue.waitForBatch(2, std::chrono::hours(1));
+    producer.join();
+
+    Clock::time_point oldestPushTime;
+    ASSERT_EQ(std::vector<int>({ 1, 2 }), queue.flush(&oldestPushTime));
+    ASSERT_GE(oldestPushTime, beforePush);
+    ASSERT_LE(oldestPushTime, afterPush);
+}
+
+class BatchingConsumerTest : public ::testing::Test {
+protected:
+    void startConsumer(milliseconds batchInterval) {
+        consumer.run(&queue, batchInterval,
+                     [this](const std::vector<int>& batch) {
+                         std::lock_guard<std::mutex> g(lock);
+                         batches.push_back(batch);
+                         batchTimes.push_back(Clock::now());
+                         cond.notify_all();
+                     },
+                     kMaxBatchSize);
+    }
+
+    void TearDown() override {
+        consumer.requestStop();
+        queue.deactivate();
+        consumer.waitStopped();
+    }
+
+    bool waitForBatches(size_t count) {
+        std::unique_lock<std::mutex> g(lock);
+        return cond.wait_for(g, kDeliveryTimeout,
+                             [this, count] { return batches.size() >= count; });
+    }
+
+    /* Waits until count items have been delivered and returns them in delivery order. */
+    std::vector<int> waitForItems(size_t count) {
+        std::unique_lock<std::mutex> g(lock);
+        std::vector<int> items;
+        cond.wait_for(g, kDeliveryTimeout, [this, count, &items] {
+            items.clear();
+            for (const auto& batch : batches) {
+                items.insert(items.end(), batch.begin(), batch.end());
+            }
+            return items.size() >= count;
+        });
+        return items;
+    }
+
+public:
+    static constexpr size_t kMaxBatchSize = 4;
+    // Only bounds how long a broken consumer can hang the test.
+    static constexpr milliseconds kDeliveryTimeout { 10000 };
+
+    ConcurrentQueue<int> queue;
+    BatchingConsumer<int> consumer;
+
+    std::mutex lock;
+    std::condition_variable cond;
+    std::vector<std::vector<int>> batches;
+    std::vector<Clock::time_point> batchTimes;
+};
+
+TEST_F(BatchingConsumerTest, coldQueueDeliversImmediately) {
+    startConsumer(kBatchInterval);
+    queue.push(1);
+    ASSERT_TRUE(waitForBatches(1));
+    ASSERT_EQ(std::vector<int>({ 1 }), batches[0]);
+
+    // Whether the consumer waited for more items doesn't depend on how fast this machine is.
+    const BatchingStats& stats = consumer.getStats();
+    ASSERT_EQ(1u, stats.batches.load());
+    ASSERT_EQ(1u, stats.immediateBatches.load());
+    ASSERT_EQ(1u, stats.batchSizeHistogram[BatchingStats::getBucket(1)].load());
+}
+
+TEST_F(BatchingConsumerTest, batchesUntilFull) {
+    // Long enough for the queue to stay hot however slowly the items below are pushed.
+    startConsumer(kLongBatchInterval);
+    queue.push(0);
+    ASSERT_TRUE(waitForBatches(1));
+
+    // The queue is hot now: items are held until the batch is full.
+    for (int i = 1; i <= static_cast<int>(kMaxBatchSize); i++) {
+        queue.push(int(i));
+    }
+    ASSERT_TRUE(waitForBatches(2));
+    ASSERT_EQ(std::vector<int>({ 1, 2, 3, 4 }), batches[1]);
+
+    const BatchingStats& stats = consumer.getStats();
+    ASSERT_EQ(2u, stats.batches.load());
+    ASSERT_EQ(5u, stats.items.load());
+    ASSERT_EQ(1u, stats.immediateBatches.load());
+}
+
+TEST_F(BatchingConsumerTest, flushesAfterBatchInterval) {
+    startConsumer(kBatchInterval);
+    queue.push(0);
+    ASSERT_TRUE(waitForBatches(1));
+
+    auto start = Clock::now();
+    queue.push(10);
+    queue.push(11);
+    ASSERT_EQ(std::vector<int>({ 0, 10, 11 }), waitForItems(3));
+
+    // If this thread was preempted for longer than the batch interval, the queue went cold and
+    // the items were rightly delivered at once. Otherwise they were held for the interval.
+    std::lock_guard<std::mutex> g(lock);
+    if (consumer.getStats().immediateBatches.load() == 1) {
+        ASSERT_GE(batchTimes[1] - start, kBatchInterval);
+    }
+}
+
+}  // namespace
+
+}  // namespace android
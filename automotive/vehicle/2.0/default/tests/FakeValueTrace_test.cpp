@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "vhal_v2_0/DefaultConfig.h"
+#include "vhal_v2_0/FakeValueTrace.h"
+#include "vhal_v2_0/JsonFakeValueGenerator.h"
+#include "vhal_v2_0/VehicleUtils.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace impl {
+
+namespace {
+
+constexpr int64_t kSecond = 1000000000;
+
+VehiclePropValue createEvent(VehicleProperty prop, int64_t timestamp) {
+    VehiclePropValue event = {
+        .timestamp = timestamp,
+        .prop = toInt(prop),
+    };
+    event.value.floatValues = hidl_vec<float>{float(timestamp / kSecond)};
+    return event;
+}
+
+void writeTrace(const char* path, const std::vector<VehiclePropValue>& events) {
+    FakeValueTraceWriter writer;
+    ASSERT_TRUE(writer.open(path));
+    for (const auto& event : events) {
+        ASSERT_TRUE(writer.append(event));
+    }
+    ASSERT_TRUE(writer.close());
+}
+
+/* Requests replay of the trace at path, see FakeDataCommand::StartJson. */
+VehiclePropValue createReplayRequest(const char* path, int32_t iterations, int32_t rate,
+                                     const std::vector<int32_t>& filter = {}) {
+    VehiclePropValue request;
+    std::vector<int32_t> int32Values = {toInt(FakeDataCommand::StartJson), iterations, rate};
+    int32Values.insert(int32Values.end(), filter.begin(), filter.end());
+    request.value.int32Values = int32Values;
+    request.value.stringValue = path;
+    return request;
+}
+
+TEST(FakeValueTraceTest, roundTrip) {
+    VehiclePropValue mixed = {
+        .timestamp = 2 * kSecond,
+        .areaId = 3,
+        .prop = toInt(VehicleProperty::VEHICLE_MAP_SERVICE),
+    };
+    mixed.value.int32Values = hidl_vec<int32_t>{1, 2, 3};
+    mixed.value.int64Values = hidl_vec<int64_t>{-4};
+    mixed.value.floatValues = hidl_vec<float>{5.5f, 6.5f};
+    mixed.value.bytes = hidl_vec<uint8_t>{7, 8, 9, 10, 11};
+    mixed.value.stringValue = "twelve";
+    std::vector<VehiclePropValue> events = {
+        createEvent(VehicleProperty::PERF_VEHICLE_SPEED, kSecond), mixed,
+        createEvent(VehicleProperty::ENGINE_RPM, 2 * kSecond),
+    };
+
+    TemporaryFile trace;
+    writeTrace(trace.path, events);
+
+    FakeValueTraceReader reader;
+    bool isTrace;
+    ASSERT_TRUE(reader.open(trace.path, &isTrace));
+    ASSERT_TRUE(isTrace);
+    ASSERT_EQ(3u, reader.header().recordCount);
+    ASSERT_EQ(kSecond, reader.header().firstTimestamp);
+    ASSERT_EQ(2 * kSecond, reader.header().lastTimestamp);
+
+    // A second pass after rewind() reads the same events.
+    for (int pass = 0; pass < 2; pass++) {
+        for (const auto& expected : events) {
+            const FakeValueTraceRecord* record = reader.nextRecord();
+            ASSERT_NE(nullptr, record);
+            VehiclePropValue event;
+            FakeValueTraceReader::decode(*record, &event);
+            ASSERT_EQ(expected.prop, event.prop);
+            ASSERT_EQ(expected.areaId, event.areaId);
+            ASSERT_EQ(expected.timestamp, event.timestamp);
+            ASSERT_EQ(expected.value.int32Values, event.value.int32Values);
+            ASSERT_EQ(expected.value.int64Values, event.value.int64Values);
+            ASSERT_EQ(expected.value.floatValues, event.value.floatValues);
+            ASSERT_EQ(expected.value.bytes, event.value.bytes);
+            ASSERT_EQ(expected.value.stringValue, event.value.stringValue);
+        }
+        ASSERT_EQ(nullptr, reader.nextRecord());
+        reader.rewind();
+    }
+}
+
+TEST(FakeValueTraceTest, writerRejectsMisuse) {
+    FakeValueTraceWriter unopened;
+    ASSERT_FALSE(unopened.append(createEvent(VehicleProperty::ENGINE_RPM, 0)));
+    ASSERT_FALSE(unopened.close());
+
+    TemporaryFile trace;
+    FakeValueTraceWriter writer;
+    ASSERT_TRUE(writer.open(trace.path));
+    ASSERT_TRUE(writer.append(createEvent(VehicleProperty::ENGINE_RPM, 2 * kSecond)));
+    ASSERT_FALSE(writer.append(createEvent(VehicleProperty::ENGINE_RPM, kSecond)));
+    ASSERT_TRUE(writer.close());
+    ASSERT_FALSE(writer.close());
+}
+
+TEST(FakeValueTraceTest, readerRejectsBadHeader) {
+    TemporaryFile notTrace;
+    ASSERT_TRUE(android::base::WriteStringToFile("[]", notTrace.path));
+    FakeValueTraceReader reader;
+    bool isTrace;
+    ASSERT_FALSE(reader.open(notTrace.path, &isTrace));
+    ASSERT_FALSE(isTrace);
+
+    TemporaryFile newerVersion;
+    writeTrace(newerVersion.path, {});
+    FakeValueTraceHeader header;
+    int fd = open(newerVersion.path, O_RDWR);
+    ASSERT_EQ(ssize_t(sizeof(header)), pread(fd, &header, sizeof(header), 0));
+    header.version++;
+    ASSERT_EQ(ssize_t(sizeof(header)), pwrite(fd, &header, sizeof(header), 0));
+    close(fd);
+    ASSERT_FALSE(reader.open(newerVersion.path, &isTrace));
+    ASSERT_TRUE(isTrace);
+}
+
+TEST(FakeValueTraceTest, readerStopsAtTruncatedRecord) {
+    TemporaryFile trace;
+    writeTrace(trace.path, {createEvent(VehicleProperty::ENGINE_RPM, 0),
+                            createEvent(VehicleProperty::ENGINE_RPM, kSecond)});
+    struct stat st;
+    ASSERT_EQ(0, stat(trace.path, &st));
+    ASSERT_EQ(0, truncate(trace.path, st.st_size - 8));
+
+    FakeValueTraceReader reader;
+    bool isTrace;
+    ASSERT_TRUE(reader.open(trace.path, &isTrace));
+    ASSERT_NE(nullptr, reader.nextRecord());
+    ASSERT_EQ(nullptr, reader.nextRecord());
+}
+
+TEST(FakeValueTraceTest, readerStopsAtCorruptRecord) {
+    TemporaryFile trace;
+    writeTrace(trace.path, {createEvent(VehicleProperty::ENGINE_RPM, 0),
+                            createEvent(VehicleProperty::ENGINE_RPM, kSecond),
+                            createEvent(VehicleProperty::ENGINE_RPM, 2 * kSecond)});
+
+    // Claims a payload far larger than the record of the second event.
+    FakeValueTraceRecord record;
+    off_t secondRecord = sizeof(FakeValueTraceHeader) + 48;
+    int fd = open(trace.path, O_RDWR);
+    ASSERT_EQ(ssize_t(sizeof(record)), pread(fd, &record, sizeof(record), secondRecord));
+    ASSERT_EQ(48u, record.size);
+    record.int64Count = 0x40000000;
+    ASSERT_EQ(ssize_t(sizeof(record)), pwrite(fd, &record, sizeof(record), secondRecord));
+    close(fd);
+
+    FakeValueTraceReader reader;
+    bool isTrace;
+    ASSERT_TRUE(reader.open(trace.path, &isTrace));
+    ASSERT_NE(nullptr, reader.nextRecord());
+    ASSERT_EQ(nullptr, reader.nextRecord());
+    // Nothing past a corrupt record is trusted.
+    ASSERT_EQ(nullptr, reader.nextRecord());
+}
+
+TEST(FakeValueTraceTest, replayScalesByRate) {
+    TemporaryFile trace;
+    writeTrace(trace.path, {createEvent(VehicleProperty::ENGINE_RPM, 10 * kSecond),
+                            createEvent(VehicleProperty::ENGINE_RPM, 11 * kSecond),
+                            createEvent(VehicleProperty::ENGINE_RPM, 13 * kSecond)});
+
+    JsonFakeValueGenerator generator(createReplayRequest(trace.path, 1, 10));
+    std::vector<int64_t> timestamps;
+    while (generator.hasNext()) {
+        timestamps.push_back(generator.nextEvent().timestamp);
+    }
+    ASSERT_EQ(3u, timestamps.size());
+    ASSERT_EQ(kSecond / 10, timestamps[1] - timestamps[0]);
+    ASSERT_EQ(3 * kSecond / 10, timestamps[2] - timestamps[0]);
+}
+
+TEST(FakeValueTraceTest, replayClampsRate) {
+    TemporaryFile trace;
+    writeTrace(trace.path, {createEvent(VehicleProperty::ENGINE_RPM, 0),
+                            createEvent(VehicleProperty::ENGINE_RPM, 100 * kSecond)});
+
+    JsonFakeValueGenerator generator(
+        createReplayRequest(trace.path, 1, JsonFakeValueGenerator::kMaxReplayRate * 2));
+    int64_t first = generator.nextEvent().timestamp;
+    ASSERT_EQ(100 * kSecond / JsonFakeValueGenerator::kMaxReplayRate,
+              generator.nextEvent().timestamp - first);
+    ASSERT_FALSE(generator.hasNext());
+}
+
+TEST(FakeValueTraceTest, replayFiltersProperties) {
+    TemporaryFile trace;
+    writeTrace(trace.path, {createEvent(VehicleProperty::ENGINE_RPM, 0),
+                            createEvent(VehicleProperty::PERF_VEHICLE_SPEED, kSecond),
+                            createEvent(VehicleProperty::ENGINE_RPM, 2 * kSecond),
+                            createEvent(VehicleProperty::PERF_VEHICLE_SPEED, 3 * kSecond)});
+
+    JsonFakeValueGenerator generator(
+        createReplayRequest(trace.path, 2, 1, {toInt(VehicleProperty::PERF_VEHICLE_SPEED)}));
+    std::vector<VehiclePropValue> events;
+    while (generator.hasNext()) {
+        events.push_back(generator.nextEvent());
+    }
+    // Both iterations, only the speed events.
+    ASSERT_EQ(4u, events.size());
+    for (size_t i = 0; i < events.size(); i++) {
+        ASSERT_EQ(toInt(VehicleProperty::PERF_VEHICLE_SPEED), events[i].prop);
+        ASSERT_EQ(float(1 + 2 * (i % 2)), events[i].value.floatValues[0]);
+    }
+}
+
+TEST(FakeValueTraceTest, replayEndsWhenFilterMatchesNothing) {
+    TemporaryFile trace;
+    writeTrace(trace.path, {createEvent(VehicleProperty::ENGINE_RPM, 0)});
+
+    // Would otherwise iterate forever.
+    JsonFakeValueGenerator generator(
+        createReplayRequest(trace.path, -1, 1, {toInt(VehicleProperty::PERF_VEHICLE_SPEED)}));
+    ASSERT_FALSE(generator.hasNext());
+}
+
+}  // namespace
+
+}  // namespace impl
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
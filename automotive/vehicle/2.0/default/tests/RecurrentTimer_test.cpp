@@ -14,7 +14,10 @@
  * limitations under the License.
  */
 
+#include <condition_variable>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
 
 #include <gtest/gtest.h>
 
@@ -70,4 +73,84 @@ TEST(RecurrentTimerTest, multipleIntervals) {
     ASSERT_EQ_WITH_TOLERANCE(20, counter5ms.load(), 5);
 }
 
+TEST(RecurrentTimerTest, registerAndUnregister) {
+    std::mutex lock;
+    std::unordered_map<int32_t, int64_t> counters;
+    RecurrentTimer timer([&lock, &counters](const std::vector<int32_t>& cookies) {
+        std::lock_guard<std::mutex> g(lock);
+        for (int32_t cookie : cookies) {
+            counters[cookie]++;
+        }
+    });
+
+    // Many events sharing few intervals.
+    for (int32_t cookie = 0; cookie < 300; cookie++) {
+        timer.registerRecurrentEvent(milliseconds(cookie % 3 == 0 ? 5 : 10), cookie);
+    }
+    // Moving an event to another interval, and unregistering the only event of an interval.
+    timer.registerRecurrentEvent(milliseconds(5), 1);
+    timer.registerRecurrentEvent(milliseconds(2), 1000);
+    timer.unregisterRecurrentEvent(1000);
+    timer.unregisterRecurrentEvent(2);
+
+    std::this_thread::sleep_for(milliseconds(100));
+    timer.unregisterRecurrentEvent(0);
+    std::this_thread::sleep_for(milliseconds(20));
+
+    std::lock_guard<std::mutex> g(lock);
+    ASSERT_EQ_WITH_TOLERANCE(24, counters[3], 5);
+    ASSERT_EQ_WITH_TOLERANCE(counters[3], counters[1], 2);
+    ASSERT_EQ_WITH_TOLERANCE(counters[3] / 2, counters[4], 2);
+    // Unregistered right after being registered.
+    ASSERT_GT(counters[5] / 2, counters[2]);
+    ASSERT_GT(counters[5] / 2, counters[1000]);
+    ASSERT_EQ_WITH_TOLERANCE(counters[3] - 4, counters[0], 2);
+
+    const RecurrentTimer::Stats& stats = timer.getStats();
+    uint64_t histogramTicks = 0;
+    for (const auto& bucket : stats.driftUsHistogram) {
+        histogramTicks += bucket.load();
+    }
+    ASSERT_EQ(stats.ticks.load(), histogramTicks);
+    ASSERT_EQ_WITH_TOLERANCE(36, static_cast<int64_t>(stats.ticks.load()), 10);
+}
+
+TEST(RecurrentTimerTest, unregisterBeforeFiredOnRegistration) {
+    std::mutex lock;
+    std::condition_variable cond;
+    bool firing = false;
+    bool release = false;
+    std::unordered_map<int32_t, int64_t> counters;
+    RecurrentTimer timer([&](const std::vector<int32_t>& cookies) {
+        std::unique_lock<std::mutex> g(lock);
+        for (int32_t cookie : cookies) {
+            counters[cookie]++;
+        }
+        firing = true;
+        cond.notify_all();
+        cond.wait(g, [&release] { return release; });
+    });
+
+    // Holds the timer thread in its action, after the interval was fired.
+    timer.registerRecurrentEvent(std::chrono::hours(1), 1);
+    {
+        std::unique_lock<std::mutex> g(lock);
+        cond.wait(g, [&firing] { return firing; });
+    }
+    // Due right away as its interval was already fired, but gone before the thread gets to it.
+    timer.registerRecurrentEvent(std::chrono::hours(1), 2);
+    timer.unregisterRecurrentEvent(2);
+    {
+        std::lock_guard<std::mutex> g(lock);
+        release = true;
+    }
+    cond.notify_all();
+    std::this_thread::sleep_for(milliseconds(50));
+
+    std::lock_guard<std::mutex> g(lock);
+    // Interval times are aligned to the clock, so the interval may be due again already.
+    ASSERT_LE(1, counters[1]);
+    ASSERT_EQ(0, counters[2]);
+}
+
 }  // anonymous namespace
@@ -188,6 +188,99 @@ TEST_F(SubscriptionManagerTest, unsubscribe) {
     assertLastUnsubscribedProperty(PROP1);
 }
 
+TEST_F(SubscriptionManagerTest, distributeValuesToClients) {
+    std::list<SubscribeOptions> updatedOptions;
+    ASSERT_EQ(StatusCode::OK,
+              manager.addOrUpdateSubscription(1, cb1, subscrToProp1, &updatedOptions));
+    ASSERT_EQ(StatusCode::OK,
+              manager.addOrUpdateSubscription(2, cb2, subscrToProp1and2, &updatedOptions));
+
+    VehiclePropValuePool pool;
+    std::vector<recyclable_ptr<VehiclePropValue>> values;
+    values.push_back(pool.obtainInt32(1));
+    values.back()->prop = PROP1;
+    values.push_back(pool.obtainInt32(2));
+    values.back()->prop = PROP2;
+
+    std::vector<HalClientValues> clientValues;
+    manager.distributeValuesToClients(values, SubscribeFlags::EVENTS_FROM_CAR, &clientValues);
+    ASSERT_EQ(2u, clientValues.size());
+    for (const auto& cv : clientValues) {
+        if (cv.client->getCallback() == cb1) {
+            ASSERT_EQ(std::vector<VehiclePropValue*>({values[0].get()}), cv.values);
+        } else {
+            ASSERT_EQ(cb2, cv.client->getCallback());
+            ASSERT_EQ(std::vector<VehiclePropValue*>({values[0].get(), values[1].get()}),
+                      cv.values);
+        }
+    }
+
+    // The vector is reused for the next batch, entries of clients without values are empty.
+    manager.unsubscribe(2, PROP1);
+    values.erase(values.begin());
+    manager.distributeValuesToClients(values, SubscribeFlags::EVENTS_FROM_CAR, &clientValues);
+    ASSERT_EQ(2u, clientValues.size());
+    for (const auto& cv : clientValues) {
+        if (cv.client->getCallback() == cb1) {
+            ASSERT_TRUE(cv.values.empty());
+        } else {
+            ASSERT_EQ(std::vector<VehiclePropValue*>({values[0].get()}), cv.values);
+        }
+    }
+
+    manager.distributeValuesToClients(values, SubscribeFlags::EVENTS_FROM_ANDROID, &clientValues);
+    for (const auto& cv : clientValues) {
+        ASSERT_TRUE(cv.values.empty());
+    }
+}
+
+TEST_F(SubscriptionManagerTest, rateLimitsSlowerClients) {
+    std::list<SubscribeOptions> updatedOptions;
+    hidl_vec<SubscribeOptions> fast = {
+        SubscribeOptions{
+            .propId = PROP1, .sampleRate = 100, .flags = SubscribeFlags::EVENTS_FROM_CAR},
+    };
+    hidl_vec<SubscribeOptions> slow = {
+        SubscribeOptions{
+            .propId = PROP1, .sampleRate = 10, .flags = SubscribeFlags::EVENTS_FROM_CAR},
+    };
+    ASSERT_EQ(StatusCode::OK, manager.addOrUpdateSubscription(1, cb1, fast, &updatedOptions));
+    ASSERT_EQ(StatusCode::OK, manager.addOrUpdateSubscription(2, cb2, slow, &updatedOptions));
+
+    VehiclePropValuePool pool;
+    std::vector<HalClientValues> clientValues;
+    size_t fastCount = 0;
+    size_t slowCount = 0;
+    // One second of values at 100Hz, two per batch.
+    const int64_t start = 1000000000;
+    for (int i = 0; i < 100; i += 2) {
+        std::vector<recyclable_ptr<VehiclePropValue>> values;
+        for (int j = i; j < i + 2; j++) {
+            values.push_back(pool.obtainInt32(j));
+            values.back()->prop = PROP1;
+        }
+        manager.distributeValuesToClients(values, SubscribeFlags::EVENTS_FROM_CAR, &clientValues,
+                                          start + (i + 1) * 10000000);
+        for (const auto& cv : clientValues) {
+            if (cv.client->getCallback() == cb1) {
+                fastCount += cv.values.size();
+            } else {
+                slowCount += cv.values.size();
+                if (!cv.values.empty()) {
+                    // Only the latest value of the batch.
+                    ASSERT_EQ(1u, cv.values.size());
+                    ASSERT_EQ(i + 1, cv.values[0]->value.int32Values[0]);
+                }
+            }
+        }
+    }
+
+    ASSERT_EQ(100u, fastCount);
+    // The first value, then one per 100ms period after it.
+    ASSERT_EQ(11u, slowCount);
+    ASSERT_EQ(89u, manager.getRateLimitedCount());
+}
+
 }  // namespace anonymous
 
 }  // namespace V2_0
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "vhal_v2_0/TimedMutex.h"
+
+namespace android {
+
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+
+TEST(TimedMutexTest, freeLockIsNotCounted) {
+    TimedMutex mutex;
+    for (int i = 0; i < 100; i++) {
+        std::lock_guard<TimedMutex> g(mutex);
+    }
+    LockWaitStats stats = mutex.getWaitStats();
+    ASSERT_EQ(0u, stats.waits);
+    ASSERT_EQ(0u, stats.waitNanos);
+}
+
+TEST(TimedMutexTest, countsWaitForHeldLock) {
+    constexpr milliseconds kHoldTime(50);
+    TimedMutex mutex;
+    std::atomic<bool> locked { false };
+
+    std::thread holder([&] {
+        std::lock_guard<TimedMutex> g(mutex);
+        locked = true;
+        std::this_thread::sleep_for(kHoldTime);
+    });
+    while (!locked) {
+        std::this_thread::yield();
+    }
+    {
+        std::lock_guard<TimedMutex> g(mutex);
+    }
+    holder.join();
+
+    LockWaitStats stats = mutex.getWaitStats();
+    ASSERT_EQ(1u, stats.waits);
+    // The holder may have slept for a bit already when we started waiting.
+    ASSERT_GT(stats.waitNanos, uint64_t(nanoseconds(kHoldTime / 2).count()));
+
+    LockWaitStats total;
+    total += stats;
+    total += stats;
+    ASSERT_EQ(2u, total.waits);
+    ASSERT_EQ(2 * stats.waitNanos, total.waitNanos);
+}
+
+}  // namespace
+
+}  // namespace android
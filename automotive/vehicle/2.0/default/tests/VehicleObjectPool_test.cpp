@@ -21,6 +21,7 @@
 #include <utils/SystemClock.h>
 
 #include "vhal_v2_0/VehicleObjectPool.h"
+#include "vhal_v2_0/VehicleUtils.h"
 
 namespace android {
 namespace hardware {
@@ -49,6 +50,9 @@ private:
         stats->Obtained = 0;
         stats->Created = 0;
         stats->Recycled = 0;
+        stats->ThreadCacheHits = 0;
+        stats->SharedPoolHits = 0;
+        stats->NotPooled = 0;
     }
 
 public:
@@ -81,6 +85,94 @@ TEST_F(VehicleObjectPoolTest, valuePoolStrings) {
     ASSERT_EQ(0u, stats->Obtained);
 }
 
+TEST_F(VehicleObjectPoolTest, valuePoolSizeClasses) {
+    auto v = valuePool->obtain(VehiclePropertyType::BYTES, 100);
+    ASSERT_EQ(100u, v->value.bytes.size());
+    v->value.bytes[99] = 0x42;
+    v.reset();
+
+    // Any size of the same class reuses the value.
+    auto v2 = valuePool->obtain(VehiclePropertyType::BYTES, 128);
+    ASSERT_EQ(128u, v2->value.bytes.size());
+    auto v3 = valuePool->obtain(VehiclePropertyType::BYTES, 65);
+    ASSERT_EQ(65u, v3->value.bytes.size());
+    v3.reset();
+    v2.reset();
+    v3 = valuePool->obtain(VehiclePropertyType::BYTES, 127);
+    ASSERT_EQ(127u, v3->value.bytes.size());
+
+    // Another class.
+    auto v4 = valuePool->obtain(VehiclePropertyType::INT32_VEC, 200);
+    ASSERT_EQ(200u, v4->value.int32Values.size());
+    ASSERT_EQ(0u, v4->value.bytes.size());
+
+    ASSERT_EQ(5u, stats->Obtained);
+    ASSERT_EQ(2u, stats->ThreadCacheHits);
+    ASSERT_EQ(0u, stats->SharedPoolHits);
+    ASSERT_EQ(3u, stats->Created);
+    ASSERT_EQ(0u, stats->NotPooled);
+}
+
+TEST_F(VehicleObjectPoolTest, valuePoolMixedCopies) {
+    VehiclePropValue src;
+    src.prop = toInt(VehicleProperty::VEHICLE_MAP_SERVICE);
+    src.value.int32Values.resize(3);
+    src.value.int32Values[2] = 5;
+    src.value.bytes.resize(1000);
+    src.value.bytes[999] = 7;
+
+    auto copy = valuePool->obtain(src);
+    ASSERT_EQ(src.value.int32Values, copy->value.int32Values);
+    ASSERT_EQ(1000u, copy->value.bytes.size());
+    ASSERT_EQ(7, copy->value.bytes[999]);
+    void* raw = copy.get();
+    copy.reset();
+
+    // Copies of another message of the same size class reuse the value.
+    src.value.int32Values.resize(0);
+    src.value.bytes.resize(600);
+    src.value.stringValue = "s";
+    copy = valuePool->obtain(src);
+    ASSERT_EQ(raw, copy.get());
+    ASSERT_EQ(0u, copy->value.int32Values.size());
+    ASSERT_EQ(600u, copy->value.bytes.size());
+    ASSERT_STREQ("s", copy->value.stringValue.c_str());
+
+    ASSERT_EQ(0u, stats->NotPooled);
+    ASSERT_EQ(1u, stats->ThreadCacheHits);
+}
+
+TEST_F(VehicleObjectPoolTest, valuePoolOversizedVectors) {
+    size_t size = VehiclePropValuePool::kMaxSizeClassBytes + 1;
+    auto v = valuePool->obtain(VehiclePropertyType::BYTES, size);
+    ASSERT_EQ(size, v->value.bytes.size());
+
+    ASSERT_EQ(0u, stats->Obtained);
+    ASSERT_EQ(1u, stats->NotPooled);
+}
+
+TEST_F(VehicleObjectPoolTest, valuePoolAcrossThreads) {
+    // Values obtained in one thread and recycled in another get back to the first one through
+    // the shared pool.
+    const int O = 1000;
+    std::vector<recyclable_ptr<VehiclePropValue>> values;
+    for (int cycle = 0; cycle < 2; cycle++) {
+        for (int i = 0; i < O; i++) {
+            values.push_back(valuePool->obtain(VehiclePropertyType::INT32));
+        }
+        std::thread([&values] { values.clear(); }).join();
+    }
+
+    const uint32_t magazineSize = ObjectPool<VehiclePropValue>::kDefaultMagazineSize;
+    ASSERT_EQ(static_cast<uint32_t>(2 * O), stats->Obtained);
+    // Only the magazine of the exiting thread is lost.
+    ASSERT_GE(static_cast<uint32_t>(O) + magazineSize, stats->Created);
+    ASSERT_LT(static_cast<uint32_t>(O / 2), stats->ThreadCacheHits);
+    ASSERT_LT(0u, stats->SharedPoolHits);
+    // The shared pool lock is taken once per half magazine.
+    ASSERT_GE(static_cast<uint32_t>(O) / (magazineSize / 2) + 1, stats->SharedPoolHits);
+}
+
 TEST_F(VehicleObjectPoolTest, valuePoolMultithreadedBenchmark) {
     // In this test we have T threads that concurrently in C cycles
     // obtain and release O VehiclePropValue objects of FLOAT / INT32 types.
@@ -114,8 +206,10 @@ TEST_F(VehicleObjectPoolTest, valuePoolMultithreadedBenchmark) {
 
     ASSERT_EQ(static_cast<uint32_t>(T * C * O), stats->Obtained);
     ASSERT_EQ(static_cast<uint32_t>(T * C * O), stats->Recycled);
-    // Created less than obtained.
-    ASSERT_GE(static_cast<uint32_t>(T * O), stats->Created);
+    // Created less than obtained. Besides the objects in use, each thread may have a magazine of
+    // each type cached while the other one creates objects.
+    const uint32_t magazineSize = ObjectPool<VehiclePropValue>::kDefaultMagazineSize;
+    ASSERT_GE(static_cast<uint32_t>(T * O) + T * 2 * magazineSize, stats->Created);
 
     auto elapsedMs = (finish - start) / 1000000;
     ASSERT_GE(1000, elapsedMs);  // Less a second to access 100K objects.
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "vhal_v2_0/VehiclePropertyStore.h"
+#include "vhal_v2_0/VehicleUtils.h"
+
+namespace android {
+namespace hardware {
+namespace automotive {
+namespace vehicle {
+namespace V2_0 {
+
+namespace {
+
+constexpr int32_t kGlobalProp = toInt(VehicleProperty::PERF_VEHICLE_SPEED);
+constexpr int32_t kZonedProp = toInt(VehicleProperty::HVAC_FAN_SPEED);
+constexpr int32_t kTokenProp = toInt(VehicleProperty::OBD2_FREEZE_FRAME);
+constexpr int32_t kLeftSeat = toInt(VehicleAreaSeat::ROW_1_LEFT);
+constexpr int32_t kRightSeat = toInt(VehicleAreaSeat::ROW_1_RIGHT);
+
+VehiclePropValue makeValue(int32_t prop, int32_t area, int32_t value, int64_t timestamp = 0) {
+    VehiclePropValue propValue;
+    propValue.prop = prop;
+    propValue.areaId = area;
+    propValue.timestamp = timestamp;
+    propValue.status = VehiclePropertyStatus::AVAILABLE;
+    propValue.value.int32Values = std::vector<int32_t> { value };
+    return propValue;
+}
+
+class VehiclePropertyStoreTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        VehiclePropConfig global;
+        global.prop = kGlobalProp;
+        store.registerProperty(global);
+
+        VehiclePropConfig zoned;
+        zoned.prop = kZonedProp;
+        zoned.areaConfigs = std::vector<VehicleAreaConfig> { { .areaId = kLeftSeat } };
+        store.registerProperty(zoned);
+
+        VehiclePropConfig tokenized;
+        tokenized.prop = kTokenProp;
+        store.registerProperty(tokenized, [](const VehiclePropValue& value) {
+            return value.timestamp;
+        });
+    }
+
+public:
+    VehiclePropertyStore store;
+};
+
+TEST_F(VehiclePropertyStoreTest, unregisteredProperty) {
+    ASSERT_FALSE(store.writeValue(makeValue(toInt(VehicleProperty::INFO_MAKE), 0, 1), true));
+    ASSERT_EQ(nullptr, store.getConfigOrNull(toInt(VehicleProperty::INFO_MAKE)));
+    ASSERT_EQ(nullptr, store.readSnapshotOrNull(toInt(VehicleProperty::INFO_MAKE)));
+    ASSERT_EQ(3u, store.getAllConfigs().size());
+}
+
+TEST_F(VehiclePropertyStoreTest, latestValuePerArea) {
+    ASSERT_TRUE(store.writeValue(makeValue(kZonedProp, kLeftSeat, 1), true));
+    // Areas without a config get their slot on first write.
+    ASSERT_TRUE(store.writeValue(makeValue(kZonedProp, kRightSeat, 2), true));
+    ASSERT_TRUE(store.writeValue(makeValue(kZonedProp, kLeftSeat, 3), true));
+
+    auto left = store.readSnapshotOrNull(kZonedProp, kLeftSeat);
+    ASSERT_NE(nullptr, left);
+    ASSERT_EQ(3, left->value.int32Values[0]);
+    auto right = store.readValueOrNull(makeValue(kZonedProp, kRightSeat, 0));
+    ASSERT_NE(nullptr, right);
+    ASSERT_EQ(2, right->value.int32Values[0]);
+    ASSERT_EQ(2u, store.readValuesForProperty(kZonedProp).size());
+
+    // A snapshot is not affected by later writes.
+    ASSERT_TRUE(store.writeValue(makeValue(kZonedProp, kLeftSeat, 4), true));
+    ASSERT_EQ(3, left->value.int32Values[0]);
+
+    store.removeValue(makeValue(kZonedProp, kLeftSeat, 0));
+    ASSERT_EQ(nullptr, store.readSnapshotOrNull(kZonedProp, kLeftSeat));
+    store.removeValuesForProperty(kZonedProp);
+    ASSERT_TRUE(store.readValuesForProperty(kZonedProp).empty());
+}
+
+TEST_F(VehiclePropertyStoreTest, keepsStatusUnlessAsked) {
+    auto value = makeValue(kGlobalProp, 0, 1);
+    value.status = VehiclePropertyStatus::UNAVAILABLE;
+    ASSERT_TRUE(store.writeValue(value, true));
+
+    value.status = VehiclePropertyStatus::AVAILABLE;
+    ASSERT_TRUE(store.writeValue(value, false));
+    ASSERT_EQ(VehiclePropertyStatus::UNAVAILABLE, store.readSnapshotOrNull(kGlobalProp)->status);
+
+    ASSERT_TRUE(store.writeValue(value, true));
+    ASSERT_EQ(VehiclePropertyStatus::AVAILABLE, store.readSnapshotOrNull(kGlobalProp)->status);
+}
+
+TEST_F(VehiclePropertyStoreTest, tokenValues) {
+    ASSERT_TRUE(store.writeValue(makeValue(kTokenProp, 0, 1, 100), true));
+    ASSERT_TRUE(store.writeValue(makeValue(kTokenProp, 0, 2, 200), true));
+
+    ASSERT_EQ(1, store.readSnapshotOrNull(kTokenProp, 0, 100)->value.int32Values[0]);
+    ASSERT_EQ(2, store.readSnapshotOrNull(kTokenProp, 0, 200)->value.int32Values[0]);
+    ASSERT_EQ(nullptr, store.readSnapshotOrNull(kTokenProp, 0, 300));
+    // Properties without a token function only store token 0.
+    ASSERT_TRUE(store.writeValue(makeValue(kGlobalProp, 0, 1), true));
+    ASSERT_EQ(nullptr, store.readSnapshotOrNull(kGlobalProp, 0, 100));
+
+    store.removeValue(makeValue(kTokenProp, 0, 0, 100));
+    ASSERT_EQ(1u, store.readValuesForProperty(kTokenProp).size());
+    ASSERT_EQ(2u, store.readAllValues().size());
+}
+
+TEST_F(VehiclePropertyStoreTest, readsDuringWrites) {
+    constexpr int32_t kWrites = 10000;
+    std::atomic<bool> done { false };
+    std::thread writer([this, &done] {
+        for (int32_t i = 1; i <= kWrites; i++) {
+            auto value = makeValue(kGlobalProp, 0, i);
+            value.value.floatValues = std::vector<float>(i % 16, static_cast<float>(i));
+            store.writeValue(value, true);
+        }
+        done = true;
+    });
+
+    int32_t last = 0;
+    while (!done) {
+        auto value = store.readSnapshotOrNull(kGlobalProp);
+        if (value == nullptr) continue;
+        int32_t current = value->value.int32Values[0];
+        ASSERT_LE(last, current);
+        ASSERT_EQ(static_cast<size_t>(current % 16), value->value.floatValues.size());
+        last = current;
+    }
+    writer.join();
+    ASSERT_EQ(kWrites, store.readSnapshotOrNull(kGlobalProp)->value.int32Values[0]);
+}
+
+}  // namespace
+
+}  // namespace V2_0
+}  // namespace vehicle
+}  // namespace automotive
+}  // namespace hardware
+}  // namespace android
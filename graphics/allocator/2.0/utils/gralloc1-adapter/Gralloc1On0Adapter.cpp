@@ -29,6 +29,7 @@
 #include <sync/sync.h>
 
 #include <inttypes.h>
+#include <stdio.h>
 #include <unistd.h>
 
 template <typename PFN, typename T>
@@ -190,7 +191,13 @@ void Gralloc1On0Adapter::dump(uint32_t* outSize, char* outBuffer)
         size_t actualLength = std::strlen(buffer);
         mCachedDump.resize(actualLength);
         std::copy_n(buffer, actualLength, mCachedDump.begin());
-        *outSize = static_cast<uint32_t>(actualLength);
+
+        char stats[128];
+        snprintf(stats, sizeof(stats),
+                "Gralloc1On0Adapter lock cache: %" PRIu64 " hits, %" PRIu64
+                " misses\n", mLockCacheHits.load(), mLockCacheMisses.load());
+        mCachedDump.append(stats);
+        *outSize = static_cast<uint32_t>(mCachedDump.size());
     } else {
         *outSize = std::min(*outSize,
                 static_cast<uint32_t>(mCachedDump.size()));
@@ -227,14 +234,16 @@ gralloc1_error_t Gralloc1On0Adapter::destroyDescriptor(
 
 Gralloc1On0Adapter::Buffer::Buffer(buffer_handle_t handle,
         gralloc1_backing_store_t store, const Descriptor& descriptor,
-        uint32_t stride, uint32_t numFlexPlanes, bool wasAllocated)
+        uint32_t stride, uint32_t numFlexPlanes, bool wasAllocated,
+        bool lockCacheable)
   : mHandle(handle),
     mReferenceCount(1),
     mStore(store),
     mDescriptor(descriptor),
     mStride(stride),
     mNumFlexPlanes(numFlexPlanes),
-    mWasAllocated(wasAllocated) {}
+    mWasAllocated(wasAllocated),
+    mLockCacheable(lockCacheable) {}
 
 gralloc1_error_t Gralloc1On0Adapter::allocate(
         gralloc1_buffer_descriptor_t id,
@@ -277,10 +286,12 @@ gralloc1_error_t Gralloc1On0Adapter::allocate(
 
     *outBufferHandle = handle;
     auto buffer = std::make_shared<Buffer>(handle, backingStore,
-            *descriptor, stride, numFlexPlanes, true);
+            *descriptor, stride, numFlexPlanes, true,
+            queryLockCacheable(handle));
 
-    std::lock_guard<std::mutex> lock(mBufferMutex);
-    mBuffers.emplace(handle, std::move(buffer));
+    auto& shard = getBufferShard(handle);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.buffers.emplace(handle, std::move(buffer));
 
     return GRALLOC1_ERROR_NONE;
 }
@@ -331,7 +342,8 @@ int32_t Gralloc1On0Adapter::allocateHook(gralloc1_device* device,
 gralloc1_error_t Gralloc1On0Adapter::retain(
         const std::shared_ptr<Buffer>& buffer)
 {
-    std::lock_guard<std::mutex> lock(mBufferMutex);
+    std::lock_guard<std::mutex> lock(
+            getBufferShard(buffer->getHandle()).mutex);
     buffer->retain();
     return GRALLOC1_ERROR_NONE;
 }
@@ -339,12 +351,18 @@ gralloc1_error_t Gralloc1On0Adapter::retain(
 gralloc1_error_t Gralloc1On0Adapter::release(
         const std::shared_ptr<Buffer>& buffer)
 {
-    std::lock_guard<std::mutex> lock(mBufferMutex);
+    buffer_handle_t handle = buffer->getHandle();
+    auto& shard = getBufferShard(handle);
+    std::lock_guard<std::mutex> lock(shard.mutex);
     if (!buffer->release()) {
         return GRALLOC1_ERROR_NONE;
     }
 
-    buffer_handle_t handle = buffer->getHandle();
+    {
+        std::lock_guard<std::mutex> lockStateLock(buffer->getLockMutex());
+        flushDeferredUnlockLocked(*buffer);
+    }
+
     if (buffer->wasAllocated()) {
         ALOGV("Calling free(%p)", handle);
         int result = mDevice->free(mDevice, handle);
@@ -359,7 +377,7 @@ gralloc1_error_t Gralloc1On0Adapter::release(
         }
     }
 
-    mBuffers.erase(handle);
+    shard.buffers.erase(handle);
     return GRALLOC1_ERROR_NONE;
 }
 
@@ -367,10 +385,12 @@ gralloc1_error_t Gralloc1On0Adapter::retain(buffer_handle_t bufferHandle)
 {
     ALOGV("retain(%p)", bufferHandle);
 
-    std::lock_guard<std::mutex> lock(mBufferMutex);
+    auto& shard = getBufferShard(bufferHandle);
+    std::lock_guard<std::mutex> lock(shard.mutex);
 
-    if (mBuffers.count(bufferHandle) != 0) {
-        mBuffers[bufferHandle]->retain();
+    auto iter = shard.buffers.find(bufferHandle);
+    if (iter != shard.buffers.end()) {
+        iter->second->retain();
         return GRALLOC1_ERROR_NONE;
     }
 
@@ -416,8 +436,9 @@ gralloc1_error_t Gralloc1On0Adapter::retain(buffer_handle_t bufferHandle)
             static_cast<gralloc1_consumer_usage_t>(consumerUsage));
 
     auto buffer = std::make_shared<Buffer>(bufferHandle, backingStore,
-            descriptor, stride, numFlexPlanes, false);
-    mBuffers.emplace(bufferHandle, std::move(buffer));
+            descriptor, stride, numFlexPlanes, false,
+            queryLockCacheable(bufferHandle));
+    shard.buffers.emplace(bufferHandle, std::move(buffer));
     return GRALLOC1_ERROR_NONE;
 }
 
@@ -436,6 +457,12 @@ static void syncWaitForever(int fd, const char* logname)
     }
 }
 
+static bool sameRegion(const gralloc1_rect_t& a, const gralloc1_rect_t& b)
+{
+    return a.left == b.left && a.top == b.top && a.width == b.width &&
+            a.height == b.height;
+}
+
 gralloc1_error_t Gralloc1On0Adapter::lock(
         const std::shared_ptr<Buffer>& buffer,
         gralloc1_producer_usage_t producerUsage,
@@ -443,21 +470,77 @@ gralloc1_error_t Gralloc1On0Adapter::lock(
         const gralloc1_rect_t& accessRegion, void** outData,
         int acquireFence)
 {
+    int usage = android_convertGralloc1To0Usage(producerUsage, consumerUsage);
+
+    if (!buffer->isLockCacheable()) {
+        return lockModule(*buffer, usage, accessRegion, outData, acquireFence);
+    }
+
+    std::lock_guard<std::mutex> lock(buffer->getLockMutex());
+    auto& lockState = buffer->getLockState();
+
+    // The previous unlock was deferred and the caller asks for the same
+    // mapping again; hand it out without going through the module
+    if (lockState.unlockDeferred && lockState.usage == usage &&
+            sameRegion(lockState.accessRegion, accessRegion)) {
+        syncWaitForever(acquireFence, "Gralloc1On0Adapter::lock");
+        if (acquireFence >= 0) {
+            close(acquireFence);
+        }
+        lockState.unlockDeferred = false;
+        lockState.lockCount = 1;
+        lockState.reusable = true;
+        if (outData) {
+            *outData = lockState.data;
+        }
+        mLockCacheHits++;
+        return GRALLOC1_ERROR_NONE;
+    }
+
+    flushDeferredUnlockLocked(*buffer);
+    mLockCacheMisses++;
+
+    void* data = nullptr;
+    gralloc1_error_t error = lockModule(*buffer, usage, accessRegion, &data,
+            acquireFence);
+    if (error != GRALLOC1_ERROR_NONE) {
+        return error;
+    }
+    if (outData) {
+        *outData = data;
+    }
+
+    // A lock nested in another one leaves the first mapping alone, and is not
+    // reused as there is more than one to unlock
+    lockState.reusable = lockState.lockCount++ == 0;
+    if (lockState.reusable) {
+        lockState.usage = usage;
+        lockState.accessRegion = accessRegion;
+        lockState.data = data;
+    }
+
+    return GRALLOC1_ERROR_NONE;
+}
+
+gralloc1_error_t Gralloc1On0Adapter::lockModule(const Buffer& buffer,
+        int usage, const gralloc1_rect_t& accessRegion, void** outData,
+        int acquireFence)
+{
+    void* data = nullptr;
     if (mMinorVersion >= 3) {
-        int result = mModule->lockAsync(mModule, buffer->getHandle(),
-                android_convertGralloc1To0Usage(producerUsage, consumerUsage),
-                accessRegion.left, accessRegion.top, accessRegion.width,
-                accessRegion.height, outData, acquireFence);
+        int result = mModule->lockAsync(mModule, buffer.getHandle(),
+                usage, accessRegion.left, accessRegion.top,
+                accessRegion.width, accessRegion.height, &data,
+                acquireFence);
         if (result != 0) {
             return GRALLOC1_ERROR_UNSUPPORTED;
         }
     } else {
         syncWaitForever(acquireFence, "Gralloc1On0Adapter::lock");
 
-        int result = mModule->lock(mModule, buffer->getHandle(),
-                android_convertGralloc1To0Usage(producerUsage, consumerUsage),
-                accessRegion.left, accessRegion.top, accessRegion.width,
-                accessRegion.height, outData);
+        int result = mModule->lock(mModule, buffer.getHandle(),
+                usage, accessRegion.left, accessRegion.top,
+                accessRegion.width, accessRegion.height, &data);
         ALOGV("gralloc0 lock returned %d", result);
         if (result != 0) {
             return GRALLOC1_ERROR_UNSUPPORTED;
@@ -465,6 +548,10 @@ gralloc1_error_t Gralloc1On0Adapter::lock(
             close(acquireFence);
         }
     }
+
+    if (outData) {
+        *outData = data;
+    }
     return GRALLOC1_ERROR_NONE;
 }
 
@@ -475,11 +562,37 @@ gralloc1_error_t Gralloc1On0Adapter::lockFlex(
         const gralloc1_rect_t& accessRegion,
         struct android_flex_layout* outFlex,
         int acquireFence)
+{
+    if (!buffer->isLockCacheable()) {
+        return lockFlexModule(*buffer, producerUsage, consumerUsage,
+                accessRegion, outFlex, acquireFence);
+    }
+
+    // Flex layouts are not cached; the plane array belongs to the caller
+    std::lock_guard<std::mutex> lock(buffer->getLockMutex());
+    flushDeferredUnlockLocked(*buffer);
+
+    gralloc1_error_t error = lockFlexModule(*buffer, producerUsage,
+            consumerUsage, accessRegion, outFlex, acquireFence);
+    if (error == GRALLOC1_ERROR_NONE) {
+        auto& lockState = buffer->getLockState();
+        lockState.lockCount++;
+        lockState.reusable = false;
+    }
+    return error;
+}
+
+gralloc1_error_t Gralloc1On0Adapter::lockFlexModule(const Buffer& buffer,
+        gralloc1_producer_usage_t producerUsage,
+        gralloc1_consumer_usage_t consumerUsage,
+        const gralloc1_rect_t& accessRegion,
+        struct android_flex_layout* outFlex,
+        int acquireFence)
 {
     if (mMinorVersion >= 3) {
         int result = mModule->perform(mModule,
                 GRALLOC1_ADAPTER_PERFORM_LOCK_FLEX,
-                buffer->getHandle(),
+                buffer.getHandle(),
                 static_cast<int>(producerUsage),
                 static_cast<int>(consumerUsage),
                 accessRegion.left,
@@ -495,7 +608,7 @@ gralloc1_error_t Gralloc1On0Adapter::lockFlex(
 
         int result = mModule->perform(mModule,
                 GRALLOC1_ADAPTER_PERFORM_LOCK_FLEX,
-                buffer->getHandle(),
+                buffer.getHandle(),
                 static_cast<int>(producerUsage),
                 static_cast<int>(consumerUsage),
                 accessRegion.left,
@@ -516,10 +629,41 @@ gralloc1_error_t Gralloc1On0Adapter::lockFlex(
 gralloc1_error_t Gralloc1On0Adapter::unlock(
         const std::shared_ptr<Buffer>& buffer,
         int* outReleaseFence)
+{
+    if (!buffer->isLockCacheable()) {
+        return unlockModule(*buffer, outReleaseFence);
+    }
+
+    std::lock_guard<std::mutex> lock(buffer->getLockMutex());
+    auto& lockState = buffer->getLockState();
+
+    // Also covers a second unlock after a deferred one, which would otherwise
+    // unlock the module twice
+    if (lockState.lockCount == 0) {
+        ALOGE("Unlocking %p, which is not locked", buffer->getHandle());
+        return GRALLOC1_ERROR_BAD_VALUE;
+    }
+
+    // Keep the mapping around for the next lock.  The module promised
+    // coherency for this buffer, so there is nothing to wait for.
+    if (lockState.lockCount == 1 && lockState.reusable) {
+        lockState.lockCount = 0;
+        lockState.reusable = false;
+        lockState.unlockDeferred = true;
+        *outReleaseFence = -1;
+        return GRALLOC1_ERROR_NONE;
+    }
+
+    lockState.lockCount--;
+    return unlockModule(*buffer, outReleaseFence);
+}
+
+gralloc1_error_t Gralloc1On0Adapter::unlockModule(const Buffer& buffer,
+        int* outReleaseFence)
 {
     if (mMinorVersion >= 3) {
         int fenceFd = -1;
-        int result = mModule->unlockAsync(mModule, buffer->getHandle(),
+        int result = mModule->unlockAsync(mModule, buffer.getHandle(),
                 &fenceFd);
         if (result != 0) {
             close(fenceFd);
@@ -528,7 +672,7 @@ gralloc1_error_t Gralloc1On0Adapter::unlock(
             *outReleaseFence = fenceFd;
         }
     } else {
-        int result = mModule->unlock(mModule, buffer->getHandle());
+        int result = mModule->unlock(mModule, buffer.getHandle());
         if (result != 0) {
             ALOGE("gralloc0 unlock failed: %d", result);
         } else {
@@ -538,6 +682,34 @@ gralloc1_error_t Gralloc1On0Adapter::unlock(
     return GRALLOC1_ERROR_NONE;
 }
 
+void Gralloc1On0Adapter::flushDeferredUnlockLocked(Buffer& buffer)
+{
+    auto& lockState = buffer.getLockState();
+    if (!lockState.unlockDeferred) {
+        return;
+    }
+    lockState.unlockDeferred = false;
+
+    ALOGV("Flushing deferred unlock of %p", buffer.getHandle());
+    if (mMinorVersion >= 3) {
+        int fenceFd = -1;
+        int result = mModule->unlockAsync(mModule, buffer.getHandle(),
+                &fenceFd);
+        if (result != 0) {
+            ALOGE("gralloc0 unlockAsync failed: %d", result);
+        }
+        syncWaitForever(fenceFd, "Gralloc1On0Adapter::flushDeferredUnlock");
+        if (fenceFd >= 0) {
+            close(fenceFd);
+        }
+    } else {
+        int result = mModule->unlock(mModule, buffer.getHandle());
+        if (result != 0) {
+            ALOGE("gralloc0 unlock failed: %d", result);
+        }
+    }
+}
+
 std::shared_ptr<Gralloc1On0Adapter::Descriptor>
 Gralloc1On0Adapter::getDescriptor(gralloc1_buffer_descriptor_t descriptorId)
 {
@@ -552,12 +724,30 @@ Gralloc1On0Adapter::getDescriptor(gralloc1_buffer_descriptor_t descriptorId)
 std::shared_ptr<Gralloc1On0Adapter::Buffer> Gralloc1On0Adapter::getBuffer(
         buffer_handle_t bufferHandle)
 {
-    std::lock_guard<std::mutex> lock(mBufferMutex);
-    if (mBuffers.count(bufferHandle) == 0) {
+    auto& shard = getBufferShard(bufferHandle);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto iter = shard.buffers.find(bufferHandle);
+    if (iter == shard.buffers.end()) {
         return nullptr;
     }
 
-    return mBuffers[bufferHandle];
+    return iter->second;
+}
+
+Gralloc1On0Adapter::BufferShard& Gralloc1On0Adapter::getBufferShard(
+        buffer_handle_t bufferHandle)
+{
+    // native_handle_t allocations are at least 16-byte aligned
+    auto key = reinterpret_cast<uintptr_t>(bufferHandle) >> 4;
+    return mBufferShards[key % kBufferShardCount];
+}
+
+bool Gralloc1On0Adapter::queryLockCacheable(buffer_handle_t bufferHandle)
+{
+    int cacheable = 0;
+    mModule->perform(mModule, GRALLOC1_ADAPTER_PERFORM_GET_LOCK_CACHEABLE,
+            bufferHandle, &cacheable);
+    return cacheable != 0;
 }
 
 std::atomic<gralloc1_buffer_descriptor_t>
@@ -20,6 +20,7 @@
 #include <hardware/gralloc1.h>
 #include <log/log.h>
 
+#include <array>
 #include <atomic>
 #include <memory>
 #include <mutex>
@@ -197,7 +198,8 @@ private:
     public:
         Buffer(buffer_handle_t handle, gralloc1_backing_store_t store,
                 const Descriptor& descriptor, uint32_t stride,
-                uint32_t numFlexPlanes, bool wasAllocated);
+                uint32_t numFlexPlanes, bool wasAllocated,
+                bool lockCacheable);
 
         buffer_handle_t getHandle() const { return mHandle; }
 
@@ -209,6 +211,25 @@ private:
 
         bool wasAllocated() const { return mWasAllocated; }
 
+        bool isLockCacheable() const { return mLockCacheable; }
+
+        // CPU locks of a lock cacheable buffer, used to defer unlock and to
+        // reuse the mapping when the next lock has the same usage and access
+        // region. Guarded by mLockMutex; buffers that are not lock cacheable
+        // do not track it.
+        struct LockState {
+            // Module locks that were not unlocked yet, a deferred one aside
+            uint32_t lockCount = 0;
+            // The only outstanding lock is a lock() described below
+            bool reusable = false;
+            bool unlockDeferred = false;
+            int usage = 0;
+            gralloc1_rect_t accessRegion = {};
+            void* data = nullptr;
+        };
+        std::mutex& getLockMutex() { return mLockMutex; }
+        LockState& getLockState() { return mLockState; }
+
         gralloc1_error_t getBackingStore(
                 gralloc1_backing_store_t* outStore) const {
             *outStore = mStore;
@@ -268,6 +289,13 @@ private:
         // being retained here), which determines whether to free or unregister
         // the buffer when this Buffer is released
         const bool mWasAllocated;
+
+        // Whether the gralloc0 module reported the CPU mapping as coherent
+        // across unlock/lock pairs
+        const bool mLockCacheable;
+
+        std::mutex mLockMutex;
+        LockState mLockState;
     };
 
     template <typename ...Args>
@@ -359,6 +387,18 @@ private:
             struct android_flex_layout* outFlex,
             int acquireFence);
 
+    // Lock and unlock through the module, without lock caching
+    gralloc1_error_t lockModule(const Buffer& buffer, int usage,
+            const gralloc1_rect_t& accessRegion, void** outData,
+            int acquireFence);
+    gralloc1_error_t lockFlexModule(const Buffer& buffer,
+            gralloc1_producer_usage_t producerUsage,
+            gralloc1_consumer_usage_t consumerUsage,
+            const gralloc1_rect_t& accessRegion,
+            struct android_flex_layout* outFlex,
+            int acquireFence);
+    gralloc1_error_t unlockModule(const Buffer& buffer, int* outReleaseFence);
+
     template <typename OUT, gralloc1_error_t (Gralloc1On0Adapter::*member)(
             const std::shared_ptr<Buffer>&, gralloc1_producer_usage_t,
             gralloc1_consumer_usage_t, const gralloc1_rect_t&, OUT*,
@@ -418,6 +458,10 @@ private:
 
     gralloc1_error_t unlock(const std::shared_ptr<Buffer>& buffer,
             int* outReleaseFence);
+
+    // Performs an unlock that was deferred by unlock(); mLockMutex of the
+    // buffer must be held
+    void flushDeferredUnlockLocked(Buffer& buffer);
     static int32_t unlockHook(gralloc1_device_t* device,
             buffer_handle_t bufferHandle, int32_t* outReleaseFenceFd) {
         auto adapter = getAdapter(device);
@@ -444,12 +488,25 @@ private:
             gralloc1_buffer_descriptor_t descriptorId);
     std::shared_ptr<Buffer> getBuffer(buffer_handle_t bufferHandle);
 
+    bool queryLockCacheable(buffer_handle_t bufferHandle);
+
     static std::atomic<gralloc1_buffer_descriptor_t> sNextBufferDescriptorId;
     std::mutex mDescriptorMutex;
     std::unordered_map<gralloc1_buffer_descriptor_t,
             std::shared_ptr<Descriptor>> mDescriptors;
-    std::mutex mBufferMutex;
-    std::unordered_map<buffer_handle_t, std::shared_ptr<Buffer>> mBuffers;
+
+    // Buffers are spread over shards keyed by handle so that lock/unlock on
+    // different buffers do not contend on a single registry mutex
+    struct BufferShard {
+        std::mutex mutex;
+        std::unordered_map<buffer_handle_t, std::shared_ptr<Buffer>> buffers;
+    };
+    static constexpr size_t kBufferShardCount = 16;
+    BufferShard& getBufferShard(buffer_handle_t bufferHandle);
+    std::array<BufferShard, kBufferShardCount> mBufferShards;
+
+    std::atomic<uint64_t> mLockCacheHits{0};
+    std::atomic<uint64_t> mLockCacheMisses{0};
 };
 
 } // namespace hardware
@@ -79,6 +79,17 @@ enum {
     //                    int acquireFence);
     GRALLOC1_ADAPTER_PERFORM_LOCK_FLEX =
         GRALLOC1_ADAPTER_PERFORM_FIRST + 9,
+
+    // void getLockCacheable(..., buffer_handle_t buffer,
+    //                            int* outCacheable);
+    //
+    // Sets *outCacheable to non-zero when the CPU mapping returned by lock
+    // stays coherent across unlock/lock pairs, so that the adapter may defer
+    // unlock and hand the same mapping to a following lock with identical
+    // usage and access region.  Modules that do not implement this are
+    // treated as not cacheable.
+    GRALLOC1_ADAPTER_PERFORM_GET_LOCK_CACHEABLE =
+        GRALLOC1_ADAPTER_PERFORM_FIRST + 10,
 };
 
 int gralloc1_adapter_device_open(const struct hw_module_t* module,
@@ -623,6 +623,13 @@ class CommandReaderBase {
    protected:
     bool isEmpty() const { return (mDataRead >= mDataSize); }
 
+    // go back to the first command of the queue
+    void rewind() {
+        mDataRead = 0;
+        mCommandBegin = 0;
+        mCommandEnd = 0;
+    }
+
     bool beginCommand(IComposerClient::Command* outCommand, uint16_t* outLength) {
         if (mCommandEnd) {
             LOG_FATAL("endCommand was not called for last command");
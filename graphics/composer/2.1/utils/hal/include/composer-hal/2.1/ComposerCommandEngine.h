@@ -54,6 +54,8 @@ class ComposerCommandEngine : protected CommandReaderBase {
             return Error::BAD_PARAMETER;
         }
 
+        prefetchLayerBuffers();
+
         IComposerClient::Command command;
         uint16_t length = 0;
         while (!isEmpty()) {
@@ -84,9 +86,43 @@ class ComposerCommandEngine : protected CommandReaderBase {
     void reset() {
         CommandReaderBase::reset();
         mWriter.reset();
+
+        // the reply has been sent; now is the time to call into the mapper
+        mResources->releaseDeferredBuffers();
     }
 
    protected:
+    // Import the buffers of all SET_LAYER_BUFFER commands in the queue before
+    // executing any of them, so that the imports happen in one batch ahead
+    // of validate rather than interleaved with the ComposerHal calls.
+    void prefetchLayerBuffers() {
+        IComposerClient::Command command;
+        uint16_t length = 0;
+        while (!isEmpty()) {
+            if (!beginCommand(&command, &length)) {
+                break;
+            }
+
+            const uint32_t commandEnd = mDataRead + length;
+            if (command == IComposerClient::Command::SET_LAYER_BUFFER &&
+                length == CommandWriterBase::kSetLayerBufferLength) {
+                bool useCache = false;
+                read();  // slot
+                auto rawHandle = readHandle(&useCache);
+                if (!useCache && rawHandle) {
+                    // errors are reported when the command is executed
+                    mResources->prefetchLayerBuffer(rawHandle);
+                }
+            }
+
+            // the rest of the command is parsed when it is executed
+            mDataRead = commandEnd;
+            endCommand();
+        }
+
+        rewind();
+    }
+
     virtual bool executeCommand(IComposerClient::Command command, uint16_t length) {
         switch (command) {
             case IComposerClient::Command::SELECT_DISPLAY:
@@ -195,7 +231,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
         bool closeFence = true;
 
         const native_handle_t* clientTarget;
-        ComposerResources::ReplacedBufferHandle replacedClientTarget;
+        ComposerResources::ReplacedBufferHandle replacedClientTarget(true /* deferFree */);
         auto err = mResources->getDisplayClientTarget(mCurrentDisplay, slot, useCache, rawHandle,
                                                       &clientTarget, &replacedClientTarget);
         if (err == Error::NONE) {
@@ -226,7 +262,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
         bool closeFence = true;
 
         const native_handle_t* outputBuffer;
-        ComposerResources::ReplacedBufferHandle replacedOutputBuffer;
+        ComposerResources::ReplacedBufferHandle replacedOutputBuffer(true /* deferFree */);
         auto err = mResources->getDisplayOutputBuffer(mCurrentDisplay, slot, useCache, rawhandle,
                                                       &outputBuffer, &replacedOutputBuffer);
         if (err == Error::NONE) {
@@ -369,7 +405,7 @@ class ComposerCommandEngine : protected CommandReaderBase {
         bool closeFence = true;
 
         const native_handle_t* buffer;
-        ComposerResources::ReplacedBufferHandle replacedBuffer;
+        ComposerResources::ReplacedBufferHandle replacedBuffer(true /* deferFree */);
         auto err = mResources->getLayerBuffer(mCurrentDisplay, mCurrentLayer, slot, useCache,
                                               rawHandle, &buffer, &replacedBuffer);
         if (err == Error::NONE) {
@@ -39,6 +39,8 @@ namespace hal {
 // wrapper for IMapper to import buffers and sideband streams
 class ComposerHandleImporter {
    public:
+    ~ComposerHandleImporter() { freeDeferredBuffers(); }
+
     bool init() {
         mMapper3 = mapper::V3_0::IMapper::getService();
         if (mMapper3) {
@@ -98,6 +100,28 @@ class ComposerHandleImporter {
         }
     }
 
+    // Queue a buffer to be freed by freeDeferredBuffers, so that mapper calls
+    // can be kept out of command execution.
+    void deferFreeBuffer(const native_handle_t* bufferHandle) {
+        if (bufferHandle) {
+            std::lock_guard<std::mutex> lock(mDeferredBuffersMutex);
+            mDeferredBuffers.push_back(bufferHandle);
+        }
+    }
+
+    void freeDeferredBuffers() {
+        {
+            std::lock_guard<std::mutex> lock(mDeferredBuffersMutex);
+            // swap so that both vectors keep their capacity
+            mDeferredBuffers.swap(mFreeingBuffers);
+        }
+
+        for (auto bufferHandle : mFreeingBuffers) {
+            freeBuffer(bufferHandle);
+        }
+        mFreeingBuffers.clear();
+    }
+
     Error importStream(const native_handle_t* rawHandle, const native_handle_t** outStreamHandle) {
         const native_handle_t* streamHandle = nullptr;
         if (rawHandle) {
@@ -121,6 +145,11 @@ class ComposerHandleImporter {
    private:
     sp<mapper::V2_0::IMapper> mMapper2;
     sp<mapper::V3_0::IMapper> mMapper3;
+
+    std::mutex mDeferredBuffersMutex;
+    std::vector<const native_handle_t*> mDeferredBuffers;
+    // only accessed by freeDeferredBuffers, which is called from one thread
+    std::vector<const native_handle_t*> mFreeingBuffers;
 };
 
 class ComposerHandleCache {
@@ -322,7 +351,7 @@ class ComposerResources {
     }
 
     ComposerResources() = default;
-    virtual ~ComposerResources() = default;
+    virtual ~ComposerResources() { releasePrefetchedBuffers(); }
 
     bool init() { return mImporter.init(); }
 
@@ -421,6 +450,30 @@ class ComposerResources {
                                               outBufferHandle, outReplacedBuffer);
     }
 
+    // Import a layer buffer ahead of the getLayerBuffer call that uses it.
+    // This lets the command engine import all buffers of a frame in one
+    // batch before executing any command.  The imported handle is picked up
+    // by the next getLayerBuffer call with the same rawHandle.
+    Error prefetchLayerBuffer(const native_handle_t* rawHandle) {
+        const native_handle_t* importedHandle = nullptr;
+        Error error = mImporter.importBuffer(rawHandle, &importedHandle);
+        if (error != Error::NONE) {
+            return error;
+        }
+
+        std::lock_guard<std::mutex> lock(mPrefetchedBuffersMutex);
+        mPrefetchedBuffers.emplace_back(rawHandle, importedHandle);
+        return Error::NONE;
+    }
+
+    // Free prefetched buffers that were never used, and buffers whose release
+    // was deferred by ReplacedBufferHandle.  Meant to be called once a batch
+    // of commands has been executed and replied to.
+    void releaseDeferredBuffers() {
+        releasePrefetchedBuffers();
+        mImporter.freeDeferredBuffers();
+    }
+
     Error getLayerSidebandStream(Display display, Layer layer, const native_handle_t* rawHandle,
                                  const native_handle_t** outStreamHandle,
                                  ReplacedStreamHandle* outReplacedStream) {
@@ -463,8 +516,34 @@ class ComposerResources {
         return iter->second.get();
     }
 
+    // return the buffer prefetched for rawHandle, if any
+    bool takePrefetchedBuffer(const native_handle_t* rawHandle,
+                              const native_handle_t** outBufferHandle) {
+        std::lock_guard<std::mutex> lock(mPrefetchedBuffersMutex);
+        for (auto iter = mPrefetchedBuffers.begin(); iter != mPrefetchedBuffers.end(); ++iter) {
+            if (iter->first == rawHandle) {
+                *outBufferHandle = iter->second;
+                mPrefetchedBuffers.erase(iter);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void releasePrefetchedBuffers() {
+        std::lock_guard<std::mutex> lock(mPrefetchedBuffersMutex);
+        for (const auto& prefetched : mPrefetchedBuffers) {
+            mImporter.freeBuffer(prefetched.second);
+        }
+        mPrefetchedBuffers.clear();
+    }
+
     ComposerHandleImporter mImporter;
 
+    // (raw handle, imported handle) pairs imported by prefetchLayerBuffer
+    std::mutex mPrefetchedBuffersMutex;
+    std::vector<std::pair<const native_handle_t*, const native_handle_t*>> mPrefetchedBuffers;
+
     std::mutex mDisplayResourcesMutex;
     std::unordered_map<Display, std::unique_ptr<ComposerDisplayResource>> mDisplayResources;
 
@@ -477,11 +556,16 @@ class ComposerResources {
     };
 
     // When a buffer in the cache is replaced by a new one, we must keep it
-    // alive until it has been replaced in ComposerHal.
+    // alive until it has been replaced in ComposerHal.  When deferFree is set,
+    // buffers are not freed right away but handed to
+    // ComposerHandleImporter::deferFreeBuffer, so that the mapper call happens
+    // after the commands have been executed.  Only the command engine, which
+    // calls releaseDeferredBuffers after each batch, may set it.
     template <bool isBuffer>
     class ReplacedHandle {
        public:
         ReplacedHandle() = default;
+        explicit ReplacedHandle(bool deferFree) : mDeferFree(deferFree) {}
         ReplacedHandle(const ReplacedHandle&) = delete;
         ReplacedHandle& operator=(const ReplacedHandle&) = delete;
 
@@ -490,7 +574,9 @@ class ComposerResources {
         void reset(ComposerHandleImporter* importer = nullptr,
                    const native_handle_t* handle = nullptr) {
             if (mHandle) {
-                if (isBuffer) {
+                if (isBuffer && mDeferFree) {
+                    mImporter->deferFreeBuffer(mHandle);
+                } else if (isBuffer) {
                     mImporter->freeBuffer(mHandle);
                 } else {
                     mImporter->freeStream(mHandle);
@@ -502,6 +588,7 @@ class ComposerResources {
         }
 
        private:
+        const bool mDeferFree = false;
         ComposerHandleImporter* mImporter = nullptr;
         const native_handle_t* mHandle = nullptr;
     };
@@ -514,7 +601,8 @@ class ComposerResources {
 
         // import the raw handle (or ignore raw handle when fromCache is true)
         const native_handle_t* importedHandle = nullptr;
-        if (!fromCache) {
+        if (!fromCache &&
+            !(cache == Cache::LAYER_BUFFER && takePrefetchedBuffer(rawHandle, &importedHandle))) {
             error = (isBuffer) ? mImporter.importBuffer(rawHandle, &importedHandle)
                                : mImporter.importStream(rawHandle, &importedHandle);
             if (error != Error::NONE) {
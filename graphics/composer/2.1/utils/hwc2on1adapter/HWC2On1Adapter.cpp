@@ -511,6 +511,7 @@ HWC2On1Adapter::Display::Display(HWC2On1Adapter& device, HWC2::DisplayType type)
     mDevice(device),
     mStateMutex(),
     mHwc1RequestedContents(nullptr),
+    mHwc1LayerCapacity(0),
     mRetireFence(),
     mChanges(),
     mHwc1Id(-1),
@@ -526,9 +527,10 @@ HWC2On1Adapter::Display::Display(HWC2On1Adapter& device, HWC2::DisplayType type)
     mHasColorTransform(false),
     mLayers(),
     mHwc1LayerMap(),
-    mNumAvailableRects(0),
-    mNextAvailableRect(nullptr),
-    mGeometryChanged(false)
+    mRectArena(),
+    mNumUsedRects(0),
+    mGeometryChanged(false),
+    mLayerOrderChanged(false)
     {}
 
 Error HWC2On1Adapter::Display::acceptChanges() {
@@ -566,7 +568,7 @@ Error HWC2On1Adapter::Display::createLayer(hwc2_layer_t* outLayerId) {
     mDevice.mLayers.emplace(std::make_pair(layer->getId(), layer));
     *outLayerId = layer->getId();
     ALOGV("[%" PRIu64 "] created layer %" PRIu64, mId, *outLayerId);
-    markGeometryChanged();
+    markLayerOrderChanged();
     return Error::None;
 }
 
@@ -589,7 +591,7 @@ Error HWC2On1Adapter::Display::destroyLayer(hwc2_layer_t layerId) {
         }
     }
     ALOGV("[%" PRIu64 "] destroyed layer %" PRIu64, mId, layerId);
-    markGeometryChanged();
+    markLayerOrderChanged();
     return Error::None;
 }
 
@@ -829,6 +831,7 @@ Error HWC2On1Adapter::Display::setActiveConfig(hwc2_config_t configId) {
             return Error::BadConfig;
         }
         mActiveConfig = config;
+        markGeometryChanged();
     }
 
     return Error::None;
@@ -883,7 +886,11 @@ Error HWC2On1Adapter::Display::setColorTransform(android_color_transform_t hint)
 
     ALOGV("%" PRIu64 "] setColorTransform(%d)", mId,
             static_cast<int32_t>(hint));
-    mHasColorTransform = (hint != HAL_COLOR_TRANSFORM_IDENTITY);
+    bool hasColorTransform = (hint != HAL_COLOR_TRANSFORM_IDENTITY);
+    if (hasColorTransform != mHasColorTransform) {
+        mHasColorTransform = hasColorTransform;
+        markGeometryChanged();
+    }
     return Error::None;
 }
 
@@ -1023,7 +1030,7 @@ Error HWC2On1Adapter::Display::updateLayerZ(hwc2_layer_t layerId, uint32_t z) {
 
     layer->setZ(z);
     mLayers.emplace(std::move(layer));
-    markGeometryChanged();
+    markLayerOrderChanged();
 
     return Error::None;
 }
@@ -1214,8 +1221,22 @@ bool HWC2On1Adapter::Display::prepare() {
         return false;
     }
 
-    allocateRequestedContents();
-    assignHwc1LayerIds();
+    // The HWC1 contents persist across frames. Only when the geometry changed
+    // (or the contents had to grow) do the rects and the non-buffer layer
+    // state have to be written again; otherwise only per-frame state is.
+    bool reallocated = allocateRequestedContents();
+    bool geometry = reallocated || mGeometryChanged;
+    if (mLayerOrderChanged) {
+        assignHwc1LayerIds();
+    }
+    if (reallocated) {
+        for (auto& layer : mLayers) {
+            layer->invalidateHwc1State();
+        }
+    }
+    if (geometry) {
+        resetRectArena();
+    }
 
     mHwc1RequestedContents->retireFenceFd = -1;
     mHwc1RequestedContents->flags = 0;
@@ -1231,11 +1252,12 @@ bool HWC2On1Adapter::Display::prepare() {
         auto& hwc1Layer = mHwc1RequestedContents->hwLayers[layer->getHwc1Id()];
         hwc1Layer.releaseFenceFd = -1;
         hwc1Layer.acquireFenceFd = -1;
+        hwc1Layer.hints = 0;
         ALOGV("Applying states for layer %" PRIu64 " ", layer->getId());
-        layer->applyState(hwc1Layer);
+        layer->applyState(hwc1Layer, geometry);
     }
 
-    prepareFramebufferTarget();
+    prepareFramebufferTarget(geometry);
 
     resetGeometryMarker();
 
@@ -1250,7 +1272,7 @@ void HWC2On1Adapter::Display::generateChanges() {
     size_t numLayers = mHwc1RequestedContents->numHwLayers;
     for (size_t hwc1Id = 0; hwc1Id < numLayers; ++hwc1Id) {
         const auto& receivedLayer = mHwc1RequestedContents->hwLayers[hwc1Id];
-        if (mHwc1LayerMap.count(hwc1Id) == 0) {
+        if (hwc1Id >= mHwc1LayerMap.size()) {
             ALOGE_IF(receivedLayer.compositionType != HWC_FRAMEBUFFER_TARGET,
                     "generateChanges: HWC1 layer %zd doesn't have a"
                     " matching HWC2 layer, and isn't the framebuffer target",
@@ -1317,7 +1339,7 @@ void HWC2On1Adapter::Display::addReleaseFences(
     size_t numLayers = hwcContents.numHwLayers;
     for (size_t hwc1Id = 0; hwc1Id < numLayers; ++hwc1Id) {
         const auto& receivedLayer = hwcContents.hwLayers[hwc1Id];
-        if (mHwc1LayerMap.count(hwc1Id) == 0) {
+        if (hwc1Id >= mHwc1LayerMap.size()) {
             if (receivedLayer.compositionType != HWC_FRAMEBUFFER_TARGET) {
                 ALOGE("addReleaseFences: HWC1 layer %zd doesn't have a"
                         " matching HWC2 layer, and isn't the framebuffer"
@@ -1563,16 +1585,15 @@ hwc_rect_t* HWC2On1Adapter::Display::GetRects(size_t numRects) {
         return nullptr;
     }
 
-    if (numRects > mNumAvailableRects) {
+    if (numRects > mRectArena.size() - mNumUsedRects) {
         // This should NEVER happen since we calculated how many rects the
         // display would need.
         ALOGE("Rect allocation failure! SF is likely to crash soon!");
         return nullptr;
 
     }
-    hwc_rect_t* rects = mNextAvailableRect;
-    mNextAvailableRect += numRects;
-    mNumAvailableRects -= numRects;
+    hwc_rect_t* rects = &mRectArena[mNumUsedRects];
+    mNumUsedRects += numRects;
     return rects;
 }
 
@@ -1780,46 +1801,53 @@ void HWC2On1Adapter::Display::initializeActiveConfig() {
 
 }
 
-void HWC2On1Adapter::Display::allocateRequestedContents() {
+bool HWC2On1Adapter::Display::allocateRequestedContents() {
     // What needs to be allocated:
     // 1 hwc_display_contents_1_t
     // 1 hwc_layer_1_t for each layer
-    // 1 hwc_rect_t for each layer's surfaceDamage
-    // 1 hwc_rect_t for each layer's visibleRegion
     // 1 hwc_layer_1_t for the framebuffer
-    // 1 hwc_rect_t for the framebuffer's visibleRegion
-
-    // Count # of surfaceDamage
-    size_t numSurfaceDamages = 0;
-    for (const auto& layer : mLayers) {
-        numSurfaceDamages += layer->getNumSurfaceDamages();
-    }
-
-    // Count # of visibleRegions (start at 1 for mandatory framebuffer target
-    // region)
-    size_t numVisibleRegion = 1;
-    for (const auto& layer : mLayers) {
-        numVisibleRegion += layer->getNumVisibleRegions();
+    //
+    // The rects referenced by the layers live in mRectArena.
+    auto numLayers = mLayers.size() + 1;
+    if (mHwc1RequestedContents && numLayers <= mHwc1LayerCapacity) {
+        return false;
     }
 
-    size_t numRects = numVisibleRegion + numSurfaceDamages;
-    auto numLayers = mLayers.size() + 1;
+    // Leave some headroom so that adding a layer or two does not reallocate
+    // and invalidate the state of every other layer.
+    auto capacity = std::max(numLayers, mHwc1LayerCapacity * 2);
     size_t size = sizeof(hwc_display_contents_1_t) +
-            sizeof(hwc_layer_1_t) * numLayers +
-            sizeof(hwc_rect_t) * numRects;
+            sizeof(hwc_layer_1_t) * capacity;
     auto contents = static_cast<hwc_display_contents_1_t*>(std::calloc(size, 1));
     mHwc1RequestedContents.reset(contents);
-    mNextAvailableRect = reinterpret_cast<hwc_rect_t*>(&contents->hwLayers[numLayers]);
-    mNumAvailableRects = numRects;
+    mHwc1LayerCapacity = capacity;
+    return true;
+}
+
+void HWC2On1Adapter::Display::resetRectArena() {
+    // 1 hwc_rect_t for each layer's visibleRegion
+    // 1 hwc_rect_t for the framebuffer's visibleRegion
+    size_t numRects = 1;
+    for (const auto& layer : mLayers) {
+        numRects += layer->getNumVisibleRegions();
+    }
+
+    // Rects handed out by GetRects must not move, so only grow the arena
+    // while nothing references it.
+    if (numRects > mRectArena.size()) {
+        mRectArena.resize(numRects);
+    }
+    mNumUsedRects = 0;
 }
 
 void HWC2On1Adapter::Display::assignHwc1LayerIds() {
     mHwc1LayerMap.clear();
     size_t nextHwc1Id = 0;
     for (auto& layer : mLayers) {
-        mHwc1LayerMap[nextHwc1Id] = layer;
+        mHwc1LayerMap.push_back(layer);
         layer->setHwc1Id(nextHwc1Id++);
     }
+    mLayerOrderChanged = false;
 }
 
 void HWC2On1Adapter::Display::updateTypeChanges(const hwc_layer_1_t& hwc1Layer,
@@ -1865,16 +1893,24 @@ void HWC2On1Adapter::Display::updateLayerRequests(
     }
 }
 
-void HWC2On1Adapter::Display::prepareFramebufferTarget() {
-    // We check that mActiveConfig is valid in Display::prepare
-    int32_t width = mActiveConfig->getAttribute(Attribute::Width);
-    int32_t height = mActiveConfig->getAttribute(Attribute::Height);
-
+void HWC2On1Adapter::Display::prepareFramebufferTarget(bool geometry) {
     auto& hwc1Target = mHwc1RequestedContents->hwLayers[mLayers.size()];
     hwc1Target.compositionType = HWC_FRAMEBUFFER_TARGET;
     hwc1Target.releaseFenceFd = -1;
     hwc1Target.hints = 0;
     hwc1Target.flags = 0;
+
+    // We will set this to the correct value in set
+    hwc1Target.acquireFenceFd = -1;
+
+    if (!geometry) {
+        return;
+    }
+
+    // We check that mActiveConfig is valid in Display::prepare
+    int32_t width = mActiveConfig->getAttribute(Attribute::Width);
+    int32_t height = mActiveConfig->getAttribute(Attribute::Height);
+
     hwc1Target.transform = 0;
     hwc1Target.blending = HWC_BLENDING_PREMULT;
     if (mDevice.getHwc1MinorVersion() < 3) {
@@ -1893,9 +1929,6 @@ void HWC2On1Adapter::Display::prepareFramebufferTarget() {
     rects[0].right = width;
     rects[0].bottom = height;
     hwc1Target.visibleRegionScreen.rects = rects;
-
-    // We will set this to the correct value in set
-    hwc1Target.acquireFenceFd = -1;
 }
 
 // Layer functions
@@ -1919,7 +1952,8 @@ HWC2On1Adapter::Layer::Layer(Display& display)
     mZ(0),
     mReleaseFence(),
     mHwc1Id(0),
-    mHasUnsupportedPlaneAlpha(false) {}
+    mHasUnsupportedPlaneAlpha(false),
+    mStateChanged(true) {}
 
 bool HWC2On1Adapter::SortLayersByZ::operator()(const std::shared_ptr<Layer>& lhs,
                                                const std::shared_ptr<Layer>& rhs) const {
@@ -1963,19 +1997,19 @@ Error HWC2On1Adapter::Layer::setSurfaceDamage(hwc_region_t damage) {
 
 Error HWC2On1Adapter::Layer::setBlendMode(BlendMode mode) {
     mBlendMode = mode;
-    mDisplay.markGeometryChanged();
+    markStateChanged();
     return Error::None;
 }
 
 Error HWC2On1Adapter::Layer::setColor(hwc_color_t color) {
     mColor = color;
-    mDisplay.markGeometryChanged();
+    markStateChanged();
     return Error::None;
 }
 
 Error HWC2On1Adapter::Layer::setCompositionType(Composition type) {
     mCompositionType = type;
-    mDisplay.markGeometryChanged();
+    markStateChanged();
     return Error::None;
 }
 
@@ -1985,31 +2019,31 @@ Error HWC2On1Adapter::Layer::setDataspace(android_dataspace_t) {
 
 Error HWC2On1Adapter::Layer::setDisplayFrame(hwc_rect_t frame) {
     mDisplayFrame = frame;
-    mDisplay.markGeometryChanged();
+    markStateChanged();
     return Error::None;
 }
 
 Error HWC2On1Adapter::Layer::setPlaneAlpha(float alpha) {
     mPlaneAlpha = alpha;
-    mDisplay.markGeometryChanged();
+    markStateChanged();
     return Error::None;
 }
 
 Error HWC2On1Adapter::Layer::setSidebandStream(const native_handle_t* stream) {
     mSidebandStream = stream;
-    mDisplay.markGeometryChanged();
+    markStateChanged();
     return Error::None;
 }
 
 Error HWC2On1Adapter::Layer::setSourceCrop(hwc_frect_t crop) {
     mSourceCrop = crop;
-    mDisplay.markGeometryChanged();
+    markStateChanged();
     return Error::None;
 }
 
 Error HWC2On1Adapter::Layer::setTransform(Transform transform) {
     mTransform = transform;
-    mDisplay.markGeometryChanged();
+    markStateChanged();
     return Error::None;
 }
 
@@ -2026,7 +2060,7 @@ Error HWC2On1Adapter::Layer::setVisibleRegion(hwc_region_t visible) {
                     compareRects)) {
         mVisibleRegion.resize(visible.numRects);
         std::copy_n(visible.rects, visible.numRects, mVisibleRegion.begin());
-        mDisplay.markGeometryChanged();
+        markStateChanged();
     }
     return Error::None;
 }
@@ -2045,8 +2079,15 @@ const sp<MiniFence>& HWC2On1Adapter::Layer::getReleaseFence() const {
     return mReleaseFence.get();
 }
 
-void HWC2On1Adapter::Layer::applyState(hwc_layer_1_t& hwc1Layer) {
-    applyCommonState(hwc1Layer);
+void HWC2On1Adapter::Layer::applyState(hwc_layer_1_t& hwc1Layer,
+        bool geometry) {
+    if (mStateChanged) {
+        applyCommonState(hwc1Layer);
+        mStateChanged = false;
+    }
+    if (geometry) {
+        applyVisibleRegion(hwc1Layer);
+    }
     applyCompositionType(hwc1Layer);
     switch (mCompositionType) {
         case Composition::SolidColor : applySolidColorState(hwc1Layer); break;
@@ -2150,7 +2191,9 @@ void HWC2On1Adapter::Layer::applyCommonState(hwc_layer_1_t& hwc1Layer) {
     }
 
     hwc1Layer.transform = static_cast<uint32_t>(mTransform);
+}
 
+void HWC2On1Adapter::Layer::applyVisibleRegion(hwc_layer_1_t& hwc1Layer) {
     auto& hwc1VisibleRegion = hwc1Layer.visibleRegionScreen;
     hwc1VisibleRegion.numRects = mVisibleRegion.size();
     hwc_rect_t* rects = mDisplay.GetRects(hwc1VisibleRegion.numRects);
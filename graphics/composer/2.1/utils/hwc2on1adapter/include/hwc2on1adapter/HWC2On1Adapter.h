@@ -26,6 +26,7 @@
 #include "MiniFence.h"
 
 #include <atomic>
+#include <cstdlib>
 #include <map>
 #include <mutex>
 #include <queue>
@@ -271,13 +272,17 @@ private:
 
             std::string dump() const;
 
-            // Return a rect from the pool allocated during validate()
+            // Return a rect from the frame arena sized during validate()
             hwc_rect_t* GetRects(size_t numRects);
 
             hwc_display_contents_1* getDisplayContents();
 
             void markGeometryChanged() { mGeometryChanged = true; }
             void resetGeometryMarker() { mGeometryChanged = false;}
+            void markLayerOrderChanged() {
+                mLayerOrderChanged = true;
+                markGeometryChanged();
+            }
         private:
             class Config {
                 public:
@@ -374,6 +379,7 @@ private:
             // Creates a bi-directional mapping between index in HWC1
             // prepare/set array and Layer object. Stores mapping in
             // mHwc1LayerMap and also updates Layer's attribute mHwc1Id.
+            // Only needs to run when the Z-order of mLayers has changed.
             void assignHwc1LayerIds();
 
             // Called after a response to prepare() has been received:
@@ -387,8 +393,10 @@ private:
                     const Layer& layer);
 
             // Set all fields in HWC1 comm array for layer containing the
-            // HWC_FRAMEBUFFER_TARGET (always the last layer).
-            void prepareFramebufferTarget();
+            // HWC_FRAMEBUFFER_TARGET (always the last layer). If geometry is
+            // false, only the fields HWC1 may modify during prepare() are
+            // reset.
+            void prepareFramebufferTarget(bool geometry);
 
             // Display ID generator.
             static std::atomic<hwc2_display_t> sNextId;
@@ -408,14 +416,29 @@ private:
             // which require locking.
             mutable std::recursive_mutex mStateMutex;
 
-            // Allocate RAM able to store all layers and rects used for
-            // communication with HWC1. Place allocated RAM in variable
-            // mHwc1RequestedContents.
-            void allocateRequestedContents();
+            // Make sure mHwc1RequestedContents can store all layers used for
+            // communication with HWC1. The contents are kept across frames and
+            // only reallocated when the number of layers outgrows them.
+            // Returns true if the contents were reallocated.
+            bool allocateRequestedContents();
+
+            // Reset the rect arena and make sure it can hold every visible
+            // region rect of this frame without reallocating.
+            void resetRectArena();
+
+            struct ContentsDeleter {
+                void operator()(hwc_display_contents_1* contents) const {
+                    std::free(contents);
+                }
+            };
 
             // Array of structs exchanged between client and hwc1 device.
             // Sent to device upon calling prepare().
-            std::unique_ptr<hwc_display_contents_1> mHwc1RequestedContents;
+            std::unique_ptr<hwc_display_contents_1, ContentsDeleter>
+                    mHwc1RequestedContents;
+
+            // Number of hwc_layer_1 structs mHwc1RequestedContents can hold.
+            size_t mHwc1LayerCapacity;
     private:
             DeferredFence mRetireFence;
 
@@ -447,17 +470,23 @@ private:
 
             // Mapping between layer index in array of hwc_display_contents_1*
             // passed to HWC1 during validate/set and Layer object.
-            std::unordered_map<size_t, std::shared_ptr<Layer>> mHwc1LayerMap;
+            std::vector<std::shared_ptr<Layer>> mHwc1LayerMap;
 
-            // All communication with HWC1 via prepare/set is done with one
-            // alloc. This pointer is pointing to a pool of hwc_rect_t.
-            size_t mNumAvailableRects;
-            hwc_rect_t* mNextAvailableRect;
+            // Frame arena backing the hwc_rect_t arrays referenced by
+            // mHwc1RequestedContents. It is only reset when the geometry
+            // changes, so rects handed out stay valid across buffer-only
+            // frames.
+            std::vector<hwc_rect_t> mRectArena;
+            size_t mNumUsedRects;
 
             // True if any of the Layers contained in this Display have been
             // updated with anything other than a buffer since last call to
             // Display::set()
             bool mGeometryChanged;
+
+            // True if a Layer was added, removed or moved in Z since the HWC1
+            // layer ids were last assigned.
+            bool mLayerOrderChanged;
     };
 
     // Utility template calling a Display object method directly based on the
@@ -557,11 +586,23 @@ private:
             void addReleaseFence(int fenceFd);
             const sp<MiniFence>& getReleaseFence() const;
 
-            void setHwc1Id(size_t id) { mHwc1Id = id; }
+            void setHwc1Id(size_t id) {
+                if (mHwc1Id != id) {
+                    mHwc1Id = id;
+                    mStateChanged = true;
+                }
+            }
             size_t getHwc1Id() const { return mHwc1Id; }
 
-            // Write state to HWC1 communication struct.
-            void applyState(struct hwc_layer_1& hwc1Layer);
+            // Force the next applyState() to write all state, e.g. because
+            // the HWC1 communication struct was reallocated.
+            void invalidateHwc1State() { mStateChanged = true; }
+
+            // Write state to HWC1 communication struct. Per-frame state
+            // (buffer, fences and composition type) is always written, the
+            // rest only if it changed since the last call. If geometry is
+            // true the visible region is copied into the Display's rect arena.
+            void applyState(struct hwc_layer_1& hwc1Layer, bool geometry);
 
             std::string dump() const;
 
@@ -576,7 +617,13 @@ private:
                         !mDisplay.getDevice().supportsBackgroundColor());
             }
         private:
+            void markStateChanged() {
+                mStateChanged = true;
+                mDisplay.markGeometryChanged();
+            }
+
             void applyCommonState(struct hwc_layer_1& hwc1Layer);
+            void applyVisibleRegion(struct hwc_layer_1& hwc1Layer);
             void applySolidColorState(struct hwc_layer_1& hwc1Layer);
             void applySidebandState(struct hwc_layer_1& hwc1Layer);
             void applyBufferState(struct hwc_layer_1& hwc1Layer);
@@ -605,6 +652,10 @@ private:
 
             size_t mHwc1Id;
             bool mHasUnsupportedPlaneAlpha;
+
+            // True if state other than the buffer changed since it was last
+            // written to the HWC1 communication struct.
+            bool mStateChanged;
     };
 
     // Utility tempate calling a Layer object method based on ID parameters:
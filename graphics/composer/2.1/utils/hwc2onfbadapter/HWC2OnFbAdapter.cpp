@@ -23,11 +23,16 @@
 #include <algorithm>
 #include <type_traits>
 
+#include <errno.h>
 #include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <sys/prctl.h>
+#include <sys/timerfd.h>
 #include <unistd.h> // for close
 
+#include <cutils/properties.h>
 #include <hardware/fb.h>
 #include <log/log.h>
 #include <sync/sync.h>
@@ -38,6 +43,24 @@ namespace android {
 
 namespace {
 
+constexpr int64_t kDefaultVsyncPeriod = 1'000'000'000 / 60;
+
+// upper bounds of all but the last VsyncThread jitter bucket, in nanoseconds
+constexpr int64_t kJitterBucketBounds[] = {
+        50'000, 100'000, 250'000, 500'000, 1'000'000, 2'000'000, 4'000'000,
+};
+constexpr size_t kNumJitterBucketBounds = sizeof(kJitterBucketBounds) / sizeof(int64_t);
+
+// Some fb HALs leave fps at zero or report garbage; fall back to 60Hz rather
+// than ticking at a nonsensical rate.
+int64_t getVsyncPeriod(const framebuffer_device_t* fbDevice) {
+    if (!(fbDevice->fps >= 1.0f && fbDevice->fps <= 1000.0f)) {
+        ALOGW("fb reports invalid refresh rate %f, assuming 60Hz", fbDevice->fps);
+        return kDefaultVsyncPeriod;
+    }
+    return int64_t(1e9 / fbDevice->fps);
+}
+
 void dumpHook(hwc2_device_t* device, uint32_t* outSize, char* outBuffer) {
     auto& adapter = HWC2OnFbAdapter::cast(device);
     if (outBuffer) {
@@ -655,7 +678,7 @@ HWC2OnFbAdapter::HWC2OnFbAdapter(framebuffer_device_t* fbDevice)
     mFbInfo.width = mFbDevice->width;
     mFbInfo.height = mFbDevice->height;
     mFbInfo.format = mFbDevice->format;
-    mFbInfo.vsync_period_ns = int(1e9 / mFbDevice->fps);
+    mFbInfo.vsync_period_ns = int(getVsyncPeriod(mFbDevice));
     mFbInfo.xdpi_scaled = int(mFbDevice->xdpi * 1000.0f);
     mFbInfo.ydpi_scaled = int(mFbDevice->ydpi * 1000.0f);
 
@@ -663,7 +686,11 @@ HWC2OnFbAdapter::HWC2OnFbAdapter(framebuffer_device_t* fbDevice)
     // for FB devices
     mCapabilities.insert(Capability::PresentFenceIsNotReliable);
 
-    mVsyncThread.start(0, mFbInfo.vsync_period_ns);
+    // vsync fires at phaseOffset + n * period on CLOCK_MONOTONIC
+    int64_t phaseOffset = property_get_int64("ro.vendor.hwc2onfb.vsync_phase_offset_ns", 0);
+    if (!mVsyncThread.start(phaseOffset, mFbInfo.vsync_period_ns)) {
+        ALOGE("failed to start vsync thread");
+    }
 }
 
 HWC2OnFbAdapter& HWC2OnFbAdapter::cast(hw_device_t* device) {
@@ -692,6 +719,8 @@ const HWC2OnFbAdapter::Info& HWC2OnFbAdapter::getInfo() const {
 }
 
 void HWC2OnFbAdapter::updateDebugString() {
+    mDebugString.clear();
+
     if (mFbDevice->common.version >= 1 && mFbDevice->dump) {
         char buffer[4096];
         mFbDevice->dump(mFbDevice, buffer, sizeof(buffer));
@@ -699,6 +728,8 @@ void HWC2OnFbAdapter::updateDebugString() {
 
         mDebugString = buffer;
     }
+
+    mVsyncThread.dump(&mDebugString);
 }
 
 const std::string& HWC2OnFbAdapter::getDebugString() const {
@@ -822,38 +853,42 @@ int64_t HWC2OnFbAdapter::VsyncThread::now() {
     return int64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
 }
 
-bool HWC2OnFbAdapter::VsyncThread::sleepUntil(int64_t t) {
-    struct timespec ts;
-    ts.tv_sec = t / 1'000'000'000;
-    ts.tv_nsec = t % 1'000'000'000;
-
-    while (true) {
-        int error = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
-        if (error) {
-            if (error == EINTR) {
-                continue;
-            }
-            return false;
-        } else {
-            return true;
-        }
+bool HWC2OnFbAdapter::VsyncThread::start(int64_t phaseOffset, int64_t period) {
+    mPeriod = period;
+    mPhaseOffset = phaseOffset % period;
+
+    mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (mTimerFd < 0) {
+        ALOGE("failed to create vsync timer: %s", strerror(errno));
+        return false;
     }
-}
 
-void HWC2OnFbAdapter::VsyncThread::start(int64_t firstVsync, int64_t period) {
-    mNextVsync = firstVsync;
-    mPeriod = period;
     mStarted = true;
     mThread = std::thread(&VsyncThread::vsyncLoop, this);
+
+    return true;
 }
 
 void HWC2OnFbAdapter::VsyncThread::stop() {
     {
         std::lock_guard<std::mutex> lock(mMutex);
+        if (!mStarted) {
+            return;
+        }
         mStarted = false;
+
+        // wake up the thread if it is blocked on the timer
+        if (mTimerArmed) {
+            struct itimerspec spec{};
+            spec.it_value.tv_nsec = 1;
+            timerfd_settime(mTimerFd, 0, &spec, nullptr);
+        }
     }
     mCondition.notify_all();
     mThread.join();
+
+    ::close(mTimerFd);
+    mTimerFd = -1;
 }
 
 void HWC2OnFbAdapter::VsyncThread::setCallback(HWC2_PFN_VSYNC callback, hwc2_callback_data_t data) {
@@ -870,41 +905,133 @@ void HWC2OnFbAdapter::VsyncThread::enableCallback(bool enable) {
     mCondition.notify_all();
 }
 
+void HWC2OnFbAdapter::VsyncThread::dump(std::string* result) {
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+             "VsyncThread: period %" PRId64 "ns, phase offset %" PRId64 "ns, %s\n"
+             "  vsyncs %" PRIu64 ", missed %" PRIu64 ", jitter avg %" PRId64
+             "ns max %" PRId64 "ns\n",
+             mPeriod, mPhaseOffset, mCallbackEnabled ? "enabled" : "disabled", mVsyncCount,
+             mMissedVsyncCount, mVsyncCount ? mTotalJitter / int64_t(mVsyncCount) : 0,
+             mMaxJitter);
+    result->append(buffer);
+
+    int64_t lower = 0;
+    for (size_t i = 0; i < mJitterHistogram.size(); i++) {
+        if (i < kNumJitterBucketBounds) {
+            snprintf(buffer, sizeof(buffer), "  [%7" PRId64 ", %7" PRId64 ")us: %" PRIu64 "\n",
+                     lower / 1000, kJitterBucketBounds[i] / 1000, mJitterHistogram[i]);
+            lower = kJitterBucketBounds[i];
+        } else {
+            snprintf(buffer, sizeof(buffer), "  [%7" PRId64 ",     inf)us: %" PRIu64 "\n",
+                     lower / 1000, mJitterHistogram[i]);
+        }
+        result->append(buffer);
+    }
+}
+
+/*
+ * The timer is armed with an absolute first expiration aligned to
+ * mPhaseOffset and an interval of mPeriod, so the kernel keeps the vsync
+ * grid instead of us accumulating drift from sleep/wakeup latencies.
+ */
+bool HWC2OnFbAdapter::VsyncThread::armTimerLocked() {
+    int64_t t = now();
+    int64_t n = (t - mPhaseOffset + mPeriod - 1) / mPeriod;
+    mNextVsync = mPhaseOffset + mPeriod * n;
+
+    struct itimerspec spec{};
+    spec.it_value.tv_sec = mNextVsync / 1'000'000'000;
+    spec.it_value.tv_nsec = mNextVsync % 1'000'000'000;
+    spec.it_interval.tv_sec = mPeriod / 1'000'000'000;
+    spec.it_interval.tv_nsec = mPeriod % 1'000'000'000;
+    if (timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME, &spec, nullptr)) {
+        ALOGE("failed to arm vsync timer: %s", strerror(errno));
+        mTimerArmed = false;
+        return false;
+    }
+
+    mTimerArmed = true;
+    return true;
+}
+
+void HWC2OnFbAdapter::VsyncThread::disarmTimerLocked() {
+    struct itimerspec spec{};
+    timerfd_settime(mTimerFd, 0, &spec, nullptr);
+    mTimerArmed = false;
+}
+
+void HWC2OnFbAdapter::VsyncThread::recordJitterLocked(int64_t jitter) {
+    static_assert(kNumJitterBucketBounds + 1 == kJitterBucketCount, "bad jitter buckets");
+
+    size_t bucket = 0;
+    while (bucket < kNumJitterBucketBounds && jitter >= kJitterBucketBounds[bucket]) {
+        bucket++;
+    }
+    mJitterHistogram[bucket]++;
+
+    mTotalJitter += jitter;
+    mMaxJitter = std::max(mMaxJitter, jitter);
+}
+
 void HWC2OnFbAdapter::VsyncThread::vsyncLoop() {
     prctl(PR_SET_NAME, "VsyncThread", 0, 0, 0);
 
     std::unique_lock<std::mutex> lock(mMutex);
-    if (!mStarted) {
-        return;
-    }
 
-    while (true) {
+    while (mStarted) {
         if (!mCallbackEnabled) {
+            if (mTimerArmed) {
+                disarmTimerLocked();
+            }
             mCondition.wait(lock, [this] { return mCallbackEnabled || !mStarted; });
             if (!mStarted) {
                 break;
             }
         }
 
+        if (!mTimerArmed && !armTimerLocked()) {
+            // nothing sensible to do but wait for the next enable
+            mCallbackEnabled = false;
+            continue;
+        }
+
         lock.unlock();
 
-        // adjust mNextVsync if necessary
+        uint64_t expirations = 0;
+        ssize_t ret;
+        do {
+            ret = read(mTimerFd, &expirations, sizeof(expirations));
+        } while (ret < 0 && errno == EINTR);
         int64_t t = now();
-        if (mNextVsync < t) {
-            int64_t n = (t - mNextVsync + mPeriod - 1) / mPeriod;
-            mNextVsync += mPeriod * n;
-        }
-        bool fire = sleepUntil(mNextVsync);
 
         lock.lock();
 
-        if (fire) {
-            ALOGV("VsyncThread(%" PRId64 ")", mNextVsync);
-            if (mCallback) {
-                mCallback(mCallbackData, getDisplayId(), mNextVsync);
-            }
-            mNextVsync += mPeriod;
+        if (!mStarted || ret != sizeof(expirations) || !mTimerArmed) {
+            continue;
         }
+
+        // the last expiration is the vsync that just passed
+        int64_t vsync = mNextVsync + mPeriod * int64_t(expirations - 1);
+        if (vsync > t) {
+            continue;
+        }
+        mNextVsync = vsync + mPeriod;
+
+        mVsyncCount++;
+        mMissedVsyncCount += expirations - 1;
+        recordJitterLocked(t - vsync);
+
+        ALOGV("VsyncThread(%" PRId64 ")", vsync);
+        if (mCallback) {
+            mCallback(mCallbackData, getDisplayId(), vsync);
+        }
+    }
+
+    if (mTimerArmed) {
+        disarmTimerLocked();
     }
 }
 
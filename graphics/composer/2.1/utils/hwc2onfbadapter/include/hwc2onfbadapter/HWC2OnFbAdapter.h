@@ -17,6 +17,7 @@
 #ifndef ANDROID_SF_HWC2_ON_FB_ADAPTER_H
 #define ANDROID_SF_HWC2_ON_FB_ADAPTER_H
 
+#include <array>
 #include <condition_variable>
 #include <mutex>
 #include <string>
@@ -100,27 +101,41 @@ private:
     class VsyncThread {
     public:
         static int64_t now();
-        static bool sleepUntil(int64_t t);
 
-        void start(int64_t first, int64_t period);
+        bool start(int64_t phaseOffset, int64_t period);
         void stop();
         void setCallback(HWC2_PFN_VSYNC callback, hwc2_callback_data_t data);
         void enableCallback(bool enable);
+        void dump(std::string* result);
 
     private:
+        // wakeup latency buckets, see kJitterBucketBounds
+        static constexpr size_t kJitterBucketCount = 8;
+
         void vsyncLoop();
-        bool waitUntilNextVsync();
+        bool armTimerLocked();
+        void disarmTimerLocked();
+        void recordJitterLocked(int64_t jitter);
 
         std::thread mThread;
+        int mTimerFd{-1};
         int64_t mNextVsync{0};
         int64_t mPeriod{0};
+        int64_t mPhaseOffset{0};
 
         std::mutex mMutex;
         std::condition_variable mCondition;
         bool mStarted{false};
+        bool mTimerArmed{false};
         HWC2_PFN_VSYNC mCallback{nullptr};
         hwc2_callback_data_t mCallbackData{nullptr};
         bool mCallbackEnabled{false};
+
+        std::array<uint64_t, kJitterBucketCount> mJitterHistogram{};
+        uint64_t mVsyncCount{0};
+        uint64_t mMissedVsyncCount{0};
+        int64_t mMaxJitter{0};
+        int64_t mTotalJitter{0};
     };
     VsyncThread mVsyncThread;
 };
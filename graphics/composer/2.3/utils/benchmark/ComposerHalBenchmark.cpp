@@ -0,0 +1,374 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "ComposerHalBenchmark"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include <android/hardware/graphics/allocator/2.0/IAllocator.h>
+#include <android/hardware/graphics/allocator/3.0/IAllocator.h>
+#include <android/hardware/graphics/mapper/2.0/IMapper.h>
+#include <android/hardware/graphics/mapper/3.0/IMapper.h>
+#include <benchmark/benchmark.h>
+#include <composer-command-buffer/2.3/ComposerCommandBuffer.h>
+#include <composer-hal/2.1/ComposerClient.h>
+#include <composer-hal/2.2/ComposerClient.h>
+#include <composer-hal/2.3/ComposerClient.h>
+#include <cutils/native_handle.h>
+
+#include "FakeComposerHal.h"
+
+// Count heap allocations so that the per-frame allocation rate of the command
+// path can be reported next to its latency.
+static std::atomic<uint64_t> gAllocationCount(0);
+
+void* operator new(size_t size) {
+    gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = malloc(size);
+    if (!ptr) {
+        abort();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+namespace android {
+namespace hardware {
+namespace graphics {
+namespace composer {
+namespace V2_3 {
+namespace benchmark {
+namespace {
+
+using std::chrono::nanoseconds;
+using std::chrono::steady_clock;
+
+constexpr uint32_t kBufferSlotCount = 3;
+constexpr uint32_t kWriterInitialSize = 1024;
+constexpr uint32_t kBufferWidth = 1080;
+constexpr uint32_t kBufferHeight = 1920;
+
+// Real gralloc buffers for the layers that queue a new buffer, so that the
+// engine imports and frees them through the mapper as it does for
+// SurfaceFlinger. The allocator matching the mapper ComposerHandleImporter
+// picks is used.
+class BufferPool {
+   public:
+    ~BufferPool() {
+        for (auto buffer : mBuffers) {
+            native_handle_close(buffer);
+            native_handle_delete(buffer);
+        }
+    }
+
+    bool allocate(uint32_t count) {
+        if (auto mapper3 = mapper::V3_0::IMapper::getService()) {
+            auto allocator3 = allocator::V3_0::IAllocator::getService();
+            return allocator3 != nullptr && allocate(mapper3, allocator3, count);
+        }
+        auto mapper2 = mapper::V2_0::IMapper::getService();
+        auto allocator2 = allocator::V2_0::IAllocator::getService();
+        return mapper2 != nullptr && allocator2 != nullptr && allocate(mapper2, allocator2, count);
+    }
+
+    // Cycles through the pool.
+    const native_handle_t* next() {
+        mNext = (mNext + 1) % mBuffers.size();
+        return mBuffers[mNext];
+    }
+
+   private:
+    template <typename Mapper, typename Allocator>
+    bool allocate(const sp<Mapper>& mapper, const sp<Allocator>& allocator, uint32_t count) {
+        typename Mapper::BufferDescriptorInfo info = {};
+        info.width = kBufferWidth;
+        info.height = kBufferHeight;
+        info.layerCount = 1;
+        info.format = static_cast<decltype(info.format)>(common::V1_0::PixelFormat::RGBA_8888);
+        info.usage = common::V1_0::BufferUsage::COMPOSER_OVERLAY |
+                     common::V1_0::BufferUsage::GPU_TEXTURE;
+
+        bool allocated = false;
+        mapper->createDescriptor(info, [&](const auto& tmpError, const auto& tmpDescriptor) {
+            if (tmpError != std::decay_t<decltype(tmpError)>::NONE) {
+                return;
+            }
+            allocator->allocate(tmpDescriptor, count,
+                                [&](const auto& tmpError, uint32_t, const auto& tmpBuffers) {
+                                    if (tmpError != std::decay_t<decltype(tmpError)>::NONE) {
+                                        return;
+                                    }
+                                    // The handles are owned by the transport.
+                                    for (const auto& buffer : tmpBuffers) {
+                                        mBuffers.push_back(
+                                            native_handle_clone(buffer.getNativeHandle()));
+                                    }
+                                    allocated = true;
+                                });
+        });
+        return allocated && !mBuffers.empty();
+    }
+
+    std::vector<native_handle_t*> mBuffers;
+    size_t mNext = 0;
+};
+
+class NullComposerCallback : public V2_1::IComposerCallback {
+   public:
+    Return<void> onHotplug(Display, Connection) override { return Void(); }
+    Return<void> onRefresh(Display) override { return Void(); }
+    Return<void> onVsync(Display, int64_t) override { return Void(); }
+};
+
+// Consumes the commands returned by the HAL without interpreting them.
+class BenchmarkCommandReader : public V2_1::CommandReaderBase {
+   public:
+    void parse() {
+        while (!isEmpty()) {
+            V2_1::IComposerClient::Command command;
+            uint16_t length;
+            if (!beginCommand(&command, &length)) {
+                break;
+            }
+            for (uint16_t i = 0; i < length; i++) {
+                read();
+            }
+            endCommand();
+        }
+    }
+};
+
+// Each version runs its own ComposerClientImpl and ComposerCommandEngine, and
+// adds one command per layer that only its engine knows about.
+struct Version2_1 {
+    using Client =
+        V2_1::hal::detail::ComposerClientImpl<V2_1::IComposerClient, V2_1::hal::ComposerHal>;
+    using Writer = V2_1::CommandWriterBase;
+
+    static void writeLayerState(Writer* writer) { writer->setLayerPlaneAlpha(1.0f); }
+};
+
+struct Version2_2 {
+    using Client =
+        V2_2::hal::detail::ComposerClientImpl<V2_2::IComposerClient, V2_2::hal::ComposerHal>;
+    using Writer = V2_2::CommandWriterBase;
+
+    static void writeLayerState(Writer* writer) {
+        writer->setLayerFloatColor(V2_2::IComposerClient::FloatColor{1.0f, 1.0f, 1.0f, 1.0f});
+    }
+};
+
+struct Version2_3 {
+    using Client = hal::detail::ComposerClientImpl<IComposerClient, hal::ComposerHal>;
+    using Writer = V2_3::CommandWriterBase;
+
+    static void writeLayerState(Writer* writer) {
+        static const float kIdentity[16] = {1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,
+                                            0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+        writer->setLayerColorTransform(kIdentity);
+    }
+};
+
+// A scene of state.range(0) layers on each of state.range(1) displays, where
+// state.range(2) percent of the layers queue a new buffer every frame, which
+// the engine imports through the mapper, and the rest reuse the buffer cached
+// in their current slot. An untimed first frame fills a slot of every layer.
+template <typename Version>
+void BM_ComposerFrame(::benchmark::State& state) {
+    const uint32_t layerCount = static_cast<uint32_t>(state.range(0));
+    const uint32_t displayCount = static_cast<uint32_t>(state.range(1));
+    const uint32_t churnPercent = static_cast<uint32_t>(state.range(2));
+
+    FakeComposerHal hal(displayCount);
+    typename Version::Client client(&hal);
+    if (!client.init()) {
+        state.SkipWithError("failed to initialize composer client");
+        return;
+    }
+    client.registerCallback(new NullComposerCallback());
+
+    // The buffer slot each layer last queued a buffer in.
+    struct SceneLayer {
+        Layer layer;
+        uint32_t slot;
+    };
+    std::vector<std::vector<SceneLayer>> layers(displayCount);
+    for (Display display = 1; display <= displayCount; display++) {
+        for (uint32_t i = 0; i < layerCount; i++) {
+            client.createLayer(display, kBufferSlotCount, [&](const auto& error, auto layer) {
+                if (error == Error::NONE) {
+                    layers[display - 1].push_back({layer, 0});
+                }
+            });
+        }
+    }
+
+    BufferPool buffers;
+    if (!buffers.allocate(kBufferSlotCount + 1)) {
+        state.SkipWithError("failed to allocate buffers");
+        return;
+    }
+
+    typename Version::Writer writer(kWriterInitialSize);
+    BenchmarkCommandReader reader;
+    const std::vector<V2_1::IComposerClient::Rect> damage = {
+        {0, 0, static_cast<int32_t>(kBufferWidth), static_cast<int32_t>(kBufferHeight)}};
+
+    uint32_t churnAccumulator = 0;
+    auto writeFrame = [&](bool fillSlots) {
+        for (Display display = 1; display <= displayCount; display++) {
+            writer.selectDisplay(display);
+            for (auto& layer : layers[display - 1]) {
+                writer.selectLayer(layer.layer);
+                bool churn = fillSlots;
+                if (!fillSlots) {
+                    churnAccumulator += churnPercent;
+                    if (churnAccumulator >= 100) {
+                        churnAccumulator -= 100;
+                        churn = true;
+                        layer.slot = (layer.slot + 1) % kBufferSlotCount;
+                    }
+                }
+                writer.setLayerBuffer(layer.slot, churn ? buffers.next() : nullptr, -1);
+                writer.setLayerSurfaceDamage(damage);
+                Version::writeLayerState(&writer);
+            }
+            writer.presentOrvalidateDisplay();
+        }
+    };
+
+    // Sends the written frame to the client and reads its reply. executeStart
+    // and replyStart are set to when each of the two steps started.
+    auto submitFrame = [&](steady_clock::time_point* executeStart,
+                           steady_clock::time_point* replyStart) {
+        bool queueChanged = false;
+        uint32_t commandLength = 0;
+        hidl_vec<hidl_handle> commandHandles;
+        if (!writer.writeQueue(&queueChanged, &commandLength, &commandHandles)) {
+            return false;
+        }
+        if (queueChanged) {
+            client.setInputCommandQueue(*writer.getMQDescriptor());
+        }
+
+        *executeStart = steady_clock::now();
+
+        Error error = Error::NONE;
+        client.executeCommands(
+            commandLength, commandHandles,
+            [&](const auto& tmpError, const auto& tmpOutQueueChanged, const auto& tmpOutLength,
+                const auto& tmpOutHandles) {
+                error = tmpError;
+                if (error != Error::NONE) {
+                    return;
+                }
+                if (tmpOutQueueChanged) {
+                    client.getOutputCommandQueue(
+                        [&](const auto& tmpError, const auto& tmpDescriptor) {
+                            if (tmpError == Error::NONE) {
+                                reader.setMQDescriptor(tmpDescriptor);
+                            }
+                        });
+                }
+                if (!reader.readQueue(tmpOutLength, tmpOutHandles)) {
+                    error = Error::NO_RESOURCES;
+                }
+            });
+
+        *replyStart = steady_clock::now();
+
+        reader.parse();
+        reader.reset();
+        writer.reset();
+        return error == Error::NONE;
+    };
+
+    steady_clock::time_point executeStart;
+    steady_clock::time_point replyStart;
+    writeFrame(true /* fillSlots */);
+    if (!submitFrame(&executeStart, &replyStart)) {
+        state.SkipWithError("failed to execute composer commands");
+        return;
+    }
+
+    nanoseconds encodeTime(0);
+    nanoseconds executeTime(0);
+    nanoseconds replyTime(0);
+    uint64_t allocations = 0;
+    bool failed = false;
+
+    for (auto _ : state) {
+        const uint64_t allocationsBefore = gAllocationCount.load(std::memory_order_relaxed);
+        const auto encodeStart = steady_clock::now();
+
+        writeFrame(false /* fillSlots */);
+        if (!submitFrame(&executeStart, &replyStart)) {
+            failed = true;
+            break;
+        }
+
+        const auto frameEnd = steady_clock::now();
+
+        encodeTime += executeStart - encodeStart;
+        executeTime += replyStart - executeStart;
+        replyTime += frameEnd - replyStart;
+        allocations += gAllocationCount.load(std::memory_order_relaxed) - allocationsBefore;
+    }
+
+    if (failed) {
+        state.SkipWithError("failed to execute composer commands");
+        return;
+    }
+
+    using ::benchmark::Counter;
+    state.counters["encode_ns"] = Counter(encodeTime.count(), Counter::kAvgIterations);
+    state.counters["execute_ns"] = Counter(executeTime.count(), Counter::kAvgIterations);
+    state.counters["reply_ns"] = Counter(replyTime.count(), Counter::kAvgIterations);
+    state.counters["allocs"] = Counter(allocations, Counter::kAvgIterations);
+}
+
+void SceneArguments(::benchmark::internal::Benchmark* b) {
+    b->ArgNames({"layers", "displays", "churn%"});
+    for (int layers : {1, 8, 32}) {
+        for (int displays : {1, 2}) {
+            for (int churn : {0, 50, 100}) {
+                b->Args({layers, displays, churn});
+            }
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_ComposerFrame, Version2_1)->Apply(SceneArguments);
+BENCHMARK_TEMPLATE(BM_ComposerFrame, Version2_2)->Apply(SceneArguments);
+BENCHMARK_TEMPLATE(BM_ComposerFrame, Version2_3)->Apply(SceneArguments);
+
+}  // namespace
+}  // namespace benchmark
+}  // namespace V2_3
+}  // namespace composer
+}  // namespace graphics
+}  // namespace hardware
+}  // namespace android
+
+BENCHMARK_MAIN();
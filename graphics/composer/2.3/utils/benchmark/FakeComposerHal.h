@@ -0,0 +1,331 @@
+/*
+ * Copyright 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <unistd.h>
+
+#include <unordered_map>
+#include <vector>
+
+#include <composer-hal/2.3/ComposerHal.h>
+
+namespace android {
+namespace hardware {
+namespace graphics {
+namespace composer {
+namespace V2_3 {
+namespace benchmark {
+
+using common::V1_1::RenderIntent;
+using common::V1_2::ColorMode;
+using common::V1_2::Dataspace;
+using common::V1_2::Hdr;
+using common::V1_2::PixelFormat;
+using V2_1::Config;
+using V2_1::Display;
+using V2_1::Error;
+using V2_1::Layer;
+
+// FakeComposerHal is an in-memory ComposerHal with no display hardware behind
+// it.  It only keeps the bookkeeping a real HAL needs (displays and layers),
+// so that benchmarks measure the cost of the HIDL composer command path
+// rather than the cost of composition.
+class FakeComposerHal : public hal::ComposerHal {
+   public:
+    explicit FakeComposerHal(uint32_t displayCount) : mDisplayCount(displayCount) {}
+
+    bool hasCapability(hwc2_capability_t capability) override {
+        return capability == HWC2_CAPABILITY_SKIP_VALIDATE;
+    }
+
+    std::string dumpDebugInfo() override { return std::string(); }
+
+    void registerEventCallback(EventCallback* callback) override {
+        mCallback = callback;
+        for (Display display = 1; display <= mDisplayCount; display++) {
+            mDisplays[display];
+            mCallback->onHotplug(display, V2_1::IComposerCallback::Connection::CONNECTED);
+        }
+    }
+
+    void unregisterEventCallback() override { mCallback = nullptr; }
+
+    uint32_t getMaxVirtualDisplayCount() override { return 0; }
+
+    Error createVirtualDisplay_2_2(uint32_t, uint32_t, common::V1_1::PixelFormat*,
+                                   Display*) override {
+        return Error::NO_RESOURCES;
+    }
+
+    Error destroyVirtualDisplay(Display) override { return Error::BAD_DISPLAY; }
+
+    Error createLayer(Display display, Layer* outLayer) override {
+        auto iter = mDisplays.find(display);
+        if (iter == mDisplays.end()) {
+            return Error::BAD_DISPLAY;
+        }
+        *outLayer = mNextLayer++;
+        iter->second.layers.push_back(*outLayer);
+        return Error::NONE;
+    }
+
+    Error destroyLayer(Display display, Layer layer) override {
+        auto iter = mDisplays.find(display);
+        if (iter == mDisplays.end()) {
+            return Error::BAD_DISPLAY;
+        }
+        auto& layers = iter->second.layers;
+        for (auto it = layers.begin(); it != layers.end(); ++it) {
+            if (*it == layer) {
+                layers.erase(it);
+                return Error::NONE;
+            }
+        }
+        return Error::BAD_LAYER;
+    }
+
+    Error getActiveConfig(Display, Config* outConfig) override {
+        *outConfig = 0;
+        return Error::NONE;
+    }
+
+    Error getDisplayAttribute(Display, Config, IComposerClient::Attribute attribute,
+                              int32_t* outValue) override {
+        switch (attribute) {
+            case IComposerClient::Attribute::WIDTH:
+                *outValue = 1080;
+                break;
+            case IComposerClient::Attribute::HEIGHT:
+                *outValue = 1920;
+                break;
+            case IComposerClient::Attribute::VSYNC_PERIOD:
+                *outValue = 16666666;
+                break;
+            default:
+                *outValue = -1;
+                break;
+        }
+        return Error::NONE;
+    }
+
+    Error getDisplayConfigs(Display, hidl_vec<Config>* outConfigs) override {
+        *outConfigs = hidl_vec<Config>{0};
+        return Error::NONE;
+    }
+
+    Error getDisplayName(Display, hidl_string* outName) override {
+        *outName = "fake";
+        return Error::NONE;
+    }
+
+    Error getDisplayType(Display, IComposerClient::DisplayType* outType) override {
+        *outType = IComposerClient::DisplayType::PHYSICAL;
+        return Error::NONE;
+    }
+
+    Error getDozeSupport(Display, bool* outSupport) override {
+        *outSupport = false;
+        return Error::NONE;
+    }
+
+    Error setActiveConfig(Display, Config) override { return Error::NONE; }
+    Error setVsyncEnabled(Display, IComposerClient::Vsync) override { return Error::NONE; }
+    Error setColorTransform(Display, const float*, int32_t) override { return Error::NONE; }
+
+    Error setClientTarget(Display, buffer_handle_t, int32_t acquireFence, int32_t,
+                          const std::vector<hwc_rect_t>&) override {
+        closeFence(acquireFence);
+        return Error::NONE;
+    }
+
+    Error setOutputBuffer(Display, buffer_handle_t, int32_t releaseFence) override {
+        closeFence(releaseFence);
+        return Error::NONE;
+    }
+
+    Error validateDisplay(Display display, std::vector<Layer>*,
+                          std::vector<IComposerClient::Composition>*, uint32_t*,
+                          std::vector<Layer>*, std::vector<uint32_t>*) override {
+        auto iter = mDisplays.find(display);
+        if (iter == mDisplays.end()) {
+            return Error::BAD_DISPLAY;
+        }
+        iter->second.validated = true;
+        return Error::NONE;
+    }
+
+    Error acceptDisplayChanges(Display) override { return Error::NONE; }
+
+    Error presentDisplay(Display display, int32_t* outPresentFence, std::vector<Layer>* outLayers,
+                         std::vector<int32_t>* outReleaseFences) override {
+        auto iter = mDisplays.find(display);
+        if (iter == mDisplays.end()) {
+            return Error::BAD_DISPLAY;
+        }
+        if (!iter->second.validated) {
+            return Error::NOT_VALIDATED;
+        }
+
+        // Report every layer as released so that the release fence path is
+        // exercised like it would be with a real HAL.
+        *outPresentFence = -1;
+        *outLayers = iter->second.layers;
+        outReleaseFences->assign(iter->second.layers.size(), -1);
+        return Error::NONE;
+    }
+
+    Error setLayerCursorPosition(Display, Layer, int32_t, int32_t) override { return Error::NONE; }
+
+    Error setLayerBuffer(Display, Layer, buffer_handle_t, int32_t acquireFence) override {
+        closeFence(acquireFence);
+        return Error::NONE;
+    }
+
+    Error setLayerSurfaceDamage(Display, Layer, const std::vector<hwc_rect_t>&) override {
+        return Error::NONE;
+    }
+    Error setLayerBlendMode(Display, Layer, int32_t) override { return Error::NONE; }
+    Error setLayerColor(Display, Layer, IComposerClient::Color) override { return Error::NONE; }
+    Error setLayerCompositionType(Display, Layer, int32_t) override { return Error::NONE; }
+    Error setLayerDataspace(Display, Layer, int32_t) override { return Error::NONE; }
+    Error setLayerDisplayFrame(Display, Layer, const hwc_rect_t&) override { return Error::NONE; }
+    Error setLayerPlaneAlpha(Display, Layer, float) override { return Error::NONE; }
+    Error setLayerSidebandStream(Display, Layer, buffer_handle_t) override { return Error::NONE; }
+    Error setLayerSourceCrop(Display, Layer, const hwc_frect_t&) override { return Error::NONE; }
+    Error setLayerTransform(Display, Layer, int32_t) override { return Error::NONE; }
+    Error setLayerVisibleRegion(Display, Layer, const std::vector<hwc_rect_t>&) override {
+        return Error::NONE;
+    }
+    Error setLayerZOrder(Display, Layer, uint32_t) override { return Error::NONE; }
+
+    // ComposerHal 2.2 interface
+
+    Error getReadbackBufferFence(Display, base::unique_fd*) override {
+        return Error::UNSUPPORTED;
+    }
+    Error setReadbackBuffer(Display, const native_handle_t*, base::unique_fd) override {
+        return Error::UNSUPPORTED;
+    }
+    Error setPowerMode_2_2(Display, V2_2::IComposerClient::PowerMode) override {
+        return Error::NONE;
+    }
+    Error setLayerFloatColor(Display, Layer, V2_2::IComposerClient::FloatColor) override {
+        return Error::NONE;
+    }
+    Error getRenderIntents(Display, common::V1_1::ColorMode,
+                           std::vector<RenderIntent>* outIntents) override {
+        *outIntents = {RenderIntent::COLORIMETRIC};
+        return Error::NONE;
+    }
+    std::array<float, 16> getDataspaceSaturationMatrix(common::V1_1::Dataspace) override {
+        return {1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,
+                0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+    }
+
+    // ComposerHal 2.3 interface
+
+    Error getPerFrameMetadataKeys_2_3(
+        Display, std::vector<IComposerClient::PerFrameMetadataKey>* outKeys) override {
+        outKeys->clear();
+        return Error::NONE;
+    }
+    Error setColorMode_2_3(Display, ColorMode, RenderIntent) override { return Error::NONE; }
+    Error getRenderIntents_2_3(Display, ColorMode, std::vector<RenderIntent>* outIntents) override {
+        *outIntents = {RenderIntent::COLORIMETRIC};
+        return Error::NONE;
+    }
+    Error getColorModes_2_3(Display, hidl_vec<ColorMode>* outModes) override {
+        *outModes = hidl_vec<ColorMode>{ColorMode::NATIVE};
+        return Error::NONE;
+    }
+    Error getClientTargetSupport_2_3(Display, uint32_t, uint32_t, PixelFormat,
+                                     Dataspace) override {
+        return Error::NONE;
+    }
+    Error getReadbackBufferAttributes_2_3(Display, PixelFormat*, Dataspace*) override {
+        return Error::UNSUPPORTED;
+    }
+    Error getHdrCapabilities_2_3(Display, hidl_vec<Hdr>* outTypes, float* outMaxLuminance,
+                                 float* outMaxAverageLuminance, float* outMinLuminance) override {
+        outTypes->resize(0);
+        *outMaxLuminance = 0.0f;
+        *outMaxAverageLuminance = 0.0f;
+        *outMinLuminance = 0.0f;
+        return Error::NONE;
+    }
+    Error setLayerPerFrameMetadata_2_3(
+        Display, Layer, const std::vector<IComposerClient::PerFrameMetadata>&) override {
+        return Error::NONE;
+    }
+    Error getDisplayIdentificationData(Display, uint8_t*, std::vector<uint8_t>*) override {
+        return Error::UNSUPPORTED;
+    }
+    Error setLayerColorTransform(Display, Layer, const float*) override { return Error::NONE; }
+    Error getDisplayedContentSamplingAttributes(
+        uint64_t, PixelFormat&, Dataspace&,
+        hidl_bitfield<IComposerClient::FormatColorComponent>&) override {
+        return Error::UNSUPPORTED;
+    }
+    Error setDisplayedContentSamplingEnabled(uint64_t, IComposerClient::DisplayedContentSampling,
+                                             hidl_bitfield<IComposerClient::FormatColorComponent>,
+                                             uint64_t) override {
+        return Error::UNSUPPORTED;
+    }
+    Error getDisplayedContentSample(uint64_t, uint64_t, uint64_t, uint64_t&, hidl_vec<uint64_t>&,
+                                    hidl_vec<uint64_t>&, hidl_vec<uint64_t>&,
+                                    hidl_vec<uint64_t>&) override {
+        return Error::UNSUPPORTED;
+    }
+    Error getDisplayCapabilities(
+        Display, std::vector<IComposerClient::DisplayCapability>* outCapabilities) override {
+        outCapabilities->clear();
+        return Error::NONE;
+    }
+    Error setLayerPerFrameMetadataBlobs(
+        Display, Layer, std::vector<IComposerClient::PerFrameMetadataBlob>&) override {
+        return Error::NONE;
+    }
+    Error getDisplayBrightnessSupport(Display, bool* outSupport) override {
+        *outSupport = false;
+        return Error::NONE;
+    }
+    Error setDisplayBrightness(Display, float) override { return Error::UNSUPPORTED; }
+
+   private:
+    static void closeFence(int32_t fence) {
+        if (fence >= 0) {
+            close(fence);
+        }
+    }
+
+    struct DisplayState {
+        std::vector<Layer> layers;
+        bool validated = false;
+    };
+
+    const uint32_t mDisplayCount;
+    EventCallback* mCallback = nullptr;
+    Layer mNextLayer = 1;
+    std::unordered_map<Display, DisplayState> mDisplays;
+};
+
+}  // namespace benchmark
+}  // namespace V2_3
+}  // namespace composer
+}  // namespace graphics
+}  // namespace hardware
+}  // namespace android